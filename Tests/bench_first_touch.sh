@@ -0,0 +1,59 @@
+#!/bin/bash
+# Times symnmf with the rows of W first touched by the threads that update them (the default) against W touched by one thread
+# (SYMNMF_FIRST_TOUCH=serial), with and without pinned threads (OMP_PROC_BIND=spread OMP_PLACES=cores).
+# Both give the same H after the same amount of iterations, so the difference is only in how fast W is read on every iteration.
+# "W GB/s" counts one read of W per iteration over the whole call (including copying W in from Python), so it is a lower bound.
+# On a machine with a single NUMA node the placements are the same, and so should the times be.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/bench_first_touch.sh [n] [k]
+
+N=${1:-6000}
+K=${2:-8}
+POINTS_FILE=$(mktemp)
+trap 'rm -f "$POINTS_FILE"' EXIT
+
+# Prints the iterations symnmf runs on the points, and the best of 3 runs in milliseconds
+time_symnmf() {
+    python3 -c "
+import sys, time, random, math
+import symnmfmodule
+X = [[float(x) for x in line.split(',')] for line in open(sys.argv[1])]
+k = int(sys.argv[2])
+W = symnmfmodule.norm(X)
+m = symnmfmodule.norm_mean(X)
+random.seed(1234)
+H = [[random.uniform(0, 2 * math.sqrt(m / k)) for _ in range(k)] for _ in range(len(X))]
+iterations = []
+symnmfmodule.symnmf_async(W, H, lambda i, delta, objective: iterations.append(i)).result()
+best = None
+for _ in range(3):
+    start = time.perf_counter()
+    symnmfmodule.symnmf(W, H)
+    elapsed = time.perf_counter() - start
+    best = elapsed if best is None else min(best, elapsed)
+print(iterations[-1], '%.3f' % (best * 1000))
+" "$POINTS_FILE" "$K"
+}
+
+echo "Compiling C module..."
+python3 setup.py build_ext --inplace --force > /dev/null || exit 1
+python3 -c "
+import random
+random.seed(0)
+for _ in range($N):
+    print(','.join('%.4f' % random.gauss(0, 1) for _ in range(5)))
+" > "$POINTS_FILE"
+
+NODES=$(ls -d /sys/devices/system/node/node[0-9]* 2> /dev/null | wc -l)
+echo "n=$N k=$K, $(nproc) cpus on ${NODES:-?} NUMA node(s)"
+printf "%-12s %-10s %11s %12s %9s\n" "first touch" "pinning" "iterations" "time (ms)" "W GB/s"
+for touch in serial parallel; do
+    for pinning in none spread; do
+        if [ "$pinning" = none ]; then
+            read -r iterations ms <<< "$(SYMNMF_FIRST_TOUCH=$touch time_symnmf)"
+        else
+            read -r iterations ms <<< "$(SYMNMF_FIRST_TOUCH=$touch OMP_PROC_BIND=spread OMP_PLACES=cores time_symnmf)"
+        fi
+        printf "%-12s %-10s %11s %12s %9.2f\n" "$touch" "$pinning" "$iterations" "$ms" \
+            "$(awk "BEGIN { print $iterations * $N * $N * 8 / ($ms / 1000) / 1e9 }")"
+    done
+done
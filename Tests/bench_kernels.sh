@@ -0,0 +1,47 @@
+#!/bin/bash
+# Times symnmf with the row kernels specialized for k against the generic ones (SYMNMF_KERNELS=generic).
+# Both give the same H after the same amount of iterations, so the speedup is also the per-iteration speedup.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/bench_kernels.sh [n] [k...]
+
+N=${1:-1000}
+shift
+K_VALUES=(${@:-2 3 4 8 12 16 20})
+POINTS_FILE=$(mktemp)
+trap 'rm -f "$POINTS_FILE"' EXIT
+
+# Prints the best of 3 runs of symnmf on the points with the given k, in milliseconds
+time_symnmf() {
+    python3 -c "
+import sys, time, random, math
+import symnmfmodule
+X = [[float(x) for x in line.split(',')] for line in open(sys.argv[1])]
+k = int(sys.argv[2])
+W = symnmfmodule.norm(X)
+m = symnmfmodule.norm_mean(X)
+random.seed(1234)
+H = [[random.uniform(0, 2 * math.sqrt(m / k)) for _ in range(k)] for _ in range(len(X))]
+best = None
+for _ in range(3):
+    start = time.perf_counter()
+    symnmfmodule.symnmf(W, H)
+    elapsed = time.perf_counter() - start
+    best = elapsed if best is None else min(best, elapsed)
+print('%.3f' % (best * 1000))
+" "$POINTS_FILE" "$1"
+}
+
+echo "Compiling C module..."
+python3 setup.py build_ext --inplace --force > /dev/null || exit 1
+python3 -c "
+import random
+random.seed(0)
+for _ in range($N):
+    print(','.join('%.4f' % random.gauss(0, 1) for _ in range(5)))
+" > "$POINTS_FILE"
+
+printf "%-4s %14s %14s %9s\n" "k" "generic (ms)" "fixed k (ms)" "speedup"
+for k in "${K_VALUES[@]}"; do
+    generic=$(SYMNMF_KERNELS=generic time_symnmf "$k")
+    fixed=$(time_symnmf "$k")
+    printf "%-4s %14s %14s %8.2fx\n" "$k" "$generic" "$fixed" "$(awk "BEGIN { print $generic / $fixed }")"
+done
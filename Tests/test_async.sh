@@ -0,0 +1,122 @@
+#!/bin/bash
+# Checks the asynchronous Python API (symnmfmodule.norm_async and symnmf_async): the futures get exactly what the synchronous calls return
+# (also through asyncio), progress reports every iteration in order, a cancelled job - running or still queued - stops at its next iteration
+# (or never starts), an exception raised by progress stops the job and becomes the future's exception, and set_kernel is refused while jobs
+# are queued or running (they read the kernel without the GIL).
+# The pool has a single thread, so the jobs run one after the other in the order they were submitted.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/test_async.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+RESET='\033[0m'
+
+INPUT_FILE=$(mktemp)
+trap 'rm -f "$INPUT_FILE"' EXIT
+
+python3 setup.py build_ext --inplace > /dev/null || exit 1
+python3 -c "
+import random
+random.seed(3)
+centers = [[random.uniform(-2, 2) for _ in range(6)] for _ in range(5)]
+for i in range(600):
+    print(','.join('%.4f' % random.gauss(c, 1.2) for c in centers[i % 5]))
+" > "$INPUT_FILE" # Overlapping clusters, so symnmf takes many iterations
+
+# Prints a line "True message" or "False message" for every check
+results=$(timeout 300 python3 -c "
+import sys, math, random, asyncio, threading
+import symnmfmodule
+symnmfmodule.set_pool(1)
+X = [[float(x) for x in line.split(',')] for line in open(sys.argv[1]) if line.strip()]
+k = 5
+W = symnmfmodule.norm(X)
+random.seed(1234)
+m = symnmfmodule.norm_mean(X)
+H = [[random.uniform(0, 2 * math.sqrt(m / k)) for _ in range(k)] for _ in range(len(X))]
+expected = symnmfmodule.symnmf(W, H)
+
+calls = []
+future = symnmfmodule.symnmf_async(W, H, lambda *report: calls.append(report))
+print(future.result() == expected, 'symnmf_async gives what symnmf does')
+iterations = len(calls)
+print([c[0] for c in calls] == list(range(1, iterations + 1)) and 3 < iterations < 300, 'progress reports every iteration in order')
+print(all(math.isfinite(c[1]) and math.isfinite(c[2]) for c in calls) and calls[-1][1] < 1e-4, 'progress reports delta and the objective')
+print(symnmfmodule.norm_async(X).result() == W, 'norm_async gives what norm does')
+async def awaited():
+    return await asyncio.wait_for(asyncio.wrap_future(symnmfmodule.symnmf_async(W, H)), 60)
+print(asyncio.run(awaited()) == expected, 'symnmf_async can be awaited in asyncio')
+
+# Cancelled while running: progress holds the job at iteration 3 until the future is cancelled
+reached, cancelled, calls = threading.Event(), threading.Event(), []
+def hold_at_3(iteration, delta, objective):
+    calls.append(iteration)
+    if iteration == 3:
+        reached.set()
+        cancelled.wait(60)
+running = symnmfmodule.symnmf_async(W, H, hold_at_3)
+reached.wait(60)
+print(running.cancel(), 'a running job can be cancelled')
+cancelled.set()
+symnmfmodule.norm_async([[0.0], [1.0]]).result() # Runs after the cancelled job is done
+print(running.cancelled() and calls == [1, 2, 3], 'a cancelled job stops at its next iteration')
+
+# Cancelled while queued behind a job that progress holds at its first iteration
+reached, release, calls = threading.Event(), threading.Event(), []
+def hold_at_1(iteration, delta, objective):
+    if iteration == 1:
+        reached.set()
+        release.wait(60)
+first = symnmfmodule.symnmf_async(W, H, hold_at_1)
+queued = symnmfmodule.symnmf_async(W, H, lambda *report: calls.append(report))
+reached.wait(60)
+print(queued.cancel(), 'a queued job can be cancelled')
+release.set()
+print(first.result() == expected and queued.cancelled() and calls == [], 'a cancelled queued job never starts, and the one before it finishes')
+
+# set_kernel while a job is held at its first iteration and another is queued, and once both are done
+reached, release = threading.Event(), threading.Event()
+held = symnmfmodule.symnmf_async(W, H, hold_at_1)
+queued = symnmfmodule.norm_async(X)
+reached.wait(60)
+try:
+    symnmfmodule.set_kernel(2.0)
+    refused = False
+except RuntimeError:
+    refused = True
+release.set()
+print(refused and held.result() == expected and queued.result() == W, 'set_kernel is refused while jobs are queued or running')
+symnmfmodule.set_kernel(2.0)
+changed = symnmfmodule.norm(X) != W
+symnmfmodule.set_kernel(1.0)
+print(changed, 'set_kernel works again once the jobs are done')
+
+# progress raises at iteration 2
+calls = []
+def fail_at_2(iteration, delta, objective):
+    calls.append(iteration)
+    if iteration == 2:
+        raise ValueError('stop here')
+failing = symnmfmodule.symnmf_async(W, H, fail_at_2)
+error = failing.exception(60)
+print(isinstance(error, ValueError) and str(error) == 'stop here' and calls == [1, 2], 'an exception raised by progress stops the job and is the future\'s')
+
+futures = [symnmfmodule.symnmf_async(W, H) if i % 2 else symnmfmodule.norm_async(X) for i in range(6)]
+print(all(f.result() == (expected if i % 2 else W) for i, f in enumerate(futures)), 'many queued jobs all get their results')
+" "$INPUT_FILE" 2>&1)
+status=$?
+
+failed=0
+if [ $status -ne 0 ]; then
+    echo -e "${RED}Failed${RESET}: the checks didn't finish (status $status)"
+    failed=1
+fi
+while read -r result message; do
+    if [ "$result" == "True" ]; then
+        echo -e "${GREEN}Passed${RESET}: $message"
+    else
+        echo -e "${RED}Failed${RESET}: $message"
+        failed=1
+    fi
+done <<< "$results"
+
+exit $failed
@@ -0,0 +1,63 @@
+#!/bin/bash
+# Checks that every job of a batch manifest (./symnmf batch) writes exactly what ./symnmf prints for it, with any amount of parallel jobs,
+# and that a job that fails (on a missing input, or out of memory) neither stops the others nor leaves an output file behind.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/test_batch.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+RESET='\033[0m'
+
+INPUT_FILES=("../Tests/HW1_tests/input_1.txt" "../Tests/HW2_tests/input_1.txt" "../Tests/HW2_tests/input_2.txt" "../Tests/altar.txt")
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+make -s symnmf > /dev/null || exit 1
+jobs=0
+for input_file in "${INPUT_FILES[@]}"; do
+    for goal in sym ddg norm "symnmf 2" "symnmf 4"; do
+        set -- $goal
+        jobs=$((jobs + 1))
+        echo "$1 ${2:--} $input_file $WORK_DIR/out_$jobs.txt" >> "$WORK_DIR/manifest"
+        ./symnmf $1 "$input_file" $2 > "$WORK_DIR/expected_$jobs.txt"
+    done
+done
+echo "symnmf 2 $WORK_DIR/missing.txt $WORK_DIR/missing_out.txt" >> "$WORK_DIR/manifest"
+
+failed=0
+for parallel_jobs in 1 4; do
+    rm -f "$WORK_DIR"/out_*.txt
+    summary=$(./symnmf batch "$WORK_DIR/manifest" $parallel_jobs | tail -n 1)
+    identical=1
+    for j in $(seq 1 $jobs); do
+        cmp -s "$WORK_DIR/expected_$j.txt" "$WORK_DIR/out_$j.txt" || identical=0
+    done
+    if [ $identical -eq 1 ] && [ ! -e "$WORK_DIR/missing_out.txt" ] && [[ "$summary" == "batch: $((jobs + 1)) jobs (1 failed)"* ]]; then
+        echo -e "${GREEN}Passed${RESET}: $jobs jobs with $parallel_jobs parallel jobs"
+    else
+        echo -e "${RED}Failed${RESET}: $jobs jobs with $parallel_jobs parallel jobs (${summary})"
+        failed=1
+    fi
+done
+
+# With memory for one n*n matrix but not the two of ddg, the large ddg job fails on its own and the jobs around it still finish
+python3 -c "
+import random
+random.seed(0)
+for _ in range(3500):
+    print(','.join('%.4f' % random.gauss(0, 1) for _ in range(5)))
+" > "$WORK_DIR/large.txt" # One n*n matrix is about 94 MiB
+{
+    echo "sym - ${INPUT_FILES[0]} $WORK_DIR/before.txt"
+    echo "ddg - $WORK_DIR/large.txt $WORK_DIR/large_out.txt"
+    echo "norm - ${INPUT_FILES[0]} $WORK_DIR/after.txt"
+} > "$WORK_DIR/oom_manifest"
+summary=$(ulimit -v 150000; OMP_NUM_THREADS=1 ./symnmf batch "$WORK_DIR/oom_manifest" 1 | tail -n 1)
+if [[ "$summary" == "batch: 3 jobs (1 failed)"* ]] && [ ! -e "$WORK_DIR/large_out.txt" ] &&
+   cmp -s "$WORK_DIR/before.txt" <(./symnmf sym "${INPUT_FILES[0]}") && cmp -s "$WORK_DIR/after.txt" <(./symnmf norm "${INPUT_FILES[0]}"); then
+    echo -e "${GREEN}Passed${RESET}: a job that runs out of memory fails alone"
+else
+    echo -e "${RED}Failed${RESET}: a job that runs out of memory (${summary})"
+    failed=1
+fi
+
+exit $failed
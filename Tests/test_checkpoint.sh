@@ -0,0 +1,120 @@
+#!/bin/bash
+# Checks checkpointing (SYMNMF_CHECKPOINT): a run killed midway and then resumed from its checkpoint prints exactly what an uninterrupted run does,
+# and a checkpoint of another input (other points of the same n, another kernel width or another seed) is never resumed from.
+# The same goes for the W file symnmf.py keeps in out-of-core mode (SYMNMF_W_FILE): it is only reused for the points and kernel it was built from,
+# and symnmfmodule.symnmf_file reports a W file it can't read as an OSError naming the file, not as out of memory.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/test_checkpoint.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+RESET='\033[0m'
+
+K=6
+export OMP_NUM_THREADS=1
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+CHECKPOINT="$WORK_DIR/checkpoint"
+
+# Writes n points of dimension 8 around 6 cluster centers drawn from the seed to a file
+generate_points() {
+    python3 -c "
+import random, sys
+random.seed(int(sys.argv[2]))
+centers = [[random.uniform(-3, 3) for _ in range(8)] for _ in range(6)]
+for i in range(int(sys.argv[1])):
+    print(','.join('%.4f' % random.gauss(c, 1.2) for c in centers[i % 6]))
+" "$1" "$2" > "$3"
+}
+
+# Prints the iteration of the checkpoint, if it is one of an n*K H of the points in the file (and the default seed)
+checkpoint_iteration() {
+    python3 -c "
+import sys, numpy as np
+import symnmfmodule
+X = np.loadtxt(sys.argv[2], delimiter=',')
+symnmfmodule.checkpoint_input(X.tolist(), 1234)
+info = symnmfmodule.checkpoint_info(sys.argv[1], len(X), int(sys.argv[3]))
+print(info[0] if info is not None else 'none')
+" "$CHECKPOINT" "$1" $K
+}
+
+# Prints "Passed" or "Failed" with the message, depending on whether the two outputs are the same
+compare() {
+    if [ "$1" == "$2" ]; then
+        echo -e "${GREEN}Passed${RESET}: $3"
+    else
+        echo -e "${RED}Failed${RESET}: $3"
+        failed=1
+    fi
+}
+
+make -s symnmf > /dev/null || exit 1
+python3 setup.py build_ext --inplace > /dev/null || exit 1
+generate_points 3000 1 "$WORK_DIR/a.txt"
+generate_points 3000 2 "$WORK_DIR/b.txt"
+generate_points 1200 3 "$WORK_DIR/c.txt"
+generate_points 1200 4 "$WORK_DIR/d.txt"
+failed=0
+
+plain_a=$(./symnmf symnmf "$WORK_DIR/a.txt" $K | md5sum)
+plain_b=$(./symnmf symnmf "$WORK_DIR/b.txt" $K | md5sum)
+
+# Interrupted with SIGKILL as soon as the first checkpoint is on disk, then resumed
+SYMNMF_CHECKPOINT="$CHECKPOINT" SYMNMF_CHECKPOINT_EVERY=1 ./symnmf symnmf "$WORK_DIR/a.txt" $K > /dev/null &
+pid=$!
+while [ ! -f "$CHECKPOINT" ] && kill -0 $pid 2> /dev/null; do
+    sleep 0.01
+done
+kill -KILL $pid 2> /dev/null
+wait $pid 2> /dev/null
+if [ $? -ne 137 ]; then
+    echo -e "${RED}Failed${RESET}: the run finished before it could be interrupted"
+    failed=1
+fi
+iteration=$(checkpoint_iteration "$WORK_DIR/a.txt")
+resumed=$(SYMNMF_CHECKPOINT="$CHECKPOINT" ./symnmf symnmf "$WORK_DIR/a.txt" $K | md5sum)
+compare "$resumed" "$plain_a" "resumed from the checkpoint of iteration $iteration, the output is the uninterrupted one"
+compare "$(SYMNMF_CHECKPOINT="$CHECKPOINT" ./symnmf symnmf "$WORK_DIR/a.txt" $K | md5sum)" "$plain_a" "resumed from the final checkpoint"
+
+# The final checkpoint of a.txt is still there - none of these may resume from it
+compare "$(SYMNMF_CHECKPOINT="$CHECKPOINT" ./symnmf symnmf "$WORK_DIR/b.txt" $K | md5sum)" "$plain_b" "other points of the same n start over"
+compare "$(SYMNMF_CHECKPOINT="$CHECKPOINT" ./symnmf symnmf "$WORK_DIR/a.txt" $K | md5sum)" "$plain_a" "the first points again, after the other ones"
+compare "$(SYMNMF_CHECKPOINT="$CHECKPOINT" SYMNMF_SIGMA=2 ./symnmf symnmf "$WORK_DIR/a.txt" $K | md5sum)" \
+        "$(SYMNMF_SIGMA=2 ./symnmf symnmf "$WORK_DIR/a.txt" $K | md5sum)" "another kernel width starts over"
+compare "$(SYMNMF_CHECKPOINT="$CHECKPOINT" SYMNMF_LOCAL_SCALING=7 ./symnmf symnmf "$WORK_DIR/a.txt" $K | md5sum)" \
+        "$(SYMNMF_LOCAL_SCALING=7 ./symnmf symnmf "$WORK_DIR/a.txt" $K | md5sum)" "local scaling starts over"
+compare "$(SYMNMF_CHECKPOINT="$CHECKPOINT" ./symnmf symnmf "$WORK_DIR/a.txt" $K 99 | md5sum)" \
+        "$(./symnmf symnmf "$WORK_DIR/a.txt" $K 99 | md5sum)" "another seed starts over"
+compare "$(SYMNMF_CHECKPOINT="$CHECKPOINT" ./symnmf --standardize symnmf "$WORK_DIR/a.txt" $K | md5sum)" \
+        "$(./symnmf --standardize symnmf "$WORK_DIR/a.txt" $K | md5sum)" "preprocessed points start over"
+
+# The same through symnmf.py
+rm -f "$CHECKPOINT" "$CHECKPOINT.W"
+SYMNMF_CHECKPOINT="$CHECKPOINT" python3 symnmf.py $K symnmf "$WORK_DIR/c.txt" > /dev/null
+compare "$(SYMNMF_CHECKPOINT="$CHECKPOINT" python3 symnmf.py $K symnmf "$WORK_DIR/d.txt" | md5sum)" \
+        "$(python3 symnmf.py $K symnmf "$WORK_DIR/d.txt" | md5sum)" "symnmf.py starts over on other points of the same n"
+compare "$(SYMNMF_CHECKPOINT="$CHECKPOINT" python3 symnmf.py $K symnmf "$WORK_DIR/d.txt" | md5sum)" \
+        "$(python3 symnmf.py $K symnmf "$WORK_DIR/d.txt" | md5sum)" "symnmf.py resumes from the final checkpoint of the same points"
+
+# The W file of out-of-core mode
+w_file="$WORK_DIR/W.bin"
+SYMNMF_MODE=out-of-core SYMNMF_W_FILE="$w_file" python3 symnmf.py $K symnmf "$WORK_DIR/c.txt" > /dev/null
+compare "$(SYMNMF_MODE=out-of-core SYMNMF_W_FILE="$w_file" python3 symnmf.py $K symnmf "$WORK_DIR/d.txt" | md5sum)" \
+        "$(python3 symnmf.py $K symnmf "$WORK_DIR/d.txt" | md5sum)" "the W file is rebuilt for other points of the same n"
+compare "$(SYMNMF_MODE=out-of-core SYMNMF_W_FILE="$w_file" SYMNMF_SIGMA=2 python3 symnmf.py $K symnmf "$WORK_DIR/d.txt" | md5sum)" \
+        "$(SYMNMF_SIGMA=2 python3 symnmf.py $K symnmf "$WORK_DIR/d.txt" | md5sum)" "the W file is rebuilt for another kernel width"
+touch -d @0 "$w_file"
+compare "$(SYMNMF_MODE=out-of-core SYMNMF_W_FILE="$w_file" SYMNMF_SIGMA=2 python3 symnmf.py $K symnmf "$WORK_DIR/d.txt" | md5sum)" \
+        "$(SYMNMF_SIGMA=2 python3 symnmf.py $K symnmf "$WORK_DIR/d.txt" | md5sum)" "the same points and kernel again give the same output"
+compare "$(stat -c %Y "$w_file")" "0" "the W file of the same points and kernel is reused"
+echo "not a matrix" > "$WORK_DIR/junk.bin"
+compare "$(python3 -c "
+import sys, symnmfmodule
+for w_file in sys.argv[1:]:
+    try:
+        symnmfmodule.symnmf_file(w_file, [[0.5]] * 4)
+    except OSError as error:
+        print(type(error).__name__, error.filename == w_file or w_file in str(error))
+" "$WORK_DIR/missing.bin" "$WORK_DIR/junk.bin" 2>&1)" "$(printf 'FileNotFoundError True\nOSError True')" "symnmf_file raises OSError for a W file it can't read"
+
+exit $failed
@@ -0,0 +1,101 @@
+#!/bin/bash
+# Checks that jobs run on symnmfd print exactly what ./symnmf prints, that clients which connect and send nothing neither hold up
+# the other jobs nor the workers (and get "ERROR timeout" once SYMNMF_RECEIVE_TIMEOUT runs out), that a job which runs out of memory
+# gets "ERROR out of memory" without taking the daemon down, and that the daemon stops cleanly.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/test_daemon.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+RESET='\033[0m'
+
+SOCKET="/tmp/symnmfd-test-$$.sock"
+INPUT_FILES=("../Tests/HW1_tests/input_1.txt" "../Tests/HW2_tests/input_2.txt" "../Tests/altar.txt")
+K=3
+TIMEOUT=3
+
+echo "Compiling C program..."
+make > /dev/null || exit 1
+
+SYMNMF_RECEIVE_TIMEOUT=$TIMEOUT ./symnmfd serve "$SOCKET" 2 2> /dev/null &
+daemon=$!
+for _ in $(seq 50); do [ -S "$SOCKET" ] && break; sleep 0.1; done
+
+failed=0
+check() {
+    if cmp -s <(./symnmf "$@") <(./symnmfd submit "$SOCKET" "$@"); then
+        echo -e "${GREEN}Identical${RESET}: $*"
+    else
+        echo -e "${RED}Different${RESET}: $*"
+        failed=1
+    fi
+}
+
+for input_file in "${INPUT_FILES[@]}"; do
+    for goal in sym ddg norm; do
+        check $goal "$input_file"
+    done
+    check symnmf "$input_file" $K
+done
+check symnmf "${INPUT_FILES[0]}" 0 # Both fail the same way
+
+# As many silent clients as there are workers, each printing the reply it gets and after how many seconds
+idle_replies=$(mktemp)
+for _ in 1 2; do
+    python3 -c "
+import socket, sys, time
+client = socket.socket(socket.AF_UNIX)
+client.connect(sys.argv[1])
+started = time.time()
+print(client.recv(100).decode().strip(), round(time.time() - started))
+" "$SOCKET" >> "$idle_replies" &
+done
+sleep 0.5
+started=$(date +%s.%N)
+check sym "${INPUT_FILES[0]}"
+if awk -v s="$started" -v e="$(date +%s.%N)" 'BEGIN { exit !(e - s < 2) }'; then
+    echo -e "${GREEN}Passed${RESET}: a job next to silent clients runs right away"
+else
+    echo -e "${RED}Failed${RESET}: a job next to silent clients waited for them"
+    failed=1
+fi
+wait $(jobs -p | grep -v "^$daemon$")
+if [ "$(sort -u "$idle_replies")" == "ERROR timeout $TIMEOUT" ]; then
+    echo -e "${GREEN}Passed${RESET}: silent clients get ERROR timeout after ${TIMEOUT}s"
+else
+    echo -e "${RED}Failed${RESET}: silent clients got $(sort -u "$idle_replies" | tr '\n' ';')"
+    failed=1
+fi
+rm -f "$idle_replies"
+
+# A daemon whose memory fits one n*n matrix but not the two of ddg: the ddg job fails alone, and the daemon keeps serving
+small_socket="$SOCKET.small"
+large_input=$(mktemp)
+python3 -c "
+import random
+random.seed(0)
+for _ in range(3500):
+    print(','.join('%.4f' % random.gauss(0, 1) for _ in range(5)))
+" > "$large_input" # One n*n matrix is about 94 MiB
+(ulimit -v 150000; OMP_NUM_THREADS=1 exec ./symnmfd serve "$small_socket" 1 2> /dev/null) &
+small_daemon=$!
+for _ in $(seq 50); do [ -S "$small_socket" ] && break; sleep 0.1; done
+reply=$(./symnmfd submit "$small_socket" ddg "$large_input" 2>&1 | head -n 1)
+if [ "$reply" == "symnmfd: ERROR out of memory" ] && kill -0 $small_daemon 2> /dev/null &&
+   cmp -s <(./symnmf sym "${INPUT_FILES[0]}") <(./symnmfd submit "$small_socket" sym "${INPUT_FILES[0]}"); then
+    echo -e "${GREEN}Passed${RESET}: a job that runs out of memory gets ERROR, and the daemon keeps serving"
+else
+    echo -e "${RED}Failed${RESET}: a job that runs out of memory (reply: $reply)"
+    failed=1
+fi
+kill -TERM $small_daemon 2> /dev/null
+wait $small_daemon
+rm -f "$large_input"
+
+kill -TERM $daemon
+wait $daemon || failed=1
+if [ -e "$SOCKET" ]; then
+    echo -e "${RED}Socket left behind${RESET}: $SOCKET"
+    failed=1
+fi
+
+exit $failed
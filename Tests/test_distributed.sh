@@ -0,0 +1,80 @@
+#!/bin/bash
+# Checks that distributed symnmf (SYMNMF_WORKERS, See distributed.c) gives bit-identical results to the default single-process run,
+# for any amount of worker processes - including more workers than the blocks of rows, and under another kernel width and local scaling.
+# symnmfmodule.symnmf_distributed must reject an H that doesn't have a row for every point before any worker starts.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/test_distributed.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+RESET='\033[0m'
+
+WORKER_COUNTS=(1 2 3 5 8)
+KERNELS=("" "SYMNMF_SIGMA=2" "SYMNMF_LOCAL_SCALING=7")
+K=4
+GENERATED_FILE=$(mktemp)
+trap 'rm -f "$GENERATED_FILE"' EXIT
+INPUT_FILES=("../Tests/HW1_tests/input_1.txt" "../Tests/HW2_tests/input_2.txt" "$GENERATED_FILE")
+
+# Prints a digest of every bit of the full-precision symnmf result under the kernel settings (environment assignments, or nothing),
+# on the given amount of workers (0 - the single-process symnmf of norm)
+digest() {
+    env $1 python3 -c "
+import sys, hashlib, random, math
+import symnmfmodule
+X = [[float(x) for x in line.split(',')] for line in open(sys.argv[1]) if line.strip()]
+k, workers = int(sys.argv[2]), int(sys.argv[3])
+random.seed(1234)
+m = symnmfmodule.norm_mean(X)
+H = [[random.uniform(0, 2 * math.sqrt(m / k)) for _ in range(k)] for _ in range(len(X))]
+H = symnmfmodule.symnmf_distributed(X, H, workers) if workers > 0 else symnmfmodule.symnmf(symnmfmodule.norm(X), H)
+print(hashlib.md5(repr(H).encode()).hexdigest())
+" "$2" "$3" "$4"
+}
+
+# Prints "Identical" or "Different" with the message, depending on whether the two outputs are the same
+compare() {
+    if [ "$1" == "$2" ]; then
+        echo -e "${GREEN}Identical${RESET}: $3"
+    else
+        echo -e "${RED}Different${RESET}: $3"
+        failed=1
+    fi
+}
+
+make -s symnmf > /dev/null || exit 1
+python3 setup.py build_ext --inplace > /dev/null || exit 1
+python3 -c "
+import random
+random.seed(5)
+centers = [[random.uniform(-3, 3) for _ in range(6)] for _ in range(4)]
+for i in range(700):
+    print(','.join('%.4f' % random.gauss(c, 1) for c in centers[i % 4]))
+" > "$GENERATED_FILE" # Several blocks of rows per worker, and rows that don't split evenly among them
+
+failed=0
+for input_file in "${INPUT_FILES[@]}"; do
+    name=$(basename "$input_file")
+    [ "$input_file" == "$GENERATED_FILE" ] && name="generated (n=700)"
+    for kernel in "${KERNELS[@]}"; do
+        expected_cli=$(env $kernel ./symnmf symnmf "$input_file" $K | md5sum)
+        expected=$(digest "$kernel" "$input_file" $K 0)
+        for workers in "${WORKER_COUNTS[@]}"; do
+            compare "$(env $kernel SYMNMF_WORKERS=$workers ./symnmf symnmf "$input_file" $K | md5sum)" "$expected_cli" \
+                    "./symnmf on ${name} with ${workers} workers ${kernel}"
+            compare "$(digest "$kernel" "$input_file" $K $workers)" "$expected" "full precision on ${name} with ${workers} workers ${kernel}"
+        done
+    done
+    compare "$(SYMNMF_MODE=distributed SYMNMF_WORKERS=3 python3 symnmf.py $K symnmf "$input_file" | md5sum)" \
+            "$(python3 symnmf.py $K symnmf "$input_file" | md5sum)" "symnmf.py on ${name} in distributed mode"
+done
+
+compare "$(python3 -c "
+import symnmfmodule
+for X, H in [([[0.0], [1.0], [2.0]], [[0.1]]), ([[0.0], [1.0]], [[0.1], [0.2], [0.3]])]:
+    try:
+        print(symnmfmodule.symnmf_distributed(X, H, 2))
+    except ValueError:
+        print('ValueError')
+" 2>&1)" "$(printf 'ValueError\nValueError')" "symnmf_distributed rejects an H without a row for every point"
+
+exit $failed
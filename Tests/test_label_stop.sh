@@ -0,0 +1,101 @@
+#!/bin/bash
+# Checks the label stability stopping rule (SYMNMF_LABEL_STOP, See label_stop_window): a run that stops on its labels goes through exactly
+# the iterations of a full run up to there, stops on a label check (every 5 iterations) no sooner than the window and only where the objective
+# has settled, and its labels agree with those of the full run. A window the run never reaches changes nothing, and a tolerance stops no later.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/test_label_stop.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+RESET='\033[0m'
+
+K=4
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+INPUT_FILE="$WORK_DIR/input.txt"
+
+# Runs symnmf on the input under the settings (environment assignments, or nothing), and writes the progress reports (iteration delta objective)
+# to name.progress, the labels (argmax of every row of H) to name.labels and the digest of every bit of H to name.digest
+run() {
+    env $2 python3 -c "
+import sys, math, random, hashlib
+import numpy as np
+import symnmfmodule
+X = np.loadtxt(sys.argv[1], delimiter=',').tolist()
+k = int(sys.argv[2])
+W = symnmfmodule.norm(X)
+random.seed(1234)
+m = symnmfmodule.norm_mean(X)
+H = [[random.uniform(0, 2 * math.sqrt(m / k)) for _ in range(k)] for _ in range(len(X))]
+reports = []
+H = symnmfmodule.symnmf_async(W, H, lambda *report: reports.append(report)).result()
+open(sys.argv[3] + '.progress', 'w').write(''.join('%d %r %r\n' % report for report in reports))
+open(sys.argv[3] + '.labels', 'w').write(' '.join(map(str, np.array(H).argmax(axis=1))) + '\n')
+open(sys.argv[3] + '.digest', 'w').write(hashlib.md5(repr(H).encode()).hexdigest() + '\n')
+" "$INPUT_FILE" $K "$WORK_DIR/$1"
+}
+
+# Prints the fraction of points whose labels in the two files are the same
+agreement() {
+    python3 -c "
+import sys
+a, b = open(sys.argv[1]).read().split(), open(sys.argv[2]).read().split()
+print(sum(x == y for x, y in zip(a, b)) / len(a) if len(a) == len(b) else 0)
+" "$1" "$2"
+}
+
+# Prints "Passed" or "Failed" with the message, depending on whether the two outputs are the same
+compare() {
+    if [ "$1" == "$2" ]; then
+        echo -e "${GREEN}Passed${RESET}: $3"
+    else
+        echo -e "${RED}Failed${RESET}: $3"
+        failed=1
+    fi
+}
+
+make -s symnmf > /dev/null || exit 1
+python3 setup.py build_ext --inplace > /dev/null || exit 1
+python3 -c "
+import random
+random.seed(11)
+centers = [[random.uniform(-4, 4) for _ in range(8)] for _ in range(4)]
+for i in range(800):
+    print(','.join('%.4f' % random.gauss(c, 1.5) for c in centers[i % 4]))
+" > "$INPUT_FILE" # Overlapping clusters: the labels settle while H still takes over 100 iterations to converge
+failed=0
+
+run full ""
+full_iterations=$(wc -l < "$WORK_DIR/full.progress")
+run never "SYMNMF_LABEL_STOP=1000"
+compare "$(cat "$WORK_DIR/never.digest")" "$(cat "$WORK_DIR/full.digest")" "a window the run never reaches leaves H as it is"
+
+for settings in "SYMNMF_LABEL_STOP=5" "SYMNMF_LABEL_STOP=10" "SYMNMF_LABEL_STOP=10 SYMNMF_LABEL_TOLERANCE=0.02"; do
+    name=$(echo "$settings" | tr ' =' '__')
+    run "$name" "$settings"
+    window=$(echo "$settings" | sed 's/SYMNMF_LABEL_STOP=\([0-9]*\).*/\1/')
+    iterations=$(wc -l < "$WORK_DIR/$name.progress")
+    compare "$(head -n "$iterations" "$WORK_DIR/full.progress")" "$(cat "$WORK_DIR/$name.progress")" \
+            "$settings goes through the iterations of the full run"
+    compare "$(awk -v i="$iterations" -v w="$window" -v full="$full_iterations" 'BEGIN { print (i < full && i % 5 == 0 && i >= w) }')" "1" \
+            "$settings stops on a label check after the window ($iterations of $full_iterations iterations)"
+    compare "$(awk -v i="$iterations" 'NR == i - 5 { before = $3 } NR == i { print ((before - $3 <= 1e-3 * $3 && $3 - before <= 1e-3 * $3)) }' \
+            "$WORK_DIR/$name.progress")" "1" "$settings stops only once the objective has settled"
+    compare "$(awk -v a="$(agreement "$WORK_DIR/$name.labels" "$WORK_DIR/full.labels")" 'BEGIN { print (a >= 0.95) }')" "1" \
+            "$settings labels agree with the full run"
+done
+compare "$(awk -v a="$(wc -l < "$WORK_DIR/SYMNMF_LABEL_STOP_10_SYMNMF_LABEL_TOLERANCE_0.02.progress")" \
+               -v b="$(wc -l < "$WORK_DIR/SYMNMF_LABEL_STOP_10.progress")" 'BEGIN { print (a <= b) }')" "1" "a tolerance stops no later"
+
+# ./symnmf draws another initial H than the runs above, so its labels are compared with its own full run
+cli_labels() {
+    env $1 ./symnmf symnmf "$INPUT_FILE" $K | python3 -c "
+import sys, numpy as np
+print(' '.join(map(str, np.loadtxt(sys.stdin, delimiter=',').argmax(axis=1))))
+" > "$2"
+}
+cli_labels "" "$WORK_DIR/cli_full.labels"
+cli_labels "SYMNMF_LABEL_STOP=10" "$WORK_DIR/cli.labels"
+compare "$(awk -v a="$(agreement "$WORK_DIR/cli.labels" "$WORK_DIR/cli_full.labels")" 'BEGIN { print (a >= 0.95) }')" "1" \
+        "./symnmf with SYMNMF_LABEL_STOP=10 labels agree with its full run"
+
+exit $failed
@@ -0,0 +1,137 @@
+#!/bin/bash
+# Performance regression test: runs every goal of ./symnmf on a fixed set of workloads (the HW1/HW2 inputs and generated larger ones),
+# and compares the best time of PERF_REPEATS runs, the peak memory and a digest of the output with the baseline in perf_baseline.txt.
+# A stage (a goal on a workload) fails if it got slower than PERF_TIME_TOLERANCE times its baseline (and by more than PERF_MIN_MS,
+# which small inputs are dominated by), if its peak memory grew beyond PERF_MEMORY_TOLERANCE times its baseline (and by more than PERF_MIN_KIB),
+# or if its output changed at all. The outputs in Tests/Claude/res that ./symnmf has always printed must also stay the same.
+# The peak memory of a process includes what the measuring interpreter had when it started it, so anything below ~11 MiB reads as that.
+# Times are only comparable on the machine the baseline was taken on: after a deliberate change (or on a new machine),
+# take a new baseline with --update and commit it. Runs on PERF_THREADS OpenMP threads (1 by default), so the core count doesn't matter.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/test_perf.sh [--update]
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+RESET='\033[0m'
+
+BASELINE_FILE="../Tests/perf_baseline.txt"
+TIME_TOLERANCE=${PERF_TIME_TOLERANCE:-1.5}
+MEMORY_TOLERANCE=${PERF_MEMORY_TOLERANCE:-1.25}
+MIN_MS=${PERF_MIN_MS:-25}
+MIN_KIB=${PERF_MIN_KIB:-4096}
+REPEATS=${PERF_REPEATS:-3}
+export OMP_NUM_THREADS=${PERF_THREADS:-1}
+GENERATED_DIR=$(mktemp -d)
+trap 'rm -rf "$GENERATED_DIR"' EXIT
+
+# name, input file and the k of symnmf
+WORKLOADS=(
+    "hw1_1 ../Tests/HW1_tests/input_1.txt 3"
+    "hw1_2 ../Tests/HW1_tests/input_2.txt 7"
+    "hw1_3 ../Tests/HW1_tests/input_3.txt 15"
+    "hw2_1 ../Tests/HW2_tests/input_1.txt 2"
+    "hw2_2 ../Tests/HW2_tests/input_2.txt 4"
+    "hw2_3 ../Tests/HW2_tests/input_3.txt 3"
+    "altar ../Tests/altar.txt 2"
+    "blobs_3000 $GENERATED_DIR/blobs_3000.txt 5"
+    "wide_1500 $GENERATED_DIR/wide_1500.txt 4"
+)
+
+# Writes n points of dimension d, spread around the given amount of cluster centers, to a file - the same on every run
+generate_points() {
+    python3 -c "
+import random, sys
+n, d, clusters, spread = int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3]), float(sys.argv[4])
+random.seed(0)
+centers = [[random.uniform(-4, 4) for _ in range(d)] for _ in range(clusters)]
+for i in range(n):
+    print(','.join('%.4f' % random.gauss(c, spread) for c in centers[i % clusters]))
+" "$1" "$2" "$3" "$4" > "$5"
+}
+
+# Runs the command REPEATS times and prints the best time in milliseconds, the peak resident memory in KiB and the md5 of its output
+measure() {
+    python3 -c "
+import sys, os, time, hashlib, subprocess
+best, peak, digest = None, 0, None
+for _ in range(int(sys.argv[1])):
+    started = time.perf_counter()
+    process = subprocess.Popen(sys.argv[2:], stdout=subprocess.PIPE)
+    md5 = hashlib.md5()
+    for chunk in iter(lambda: process.stdout.read(1 << 16), b''):
+        md5.update(chunk)
+    _, status, usage = os.wait4(process.pid, 0) # The peak memory of this very child (ru_maxrss is in KiB on Linux)
+    process.returncode = status
+    elapsed = (time.perf_counter() - started) * 1000
+    best = elapsed if best is None else min(best, elapsed)
+    peak = max(peak, usage.ru_maxrss)
+    digest = md5.hexdigest() if status == 0 else 'failed'
+print('%.1f %d %s' % (best, peak, digest))
+" "$REPEATS" "$@"
+}
+
+make -s symnmf > /dev/null || exit 1
+generate_points 3000 10 5 1 "$GENERATED_DIR/blobs_3000.txt"
+generate_points 1500 50 1 0.3 "$GENERATED_DIR/wide_1500.txt" # Narrow enough that the kernel doesn't underflow in 50 dimensions
+
+failed=0
+# expected-ddg-2 and expected-norm-2 (and the symnmf ones, of another initial H) never matched ./symnmf, so they are left out.
+# The expected files have no newline at the end, so they are compared as command substitutions, which drop it.
+for expected in sym-1 ddg-1 norm-1 sym-2; do
+    goal=${expected%-*}
+    input_file="../Tests/Claude/input_${expected#*-}.txt"
+    if [ "$(./symnmf $goal "$input_file")" == "$(cat ../Tests/Claude/res/expected-$expected.txt)" ]; then
+        echo -e "${GREEN}Passed${RESET}: $goal $input_file matches expected-$expected.txt"
+    else
+        echo -e "${RED}Failed${RESET}: $goal $input_file differs from expected-$expected.txt"
+        failed=1
+    fi
+done
+
+measurements=$(mktemp)
+for workload in "${WORKLOADS[@]}"; do
+    read -r name input_file k <<< "$workload"
+    for goal in sym ddg norm symnmf; do
+        if [ "$goal" = symnmf ]; then
+            echo "$name $goal $(measure ./symnmf symnmf "$input_file" "$k")" >> "$measurements"
+        else
+            echo "$name $goal $(measure ./symnmf "$goal" "$input_file")" >> "$measurements"
+        fi
+    done
+done
+
+if [ "$1" = "--update" ]; then
+    {
+        echo "# Baseline of test_perf.sh: workload goal best_ms peak_rss_kib output_md5"
+        echo "# Taken on $(nproc) cores ($(grep -m 1 'model name' /proc/cpuinfo 2> /dev/null | sed 's/.*: //')) with $OMP_NUM_THREADS thread(s), best of $REPEATS"
+        cat "$measurements"
+    } > "$BASELINE_FILE"
+    rm -f "$measurements"
+    echo "Baseline written to $BASELINE_FILE"
+    exit $failed
+fi
+
+while read -r name goal ms rss digest; do
+    baseline=$(grep -v '^#' "$BASELINE_FILE" 2> /dev/null | awk -v n="$name" -v g="$goal" '$1 == n && $2 == g { print $3, $4, $5 }')
+    if [ -z "$baseline" ]; then
+        echo -e "${RED}Failed${RESET}: $name $goal has no baseline (take one with --update)"
+        failed=1
+        continue
+    fi
+    read -r base_ms base_rss base_digest <<< "$baseline"
+    problems=$(awk -v ms="$ms" -v base_ms="$base_ms" -v rss="$rss" -v base_rss="$base_rss" -v tt="$TIME_TOLERANCE" -v mt="$MEMORY_TOLERANCE" \
+               -v min_ms="$MIN_MS" -v min_kib="$MIN_KIB" 'BEGIN {
+        if (ms > base_ms * tt && ms - base_ms > min_ms) printf "time %.1fx of the baseline; ", ms / base_ms
+        if (rss > base_rss * mt && rss - base_rss > min_kib) printf "memory %.2fx of the baseline; ", rss / base_rss
+    }')
+    [ "$digest" != "$base_digest" ] && problems="${problems}output changed; "
+    summary="$name $goal: $ms ms (baseline $base_ms), $((rss / 1024)) MiB (baseline $((base_rss / 1024)))"
+    if [ -z "$problems" ]; then
+        echo -e "${GREEN}Passed${RESET}: $summary"
+    else
+        echo -e "${RED}Failed${RESET}: $summary - ${problems%; }"
+        failed=1
+    fi
+done < "$measurements"
+rm -f "$measurements"
+
+exit $failed
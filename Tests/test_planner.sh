@@ -0,0 +1,85 @@
+#!/bin/bash
+# Checks that every strategy the planner can pick under a memory budget prints the same H as the default dense run,
+# that the plan is reported on stderr only, and that a budget nothing fits is an error before anything runs.
+# symnmf.py must pick the same strategy as ./symnmf under a budget both fit in comfortably (it builds a dense W in C too, so W costs no more),
+# and symnmfmodule.symnmf_matrix_free must reject an H that doesn't have a row for every point before it runs.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/test_planner.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+RESET='\033[0m'
+
+K=4
+INPUT_FILE=$(mktemp)
+W_FILE=$(mktemp -u)
+trap 'rm -f "$INPUT_FILE" "$W_FILE"' EXIT
+
+make -s symnmf > /dev/null || exit 1
+python3 setup.py build_ext --inplace > /dev/null || exit 1
+python3 -c "
+import random
+random.seed(0)
+for _ in range(1500):
+    print(','.join('%.4f' % random.gauss(0, 1) for _ in range(20)))
+" > "$INPUT_FILE" # Large enough for the strategies to differ in memory (W is about 17 MiB)
+expected=$(./symnmf symnmf "$INPUT_FILE" $K)
+failed=0
+
+# Runs symnmf under the budget, and checks the planner ran the given strategy and printed the expected H
+check_budget() {
+    local budget=$1 strategy=$2 actual plan
+    actual=$(SYMNMF_W_FILE="$W_FILE" ./symnmf --memory-budget "$budget" symnmf "$INPUT_FILE" $K 2> /tmp/planner_stderr.$$)
+    plan=$(tail -n 1 /tmp/planner_stderr.$$)
+    rm -f /tmp/planner_stderr.$$
+    if [ "$actual" == "$expected" ] && [ "$plan" == "plan: running $strategy" ] && [ ! -e "$W_FILE" ]; then
+        echo -e "${GREEN}Passed${RESET}: budget $budget ran $strategy"
+    else
+        echo -e "${RED}Failed${RESET}: budget $budget (${plan})"
+        failed=1
+    fi
+}
+
+check_budget 1G dense
+check_budget 20M out-of-core
+check_budget 12M matrix-free
+
+if SYMNMF_MEMORY_BUDGET=1K ./symnmf symnmf "$INPUT_FILE" $K 2> /dev/null | grep -q "An Error Has Occurred"; then
+    echo -e "${GREEN}Passed${RESET}: a budget nothing fits is an error"
+else
+    echo -e "${RED}Failed${RESET}: a budget nothing fits is an error"
+    failed=1
+fi
+
+# 3000 points of dimension 10 with k=5: a dense W is about 70 MiB, so 250M is room enough for it in either program
+python3 -c "
+import random
+random.seed(0)
+for _ in range(3000):
+    print(','.join('%.4f' % random.gauss(0, 1) for _ in range(10)))
+" > "$INPUT_FILE"
+cli_plan=$(./symnmf --memory-budget 250M symnmf "$INPUT_FILE" 5 2>&1 > /dev/null | tail -n 1)
+python_plan=$(SYMNMF_W_FILE="$W_FILE" SYMNMF_MEMORY_BUDGET=250M python3 symnmf.py 5 symnmf "$INPUT_FILE" 2>&1 > /dev/null | tail -n 1)
+if [ "$cli_plan" == "plan: running dense" ] && [ "$python_plan" == "$cli_plan" ]; then
+    echo -e "${GREEN}Passed${RESET}: symnmf.py picks what ./symnmf does under budget 250M"
+else
+    echo -e "${RED}Failed${RESET}: symnmf.py picks what ./symnmf does under budget 250M (${python_plan}, ./symnmf ${cli_plan})"
+    failed=1
+fi
+
+result=$(python3 -c "
+import symnmfmodule
+for X, H in [([[0.0], [1.0]], [[0.1], [0.2], [0.3]]), ([[0.0], [1.0], [2.0]], [[0.1]]), ([[0.0], [1.0, 2.0]], [[0.1], [0.2]])]:
+    try:
+        symnmfmodule.symnmf_matrix_free(X, H)
+        print('returned')
+    except ValueError:
+        print('ValueError')
+" 2>&1)
+if [ "$result" == "$(printf 'ValueError\nValueError\nValueError')" ]; then
+    echo -e "${GREEN}Passed${RESET}: symnmf_matrix_free rejects mismatched shapes"
+else
+    echo -e "${RED}Failed${RESET}: symnmf_matrix_free rejects mismatched shapes"
+    failed=1
+fi
+
+exit $failed
@@ -0,0 +1,114 @@
+#!/bin/bash
+# Checks the preprocessing flags (See preprocess.c): --dedup gives every duplicate the row of H of the point it duplicates (and runs symnmf
+# on the unique points only), --standardize scales every column to mean 0 and variance 1, and --pca P keeps the distances between points
+# that already lie in a P dimensional subspace, so W - and so the clustering - stays the same.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/test_preprocess.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+RESET='\033[0m'
+
+K=4
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# Prints "Passed" or "Failed" with the message, depending on whether the two outputs are the same
+compare() {
+    if [ "$1" == "$2" ]; then
+        echo -e "${GREEN}Passed${RESET}: $3"
+    else
+        echo -e "${RED}Failed${RESET}: $3"
+        failed=1
+    fi
+}
+
+make -s symnmf > /dev/null || exit 1
+python3 setup.py build_ext --inplace > /dev/null || exit 1
+# unique.txt has 300 distinct points, dup.txt the same ones with duplicates right after some of them (one of a point with a 0 coordinate,
+# written as -0), and representative.txt the row of unique.txt every line of dup.txt repeats
+python3 -c "
+import random, sys
+random.seed(7)
+centers = [[random.uniform(-3, 3) for _ in range(5)] for _ in range(4)]
+unique = sorted({','.join('%.4f' % random.gauss(c, 1) for c in centers[i % 4]) for i in range(300)}, key=lambda _: random.random())
+unique[0] = '0.0000,' + unique[0].split(',', 1)[1]
+lines, representative = [], []
+for i, line in enumerate(unique):
+    lines.append(line); representative.append(i)
+    if random.random() < 0.3:
+        j = random.randint(0, i)
+        lines.append(unique[j] if j > 0 else '-' + unique[0]); representative.append(j)
+open(sys.argv[1] + '/unique.txt', 'w').write('\n'.join(unique) + '\n')
+open(sys.argv[1] + '/dup.txt', 'w').write('\n'.join(lines) + '\n')
+open(sys.argv[1] + '/representative.txt', 'w').write('\n'.join(map(str, representative)) + '\n')
+" "$WORK_DIR"
+# subspace.txt has points on a 2 dimensional plane in 10 dimensions (written with enough digits that they stay on it)
+python3 -c "
+import random
+random.seed(8)
+basis = [[random.gauss(0, 1) for _ in range(10)] for _ in range(2)]
+centers = [(random.uniform(-4, 4), random.uniform(-4, 4)) for _ in range(4)]
+for i in range(400):
+    z = [random.gauss(c, 0.8) for c in centers[i % 4]]
+    print(','.join('%.17g' % (z[0] * basis[0][j] + z[1] * basis[1][j]) for j in range(10)))
+" > "$WORK_DIR/subspace.txt"
+failed=0
+
+# Dedup
+expected=$(python3 -c "
+import sys
+rows = open(sys.argv[1]).read().split('\n')
+print('\n'.join(rows[int(r)] for r in open(sys.argv[2])))
+" <(./symnmf symnmf "$WORK_DIR/unique.txt" $K) "$WORK_DIR/representative.txt")
+compare "$(./symnmf --dedup symnmf "$WORK_DIR/dup.txt" $K)" "$expected" "--dedup gives every duplicate the row of the point it duplicates"
+compare "$(./symnmf --dedup symnmf "$WORK_DIR/unique.txt" $K)" "$(./symnmf symnmf "$WORK_DIR/unique.txt" $K)" "--dedup changes nothing without duplicates"
+compare "$(./symnmf --dedup sym "$WORK_DIR/dup.txt")" "An Error Has Occurred" "--dedup is an error for goals other than symnmf"
+compare "$(python3 -c "
+import sys, numpy as np
+import symnmfmodule
+points, representative = symnmfmodule.preprocess(np.loadtxt(sys.argv[1], delimiter=',').tolist(), 1)
+print(points == np.loadtxt(sys.argv[2], delimiter=',').tolist(), representative == [int(r) for r in open(sys.argv[3])])
+" "$WORK_DIR/dup.txt" "$WORK_DIR/unique.txt" "$WORK_DIR/representative.txt")" "True True" "symnmfmodule.preprocess drops the duplicates and maps every point to its row"
+compare "$(python3 -c "
+import symnmfmodule
+for points in ['not a list', [], [[1.0], [1.0, 2.0]]]:
+    try:
+        symnmfmodule.preprocess(points, 1)
+    except (TypeError, ValueError) as error:
+        print(type(error).__name__)
+" 2>&1)" "$(printf 'TypeError\nValueError\nValueError')" "symnmfmodule.preprocess raises on input that isn't a matrix"
+
+# Standardize
+compare "$(python3 -c "
+import sys, numpy as np
+import symnmfmodule
+P = np.array(symnmfmodule.preprocess(np.loadtxt(sys.argv[1], delimiter=',').tolist(), 0, 1)[0])
+print(np.allclose(P.mean(axis=0), 0, atol=1e-12), np.allclose(P.var(axis=0), 1, atol=1e-12))
+" "$WORK_DIR/subspace.txt")" "True True" "--standardize scales every column to mean 0 and variance 1"
+compare "$(./symnmf --standardize norm "$WORK_DIR/unique.txt")" "$(python3 -c "
+import sys, numpy as np
+import symnmfmodule
+P = symnmfmodule.preprocess(np.loadtxt(sys.argv[1], delimiter=',').tolist(), 0, 1)[0]
+for row in symnmfmodule.norm(P):
+    print(','.join('%.4f' % x for x in row))
+" "$WORK_DIR/unique.txt")" "./symnmf --standardize gives the same as symnmfmodule.preprocess"
+
+# PCA
+compare "$(python3 -c "
+import sys, numpy as np
+import symnmfmodule
+X = np.loadtxt(sys.argv[1], delimiter=',').tolist()
+P = symnmfmodule.preprocess(X, 0, 0, 2)[0]
+print(len(P), len(P[0]), np.abs(np.array(symnmfmodule.sym(X)) - np.array(symnmfmodule.sym(P))).max() < 1e-9)
+print(symnmfmodule.preprocess(X, 0, 0, 10)[0] == X, symnmfmodule.preprocess(X, 0, 0, 2)[0] == P)
+" "$WORK_DIR/subspace.txt")" "$(printf '400 2 True\nTrue True')" "--pca 2 keeps the distances of points on a plane (and P >= d keeps the points)"
+compare "$(./symnmf --pca 2 symnmf "$WORK_DIR/subspace.txt" $K | python3 -c "
+import sys, numpy as np
+labels = np.loadtxt(sys.stdin, delimiter=',').argmax(axis=1)
+expected = np.loadtxt(sys.argv[1], delimiter=',').argmax(axis=1)
+print(np.mean(labels == expected) >= 0.99)
+" <(./symnmf symnmf "$WORK_DIR/subspace.txt" $K))" "True" "--pca 2 clusters points on a plane as they are"
+compare "$(OMP_NUM_THREADS=1 ./symnmf --standardize --pca 3 norm "$WORK_DIR/unique.txt" | md5sum)" \
+        "$(OMP_NUM_THREADS=4 ./symnmf --standardize --pca 3 norm "$WORK_DIR/unique.txt" | md5sum)" "--pca gives the same on any amount of threads"
+
+exit $failed
@@ -0,0 +1,49 @@
+#!/bin/bash
+# Checks that the results are bit-identical for any amount of threads (the default reproducible reductions mode).
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/test_reproducible.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+RESET='\033[0m'
+
+THREAD_COUNTS=(1 2 8 64)
+INPUT_FILES=("../Tests/HW1_tests/input_1.txt" "../Tests/HW2_tests/input_2.txt")
+K=4
+
+# Prints a digest of every bit of the full-precision norm and symnmf results (the printed "%.4f" output would hide differences)
+digest() {
+    python3 -c "
+import sys, hashlib, random, math
+import symnmfmodule
+X = [[float(x) for x in line.split(',')] for line in open(sys.argv[1]) if line.strip()]
+k = int(sys.argv[2])
+W = symnmfmodule.norm(X)
+random.seed(1234)
+m = symnmfmodule.norm_mean(X)
+H = [[random.uniform(0, 2 * math.sqrt(m / k)) for _ in range(k)] for _ in range(len(X))]
+H = symnmfmodule.symnmf(W, H)
+print(hashlib.md5((repr(W) + repr(m) + repr(H)).encode()).hexdigest())
+" "$1" "$2"
+}
+
+echo "Compiling C module..."
+python3 setup.py build_ext --inplace > /dev/null || exit 1
+
+failed=0
+for input_file in "${INPUT_FILES[@]}"; do
+    expected=""
+    for threads in "${THREAD_COUNTS[@]}"; do
+        actual=$(OMP_NUM_THREADS=$threads digest "$input_file" $K)
+        if [ -z "$expected" ]; then
+            expected=$actual
+        fi
+        if [ "$actual" == "$expected" ]; then
+            echo -e "${GREEN}Identical${RESET}: ${input_file} with ${threads} threads"
+        else
+            echo -e "${RED}Different${RESET}: ${input_file} with ${threads} threads"
+            failed=1
+        fi
+    done
+done
+
+exit $failed
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Checks that skipping the tiles of W that are 0 (SYMNMF_SPARSE_TILES=0) prints the same H as multiplying every tile, in every update mode,
+# and that the fill it reports on stderr is below 100% for well separated clusters.
+# Run from the project directory, like test_symnmf.sh: bash ../Tests/test_sparse_tiles.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+RESET='\033[0m'
+
+K=6
+INPUT_FILE=$(mktemp)
+trap 'rm -f "$INPUT_FILE"' EXIT
+
+make -s symnmf > /dev/null || exit 1
+python3 -c "
+import random
+random.seed(0)
+for c in range($K):
+    for _ in range(300):
+        print(','.join('%.4f' % (random.gauss(0, 1) + 60 * c * (j == 0)) for j in range(5)))
+" > "$INPUT_FILE" # Clusters far enough apart for the kernel to underflow to 0 between them, in order, so W is block diagonal
+failed=0
+
+for modes in "" "SYMNMF_UPDATE=in-place" "SYMNMF_KERNELS=generic" "SYMNMF_SOLVER=multilevel"; do
+    expected=$(env $modes ./symnmf symnmf "$INPUT_FILE" $K)
+    actual=$(env $modes SYMNMF_SPARSE_TILES=0 ./symnmf symnmf "$INPUT_FILE" $K 2> /tmp/sparse_tiles_stderr.$$)
+    fill=$(tail -n 1 /tmp/sparse_tiles_stderr.$$ | sed -n 's/.*fill \([0-9.]*\)%$/\1/p')
+    rm -f /tmp/sparse_tiles_stderr.$$
+    if [ "$actual" == "$expected" ] && [ -n "$fill" ] && [ "${fill%.*}" -lt 100 ]; then
+        echo -e "${GREEN}Passed${RESET}: ${modes:-default mode} with sparse tiles (fill $fill%)"
+    else
+        echo -e "${RED}Failed${RESET}: ${modes:-default mode} with sparse tiles (fill ${fill:-not reported})"
+        failed=1
+    fi
+done
+
+exit $failed
@@ -1,6 +1,5 @@
 import sys
 import numpy as np
-from sklearn.metrics import silhouette_score
 import symnmfmodule
 import kmeans
 
@@ -19,35 +18,12 @@ def load_data(filename):
         print(ERROR_MSG)
         sys.exit(1)
 
-def kmeans_clustering(X, k, filename):
+def kmeans_clustering(X, k):
     """
     Returns: numpy.ndarray: Cluster assignments for each data point
     """
-    # Convert numpy array to format expected by kmeans module
-    centroids = kmeans.kmeans_general(k, kmeans.DEFAULT_ITER, filename)
-    
-    # Get cluster assignments by finding the nearest centroid for each point
-    labels = []
-    for point in X:
-        min_dist = float('inf')
-        nearest_cluster = 0
-        
-        # Convert centroids linked list to a list for simpler processing
-        centroid_vectors = []
-        current = centroids.head
-        while current:
-            centroid_vectors.append(current.vector)
-            current = current.next
-        
-        # Find the nearest centroid
-        for i, centroid in enumerate(centroid_vectors):
-            # Use the dist function from kmeans module
-            dist = kmeans.dist_mju(list(point), centroid)
-            if dist < min_dist:
-                min_dist = dist
-                nearest_cluster = i
-        labels.append(nearest_cluster)
-    
+    # HW1's K-means, run natively. Every point is labeled with its nearest final centroid
+    centroids, labels = symnmfmodule.kmeans(X.tolist(), k, kmeans.DEFAULT_ITER, kmeans.EPSILON)
     return np.array(labels)
 
 def symnmf_clustering(X, k):
@@ -62,25 +38,21 @@ def symnmf_clustering(X, k):
     m = np.mean(W)
     H_init = np.random.uniform(0, 2 * np.sqrt(m/k), size=(len(X), k))
     
-    # Apply SymNMF to get the association matrix H
-    H = symnmfmodule.symnmf(W, H_init.tolist())
-    
-    # Get cluster assignments based on maximum association score (section 1.5)
-    labels = np.argmax(H, axis = 1)
-    return labels
+    # Apply SymNMF, and get cluster assignments based on maximum association score (section 1.5) straight from C
+    labels, top, confidence = symnmfmodule.symnmf(W, H_init.tolist(), 1)
+    return np.array(labels)
 
-def run_clustering_algos(X, k, filename):
+def run_clustering_algos(X, k):
     """
-    Expects 3 args from code:
+    Expects 2 args from code:
     1. X: numpy array of data points
     2. k: Number of clusters
-    3. filename: Path to the input file
     Prints the silhouette scores of the K Means clustering algorithm and the SymNMF clustering algorithm
     """
     # Perform HW1-Kmeans clustering and calc silhouette score
     try:
-        kmeans_labels = kmeans_clustering(X, k, filename)
-        kmeans_score = silhouette_score(X, kmeans_labels)
+        kmeans_labels = kmeans_clustering(X, k)
+        kmeans_score = symnmfmodule.silhouette(X.tolist(), kmeans_labels.tolist())
     except:
         print(ERROR_MSG)
         return
@@ -88,7 +60,7 @@ def run_clustering_algos(X, k, filename):
     # Perform Symnmf clustering and calc silhouette score
     try:
         symnmf_labels = symnmf_clustering(X, k)
-        symnmf_score = silhouette_score(X, symnmf_labels)
+        symnmf_score = symnmfmodule.silhouette(X.tolist(), symnmf_labels.tolist())
     except:
         print(ERROR_MSG)
         sys.exit(1)
@@ -123,7 +95,7 @@ def main():
         print(ERROR_MSG)
         return
     
-    run_clustering_algos(X, k, filename)
+    run_clustering_algos(X, k)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,235 @@
+/*
+* batch.c - Running a manifest of sym, ddg, norm and symnmf jobs inside one ./symnmf process
+* A nightly run of thousands of small files pays for starting a process and loading the library on every one of them.
+* Here the jobs share one OpenMP team instead, one job per thread at a time, and every thread reuses its read and write buffers across its jobs.
+*
+* Manifest format: one job per line, "goal k input output" separated by whitespace, where k is only read for symnmf (write "-" for the others).
+* Empty lines and lines starting with '#' are skipped. Every output file gets exactly what ./symnmf goal input [k] prints.
+*/
+
+#define _POSIX_C_SOURCE 200112L /* For strtok_r, which -ansi hides */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "symnmf.h"
+#include "batch.h"
+
+#define MAX_MANIFEST_LINE (2 * MAX_PATH_LENGTH + 64)
+#define MANIFEST_WHITESPACE " \t\r\n"
+#define BATCH_TEXT_BYTES 65536 /* Bytes of text a thread formats before writing them out (See write_row) */
+
+/*
+Runs goal on the points the way ./symnmf does, so the results are the same. Returns a NEW matrix of n rows and *cols columns,
+or NULL if memory runs out (deep inside the optimization too). k must already be checked to be in [1, n).
+*/
+double** run_goal(const char* goal, double** points, int n, int d, int k, unsigned long seed, int* cols)
+{
+    double **A, **W, **H;
+    w_source src;
+    *cols = n;
+    if (strcmp(goal, "sym") == 0)
+        return similarity_matrix(points, n, d);
+    if (strcmp(goal, "norm") == 0)
+        return normalized_similarity_from_points(points, n, d);
+    if (strcmp(goal, "ddg") == 0)
+    {
+        A = similarity_matrix(points, n, d);
+        if (A == NULL)
+            return NULL;
+        H = diagonal_degree_matrix(A, n);
+        free_matrix(A, n);
+        return H;
+    }
+    *cols = k; /* symnmf, as in run_symnmf */
+    W = normalized_similarity_from_points(points, n, d);
+    H = (W == NULL) ? NULL : init_H(W, n, k, seed);
+    if (H != NULL)
+    {
+        init_w_source(&src);
+        src.W = W;
+        H = optimizing_H_from_source(H, n, k, &src);
+    }
+    free_matrix(W, n);
+    return H;
+}
+
+/*
+Reads a line of a manifest into job. Returns 0 on success, 1 if the line is malformed (an unknown goal, a k that isn't a number
+for symnmf, missing or extra fields, or a path of MAX_PATH_LENGTH or more) and 2 if it is empty or a comment.
+*/
+int parse_manifest_line(char* line, batch_job* job)
+{
+    char *fields[4], *rest, *end;
+    int count = 0;
+    char* token = strtok_r(line, MANIFEST_WHITESPACE, &rest);
+    if (token == NULL || token[0] == '#')
+        return 2;
+    for (; token != NULL; token = strtok_r(NULL, MANIFEST_WHITESPACE, &rest))
+    {
+        if (count == 4)
+            return 1;
+        fields[count++] = token;
+    }
+    if (count != 4 || strlen(fields[2]) >= MAX_PATH_LENGTH || strlen(fields[3]) >= MAX_PATH_LENGTH)
+        return 1;
+    if (strcmp(fields[0], "sym") != 0 && strcmp(fields[0], "ddg") != 0 && strcmp(fields[0], "norm") != 0 && strcmp(fields[0], "symnmf") != 0)
+        return 1;
+    job->k = 0;
+    if (strcmp(fields[0], "symnmf") == 0)
+    {
+        job->k = (int)strtol(fields[1], &end, 10);
+        if (*end != '\0')
+            return 1;
+    }
+    strcpy(job->goal, fields[0]);
+    strcpy(job->input, fields[2]);
+    strcpy(job->output, fields[3]);
+    return 0;
+}
+
+/*
+Reads every job of the manifest file into a NEW array, putting their amount into count.
+Returns a null pointer if the file can't be read, any line of it is malformed (See parse_manifest_line), it has no jobs or memory allocation fails.
+*/
+batch_job* read_manifest(const char* manifest, int* count)
+{
+    int allocated = 64, line_number = 0, failed = 0, parsed;
+    char line[MAX_MANIFEST_LINE];
+    batch_job *jobs = (batch_job*)malloc(allocated * sizeof(batch_job)), *grown;
+    FILE* fp = fopen(manifest, "r");
+    *count = 0;
+    while (!failed && jobs != NULL && fp != NULL && fgets(line, MAX_MANIFEST_LINE, fp) != NULL)
+    {
+        line_number++;
+        if (strchr(line, '\n') == NULL && !feof(fp)) /* Longer than MAX_MANIFEST_LINE */
+            failed = 1;
+        if (!failed && *count == allocated)
+        {
+            grown = (batch_job*)realloc(jobs, 2 * allocated * sizeof(batch_job));
+            failed = (grown == NULL);
+            if (!failed)
+            {
+                jobs = grown;
+                allocated *= 2;
+            }
+        }
+        if (failed || (parsed = parse_manifest_line(line, &jobs[*count])) == 2)
+            continue;
+        failed = parsed;
+        jobs[(*count)++].line = line_number;
+    }
+    if (fp == NULL || jobs == NULL || failed || *count == 0)
+    {
+        if (fp != NULL)
+            fclose(fp);
+        free(jobs);
+        return NULL;
+    }
+    fclose(fp);
+    return jobs;
+}
+
+/*
+Writes the rows*cols matrix M to filename in the format of print_matrix, formatting it in text (of BATCH_TEXT_BYTES).
+The file is written under a temporary name and renamed into place, so a job that fails never leaves half a result behind.
+Returns 0 on success and 1 on failure.
+*/
+int write_result_file(const char* filename, double** M, int rows, int cols, char* text)
+{
+    int i, failed;
+    char temp[MAX_PATH_LENGTH + sizeof(TEMP_SUFFIX)];
+    FILE* fp;
+    strcpy(temp, filename);
+    strcat(temp, TEMP_SUFFIX);
+    if ((fp = fopen(temp, "w")) == NULL)
+        return 1;
+    for (i = 0; i < rows; i++)
+        write_row(fp, M[i], cols, text, BATCH_TEXT_BYTES);
+    failed = ferror(fp);
+    if (fclose(fp) != 0 || failed || rename(temp, filename) != 0)
+    {
+        remove(temp);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Runs a single job, reading its points with line (of MAX_LINE_LENGTH) and writing its result with text (of BATCH_TEXT_BYTES),
+and puts the dimensions of its points into n and d. Returns 0 on success and 1 on failure (then nothing is written).
+*/
+int run_batch_job(batch_job* job, char* line, char* text, int* n, int* d)
+{
+    int cols, failed;
+    double **points = read_points(job->input, line, n, d), **result = NULL;
+    if (points == NULL)
+    {
+        *n = 0;
+        return 1;
+    }
+    failed = (strcmp(job->goal, "symnmf") == 0 && (job->k <= 0 || job->k >= *n)); /* The same check as the daemon makes */
+    if (!failed)
+        failed = ((result = run_goal(job->goal, points, *n, *d, job->k, RANDOM_SEED, &cols)) == NULL);
+    if (!failed)
+        failed = write_result_file(job->output, result, *n, cols, text);
+    free_matrix(points, *n);
+    free_matrix(result, *n);
+    return failed;
+}
+
+/*
+Runs every job of the manifest file on parallel_jobs threads at once (one per core, if it is 0), each job on a single thread (See batch.c).
+Reports every job as it finishes and a throughput summary at the end to report.
+Checkpointing is turned off, since the jobs would all share its single file (See checkpoint_path).
+Returns the amount of jobs that failed, or -1 if the manifest couldn't be read (then nothing runs).
+*/
+int run_batch(const char* manifest, int parallel_jobs, FILE* report)
+{
+    int count, j, n, d, failed = 0, threads = 1;
+    long points = 0;
+    double started, elapsed, job_started, job_seconds, busy = 0.0;
+    char *line, *text;
+    batch_job* jobs = read_manifest(manifest, &count);
+    if (jobs == NULL)
+        return -1;
+    checkpoint_path = NULL;
+    if (parallel_jobs < 1)
+        parallel_jobs = omp_get_max_threads();
+    omp_set_max_active_levels(1); /* The parallelism is across jobs - the parallel loops inside a job run on its own thread */
+    if (parallel_jobs > count)
+        parallel_jobs = count;
+    started = omp_get_wtime();
+    #pragma omp parallel num_threads(parallel_jobs) private(j, n, d, line, text, job_started, job_seconds) reduction(+:failed, points, busy)
+    {
+        line = (char*)malloc(MAX_LINE_LENGTH); /* Reused by every job of this thread */
+        text = (char*)malloc(BATCH_TEXT_BYTES);
+        #pragma omp single
+        threads = omp_get_num_threads();
+        #pragma omp for schedule(dynamic, 1)
+        for (j = 0; j < count; j++)
+        {
+            job_started = omp_get_wtime();
+            n = 0; d = 0;
+            if (line == NULL || text == NULL || run_batch_job(&jobs[j], line, text, &n, &d) == 1)
+            {
+                failed++;
+                #pragma omp critical (batch_report)
+                fprintf(report, "job %d: %s %s -> %s failed\n", jobs[j].line, jobs[j].goal, jobs[j].input, jobs[j].output);
+                continue;
+            }
+            job_seconds = omp_get_wtime() - job_started;
+            busy += job_seconds;
+            points += n;
+            #pragma omp critical (batch_report)
+            fprintf(report, "job %d: %s %s -> %s n=%d d=%d %.3f ms\n", jobs[j].line, jobs[j].goal, jobs[j].input, jobs[j].output, n, d, job_seconds * 1e3);
+        }
+        free(line);
+        free(text);
+    }
+    elapsed = omp_get_wtime() - started;
+    fprintf(report, "batch: %d jobs (%d failed) on %d threads in %.3f s - %.1f jobs/s, %.0f points/s, threads busy %.0f%% of the time\n",
+            count, failed, threads, elapsed, count / elapsed, points / elapsed, 100.0 * busy / (elapsed * threads));
+    free(jobs);
+    return failed;
+}
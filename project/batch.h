@@ -0,0 +1,31 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include "symnmf.h"
+
+#define MAX_GOAL_LENGTH 16
+
+/*
+A job of a batch manifest (See run_batch): run goal on the points in input with k clusters (symnmf only) and write the result to output.
+line - the line of the manifest it came from, for the report.
+*/
+typedef struct {
+    char goal[MAX_GOAL_LENGTH];
+    int k;
+    char input[MAX_PATH_LENGTH];
+    char output[MAX_PATH_LENGTH];
+    int line;
+} batch_job;
+
+/* Function declarations */
+int run_batch(const char* manifest, int parallel_jobs, FILE* report);
+double** run_goal(const char* goal, double** points, int n, int d, int k, unsigned long seed, int* cols);
+
+/* Helper functions */
+batch_job* read_manifest(const char* manifest, int* count);
+int parse_manifest_line(char* line, batch_job* job);
+int run_batch_job(batch_job* job, char* line, char* text, int* n, int* d);
+int write_result_file(const char* filename, double** M, int rows, int cols, char* text);
+
+#endif
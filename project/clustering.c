@@ -0,0 +1,345 @@
+/*
+* clustering.c - Native clustering helpers used by the analysis
+* K-means (Lloyd's algorithm, optionally with Hamerly's bounds), as in HW1, the silhouette score,
+* and turning SymNMF's association matrix H into cluster memberships (see 1.5).
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "clustering.h"
+
+#define SILHOUETTE_BLOCK 256 /* Points whose distances to all others are summed together, sharing a pass over the data */
+
+/*
+Given two points of dimension d, returns their Euclidean distance.
+*/
+double centroid_dist(double* c1, double* c2, int d)
+{
+    int i;
+    double diff, sum = 0;
+    for (i = 0; i < d; i++)
+    {
+        diff = c1[i] - c2[i];
+        sum += diff * diff;
+    }
+    return sqrt(sum);
+}
+
+/*
+Given a point and k centroids of dimension d, returns the index of the nearest centroid (the first one on ties, like HW1).
+The distances to the nearest and second nearest centroids are stored in best_dist and second_dist (either may be NULL).
+*/
+int nearest_centroid(double* point, double** centroids, int k, int d, double* best_dist, double* second_dist)
+{
+    int c, best = 0;
+    double dist, best_d = DBL_MAX, second_d = DBL_MAX;
+    for (c = 0; c < k; c++)
+    {
+        dist = centroid_dist(point, centroids[c], d);
+        if (dist < best_d)
+        {
+            second_d = best_d;
+            best_d = dist;
+            best = c;
+        }
+        else if (dist < second_d)
+            second_d = dist;
+    }
+    if (best_dist != NULL) *best_dist = best_d;
+    if (second_dist != NULL) *second_dist = second_d;
+    return best;
+}
+
+/*
+Assigns every point to its nearest centroid. Points are independent, so they are split between the threads.
+Returns how many points changed their label.
+*/
+int assign_labels(double** points, int n, int d, double** centroids, int k, int* labels)
+{
+    int i, label, changed = 0;
+    #pragma omp parallel for private(label) reduction(+:changed) schedule(static)
+    for (i = 0; i < n; i++)
+    {
+        label = nearest_centroid(points[i], centroids, k, d, NULL, NULL);
+        changed += (label != labels[i]);
+        labels[i] = label;
+    }
+    return changed;
+}
+
+/*
+Puts the mean of every cluster into next. A cluster that lost all of its points keeps its current centroid.
+counts is scratch space of length k.
+*/
+void update_centroids(double** points, int n, int d, int* labels, double** next, int* counts, double** current, int k)
+{
+    int i, c, j;
+    for (c = 0; c < k; c++)
+    {
+        counts[c] = 0;
+        for (j = 0; j < d; j++)
+            next[c][j] = 0.0;
+    }
+    for (i = 0; i < n; i++)
+    {
+        counts[labels[i]]++;
+        for (j = 0; j < d; j++)
+            next[labels[i]][j] += points[i][j];
+    }
+    for (c = 0; c < k; c++)
+        for (j = 0; j < d; j++)
+            next[c][j] = (counts[c] > 0) ? next[c][j] / counts[c] : current[c][j];
+}
+
+/*
+Allocates a rows*cols matrix as a single block (the row pointers point into it), so it is freed with free_block_matrix.
+If memory allocation error occurs, returns a null pointer.
+*/
+static double** alloc_block_matrix(int rows, int cols)
+{
+    int i;
+    double** M = (double**)malloc(rows * sizeof(double*));
+    if (M == NULL)
+        return NULL;
+    M[0] = (double*)calloc((size_t)rows * cols, sizeof(double));
+    if (M[0] == NULL)
+    {
+        free(M);
+        return NULL;
+    }
+    for (i = 1; i < rows; i++)
+        M[i] = M[0] + (size_t)i * cols;
+    return M;
+}
+
+static void free_block_matrix(double** M)
+{
+    if (M == NULL)
+        return;
+    free(M[0]);
+    free(M);
+}
+
+/*
+Hamerly's assignment step: skips every point whose upper bound (distance to its centroid) is still below
+both its lower bound (distance to the second nearest centroid) and half the gap from its centroid to the nearest other one.
+Only the remaining points are compared against all k centroids, so late iterations touch very few distances.
+*/
+static void hamerly_assign(double** points, int n, int d, double** centroids, int k, int* labels, double* upper, double* lower, double* half_gap)
+{
+    int i, c, c2;
+    double bound, dist;
+    for (c = 0; c < k; c++)
+    {
+        half_gap[c] = DBL_MAX;
+        for (c2 = 0; c2 < k; c2++)
+        {
+            dist = centroid_dist(centroids[c], centroids[c2], d);
+            if (c2 != c && dist / 2 < half_gap[c])
+                half_gap[c] = dist / 2;
+        }
+    }
+    #pragma omp parallel for private(bound) schedule(static)
+    for (i = 0; i < n; i++)
+    {
+        bound = (half_gap[labels[i]] > lower[i]) ? half_gap[labels[i]] : lower[i];
+        if (upper[i] <= bound)
+            continue;
+        upper[i] = centroid_dist(points[i], centroids[labels[i]], d); /* Tighten the upper bound and test again */
+        if (upper[i] <= bound)
+            continue;
+        labels[i] = nearest_centroid(points[i], centroids, k, d, &upper[i], &lower[i]);
+    }
+}
+
+/*
+Given n points of dimension d, runs K-means as in HW1: the first k points are the initial centroids,
+and the loop stops after iter iterations or once no centroid moved by epsilon or more.
+If use_bounds is not 0, Hamerly's bounds are used to skip distance computations; the result is the same as plain Lloyd's.
+The final k*d centroids are written into centroids, and the label of every point (the index of its nearest final centroid) into labels.
+Returns the amount of iterations done, or -1 if memory allocation error occurs.
+*/
+int kmeans(double** points, int n, int d, int k, int iter, double epsilon, int use_bounds, double** centroids, int* labels)
+{
+    int i, c, it, converged = 0, failed = 0;
+    double dist, max_delta, *upper = NULL, *lower = NULL, *half_gap = NULL, *moved = NULL;
+    int* counts = (int*)malloc(k * sizeof(int));
+    double** next = alloc_block_matrix(k, d);
+    if (use_bounds)
+    {
+        upper = (double*)malloc(n * sizeof(double));
+        lower = (double*)malloc(n * sizeof(double));
+        half_gap = (double*)malloc(k * sizeof(double));
+        moved = (double*)malloc(k * sizeof(double));
+        failed = (upper == NULL || lower == NULL || half_gap == NULL || moved == NULL);
+    }
+    if (counts == NULL || next == NULL || failed)
+    {
+        free(counts); free_block_matrix(next);
+        free(upper); free(lower); free(half_gap); free(moved);
+        return -1;
+    }
+    for (c = 0; c < k; c++) /* Initialize centroids with first k points */
+        memcpy(centroids[c], points[c], d * sizeof(double));
+    if (use_bounds)
+        for (i = 0; i < n; i++)
+            labels[i] = nearest_centroid(points[i], centroids, k, d, &upper[i], &lower[i]);
+    else
+        for (i = 0; i < n; i++)
+            labels[i] = -1;
+    for (it = 1; it <= iter && !converged; it++)
+    {
+        if (use_bounds)
+            hamerly_assign(points, n, d, centroids, k, labels, upper, lower, half_gap);
+        else
+            assign_labels(points, n, d, centroids, k, labels);
+        update_centroids(points, n, d, labels, next, counts, centroids, k);
+        max_delta = 0.0;
+        for (c = 0; c < k; c++)
+        {
+            dist = centroid_dist(centroids[c], next[c], d);
+            if (use_bounds)
+                moved[c] = dist;
+            if (dist > max_delta)
+                max_delta = dist;
+        }
+        if (max_delta < epsilon) /* Converged - keep the current centroids, which the labels already match */
+        {
+            converged = 1;
+            continue;
+        }
+        for (c = 0; c < k; c++)
+            memcpy(centroids[c], next[c], d * sizeof(double));
+        if (use_bounds) /* Every centroid moved by at most max_delta, so the bounds can only loosen by that much */
+            for (i = 0; i < n; i++)
+            {
+                upper[i] += moved[labels[i]];
+                lower[i] -= max_delta;
+            }
+    }
+    if (!converged) /* The centroids moved after the last assignment */
+        assign_labels(points, n, d, centroids, k, labels);
+    free(counts); free_block_matrix(next);
+    free(upper); free(lower); free(half_gap); free(moved);
+    return it - 1;
+}
+
+/*
+Returns the Euclidean distance between points i and j.
+If the similarity matrix A is given, with scales the kernel widths it was built with (cells exp(-d^2 / (2 * s_i * s_j)) - all 1 for the
+kernel of 1.1, or the local scales), the distance is recovered from it as sqrt(-2 * s_i * s_j * ln(A)) instead of recomputed.
+Cells that underflowed to 0 (or the diagonal, where A is 0 by definition) carry no distance, so those are recomputed from the points.
+*/
+double pair_dist(double** points, int d, double** A, double* scales, int i, int j)
+{
+    if (A != NULL && A[i][j] > 0)
+        return sqrt(-2 * (scales[i] * scales[j]) * log(A[i][j]));
+    return centroid_dist(points[i], points[j], d);
+}
+
+/*
+Given n points of dimension d labeled with 0 <= labels[i] < k, puts their mean silhouette coefficient into score
+(a point alone in its cluster scores 0, as in sklearn). A may be NULL, or the n*n similarity matrix to reuse its distances,
+built with the kernel widths in scales (See pair_dist) - with any other widths, the recovered distances would be off.
+Points are handled in blocks of SILHOUETTE_BLOCK that are split between the threads. Every thread only keeps the
+per-cluster distance sums of its block, so memory is O(n + k * SILHOUETTE_BLOCK) per thread instead of a full n*n distance matrix.
+Every point sums its distances in the same order regardless of the threads, so the score is reproducible.
+Returns 0 on success, 1 if memory allocation error occurs and 2 if there are fewer than 2 non-empty clusters.
+*/
+int silhouette(double** points, int n, int d, int* labels, int k, double** A, double* scales, double* score)
+{
+    int i, j, c, ib, i_end, nonempty = 0, failed = 0;
+    double a, b, mean, sum = 0.0, *sums;
+    int* sizes = (int*)calloc(k, sizeof(int));
+    double* coefficients = (double*)malloc(n * sizeof(double));
+    if (sizes == NULL || coefficients == NULL)
+    {
+        free(sizes); free(coefficients);
+        return 1;
+    }
+    for (i = 0; i < n; i++)
+        sizes[labels[i]]++;
+    for (c = 0; c < k; c++)
+        nonempty += (sizes[c] > 0);
+    if (nonempty < 2)
+    {
+        free(sizes); free(coefficients);
+        return 2;
+    }
+    #pragma omp parallel private(i, j, c, ib, i_end, a, b, mean, sums) reduction(|:failed)
+    {
+        sums = (double*)malloc((size_t)SILHOUETTE_BLOCK * k * sizeof(double));
+        failed = (sums == NULL);
+        #pragma omp for schedule(dynamic)
+        for (ib = 0; ib < n; ib += SILHOUETTE_BLOCK)
+        {
+            if (sums == NULL)
+                continue;
+            i_end = (ib + SILHOUETTE_BLOCK < n) ? ib + SILHOUETTE_BLOCK : n;
+            for (i = 0; i < (i_end - ib) * k; i++)
+                sums[i] = 0.0;
+            for (j = 0; j < n; j++) /* One pass over all points serves the whole block */
+                for (i = ib; i < i_end; i++)
+                    if (j != i)
+                        sums[(i - ib) * k + labels[j]] += pair_dist(points, d, A, scales, i, j);
+            for (i = ib; i < i_end; i++)
+            {
+                if (sizes[labels[i]] == 1)
+                {
+                    coefficients[i] = 0.0;
+                    continue;
+                }
+                a = sums[(i - ib) * k + labels[i]] / (sizes[labels[i]] - 1);
+                b = -1;
+                for (c = 0; c < k; c++)
+                {
+                    if (c == labels[i] || sizes[c] == 0)
+                        continue;
+                    mean = sums[(i - ib) * k + c] / sizes[c];
+                    if (b < 0 || mean < b)
+                        b = mean;
+                }
+                coefficients[i] = (a < b) ? (b - a) / b : ((a > b) ? (b - a) / a : 0.0);
+            }
+        }
+        free(sums);
+    }
+    for (i = 0; i < n; i++)
+        sum += coefficients[i];
+    *score = sum / n;
+    free(sizes); free(coefficients);
+    return failed;
+}
+
+/*
+Given the final n*k association matrix H, writes the top_m clusters of every point into the n*top_m matrix top
+(best first, so top[i][0] is the hard label argmax(H[i]) - the first one on ties, like np.argmax),
+and the share of the point's association that goes to its label, H[i][label] / sum(H[i]), into confidence (0 if the row is all 0).
+*/
+void memberships(double** H, int n, int k, int top_m, int** top, double* confidence)
+{
+    int i, m, c, pos, best;
+    double row_sum;
+    #pragma omp parallel for private(m, c, pos, best, row_sum) schedule(static)
+    for (i = 0; i < n; i++)
+    {
+        for (m = 0; m < top_m; m++) /* Selection of the m-th best cluster that wasn't picked yet - top_m is tiny */
+        {
+            best = -1;
+            for (c = 0; c < k; c++)
+            {
+                for (pos = 0; pos < m && top[i][pos] != c; pos++)
+                    ;
+                if (pos == m && (best == -1 || H[i][c] > H[i][best]))
+                    best = c;
+            }
+            top[i][m] = best;
+        }
+        row_sum = 0.0;
+        for (c = 0; c < k; c++)
+            row_sum += H[i][c];
+        confidence[i] = (row_sum > 0) ? H[i][top[i][0]] / row_sum : 0.0;
+    }
+}
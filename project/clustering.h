@@ -0,0 +1,16 @@
+#ifndef CLUSTERING_H
+#define CLUSTERING_H
+
+/* Function declarations */
+int kmeans(double** points, int n, int d, int k, int iter, double epsilon, int use_bounds, double** centroids, int* labels);
+int silhouette(double** points, int n, int d, int* labels, int k, double** A, double* scales, double* score);
+void memberships(double** H, int n, int k, int top_m, int** top, double* confidence);
+
+/* Helper functions */
+int nearest_centroid(double* point, double** centroids, int k, int d, double* best_dist, double* second_dist);
+int assign_labels(double** points, int n, int d, double** centroids, int k, int* labels);
+void update_centroids(double** points, int n, int d, int* labels, double** next, int* counts, double** current, int k);
+double centroid_dist(double* c1, double* c2, int d);
+double pair_dist(double** points, int d, double** A, double* scales, int i, int j);
+
+#endif
@@ -0,0 +1,806 @@
+/*
+* daemon.c - symnmfd, a long-running process that serves sym, ddg, norm and symnmf jobs over a Unix socket
+* Small jobs are dominated by starting an interpreter and loading the library, so the daemon pays for that once and keeps it loaded.
+* The acceptor receives the request of every connection (without blocking, on all of them at once), and only a whole request becomes a job.
+* Jobs are queued on a bounded work-stealing queue and run by a fixed pool of worker threads, one job per worker at a time,
+* so a client that is slow to send never holds a worker.
+*
+* Protocol (one job per connection): the client sends a request line, "goal" or "symnmf k [seed]", then the points in the
+* usual comma separated format, ended by an empty line or by closing its side of the connection.
+* The reply is "OK rows cols wait_us run_us" followed by the result matrix in the format ./symnmf prints it, or "ERROR reason".
+* A request that isn't whole within the receive timeout is answered with "ERROR timeout".
+* A "STATS" request is answered with the latency and queue depth metrics instead, one "name value" per line.
+*/
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L /* For sockets, pthreads, clock_gettime, sigaction and fmemopen, which -ansi hides */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <omp.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "symnmf.h"
+#include "daemon.h"
+#include "batch.h"
+
+#define ERROR_MSG "An Error Has Occurred\n"
+#define MAX_REQUEST_LINE 65536 /* Longest line of a request - the same as the longest line ./symnmf reads */
+#define LATENCY_WINDOW 1024 /* The percentiles are over the latency of the last LATENCY_WINDOW jobs */
+#define RECEIVE_TIMEOUT 30 /* Default seconds a client has to send its whole request */
+#define RECEIVE_TIMEOUT_ENV "SYMNMF_RECEIVE_TIMEOUT" /* Set to other seconds for the receive timeout */
+#define ACCEPT_POLL_MS 500 /* How often the acceptor checks whether it was asked to stop, and for timed out requests */
+#define COPY_CHUNK 65536
+#define BUSY_REPLY "ERROR busy\n"
+#define TIMEOUT_REPLY "ERROR timeout\n"
+#define BAD_REQUEST_REPLY "ERROR bad request\n"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+/* Seconds from accepting a connection until its request must be whole (See serve) */
+static int receive_timeout = RECEIVE_TIMEOUT;
+
+/* Asks the acceptor to stop: it stops taking connections, and the workers finish the jobs already queued. */
+static void request_stop(int signum)
+{
+    (void)signum;
+    stop_requested = 1;
+}
+
+/* Returns the monotonic clock, in seconds. */
+double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/*
+Sets up an empty queue of workers deques, each able to hold every one of the capacity jobs that may wait at once.
+Returns 0 on success and 1 on failure (after freeing whatever was allocated).
+*/
+int open_job_queue(job_queue* queue, int workers, int capacity, int threads_per_job)
+{
+    int r;
+    memset(queue, 0, sizeof(*queue));
+    queue->workers = workers; queue->capacity = capacity; queue->threads_per_job = threads_per_job;
+    queue->deques = (job_deque*)calloc(workers, sizeof(job_deque));
+    queue->latencies = (double*)calloc(LATENCY_WINDOW, sizeof(double));
+    if (queue->deques == NULL || queue->latencies == NULL)
+    {
+        close_job_queue(queue);
+        return 1;
+    }
+    for (r = 0; r < workers; r++)
+    {
+        queue->deques[r].jobs = (daemon_job*)malloc(capacity * sizeof(daemon_job));
+        queue->deques[r].capacity = capacity;
+        if (queue->deques[r].jobs == NULL)
+        {
+            close_job_queue(queue);
+            return 1;
+        }
+        pthread_mutex_init(&queue->deques[r].lock, NULL);
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->ready, NULL);
+    return 0;
+}
+
+/* Frees the queue. Only called once no worker uses it anymore. */
+void close_job_queue(job_queue* queue)
+{
+    int r;
+    if (queue->deques != NULL)
+    {
+        for (r = 0; r < queue->workers; r++)
+        {
+            if (queue->deques[r].jobs == NULL)
+                break; /* Set up in order, so nothing after it was */
+            free(queue->deques[r].jobs);
+            pthread_mutex_destroy(&queue->deques[r].lock);
+        }
+        if (r == queue->workers)
+        {
+            pthread_mutex_destroy(&queue->lock);
+            pthread_cond_destroy(&queue->ready);
+        }
+    }
+    free(queue->deques);
+    free(queue->latencies);
+    queue->deques = NULL;
+    queue->latencies = NULL;
+}
+
+/*
+Queues the job of a connection and its whole request (of length bytes, which the job then owns) on the next worker deque
+(round robin - stealing evens out the rest), and wakes a worker.
+Returns 0 if it was queued, and 1 if the queue is full (or stopping), in which case the caller turns the connection away.
+*/
+int enqueue_job(job_queue* queue, int fd, char* request, size_t length)
+{
+    daemon_job job;
+    job_deque* deque;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->waiting >= queue->capacity || queue->stopping)
+    {
+        queue->rejected++;
+        pthread_mutex_unlock(&queue->lock);
+        return 1;
+    }
+    job.depth = ++queue->waiting;
+    if (queue->waiting > queue->max_waiting)
+        queue->max_waiting = queue->waiting;
+    job.id = queue->next_id++;
+    deque = &queue->deques[queue->next_deque];
+    queue->next_deque = (queue->next_deque + 1) % queue->workers;
+    pthread_mutex_unlock(&queue->lock);
+    job.fd = fd;
+    job.request = request;
+    job.length = length;
+    job.queued_at = now_seconds();
+    pthread_mutex_lock(&deque->lock);
+    deque->jobs[(deque->head + deque->count) % deque->capacity] = job;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+    pthread_mutex_lock(&queue->lock); /* Only now is there a job to claim */
+    queue->available++;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+/*
+Waits for a job and takes it: the oldest job of the worker's own deque, or else the newest job of another worker's deque (stealing).
+Returns 0 with the job in job, or 1 once the queue is stopping and every queued job was taken.
+*/
+int take_job(job_queue* queue, int rank, daemon_job* job)
+{
+    int i, r, found = 0, stolen = 0;
+    job_deque* deque;
+    pthread_mutex_lock(&queue->lock);
+    while (queue->available == 0 && !queue->stopping)
+        pthread_cond_wait(&queue->ready, &queue->lock);
+    if (queue->available == 0)
+    {
+        pthread_mutex_unlock(&queue->lock);
+        return 1;
+    }
+    queue->available--; /* Claimed - some deque is sure to hold a job for this worker */
+    pthread_mutex_unlock(&queue->lock);
+    for (i = 0; !found; i++)
+    {
+        r = (rank + i) % queue->workers;
+        deque = &queue->deques[r];
+        pthread_mutex_lock(&deque->lock);
+        if (deque->count > 0)
+        {
+            if (r == rank)
+            {
+                *job = deque->jobs[deque->head];
+                deque->head = (deque->head + 1) % deque->capacity;
+            }
+            else
+            {
+                *job = deque->jobs[(deque->head + deque->count - 1) % deque->capacity];
+                stolen = 1;
+            }
+            deque->count--;
+            found = 1;
+        }
+        pthread_mutex_unlock(&deque->lock);
+    }
+    pthread_mutex_lock(&queue->lock);
+    queue->waiting--;
+    queue->running++;
+    queue->steals += stolen;
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+/*
+Records a finished job in the metrics. status is 0 if the job succeeded, 1 if it failed and 2 if it was a STATS request (left out of the metrics).
+latency is the seconds from queueing the job to sending its reply.
+*/
+void finish_job(job_queue* queue, int status, double latency)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->running--;
+    if (status != 2)
+    {
+        queue->latencies[(queue->done + queue->failed) % LATENCY_WINDOW] = latency;
+        if (status == 0)
+            queue->done++;
+        else
+            queue->failed++;
+        queue->total_latency += latency;
+        if (latency > queue->max_latency)
+            queue->max_latency = latency;
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* Orders doubles for qsort. */
+int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Given count sorted latencies, returns the nearest-rank percentile of fraction (e.g. 0.99) of them, or 0 if there are none. */
+double latency_percentile(double* latencies, int count, double fraction)
+{
+    int rank = (int)ceil(fraction * count) - 1;
+    if (count == 0)
+        return 0;
+    return latencies[(rank < 0) ? 0 : rank];
+}
+
+/* Writes the metrics of the queue, one "name value" per line. Latencies are in milliseconds. */
+void write_stats(job_queue* queue, FILE* out)
+{
+    double window[LATENCY_WINDOW], mean;
+    long done, failed, rejected, timed_out, steals;
+    int count, receiving, waiting, running, max_waiting;
+    pthread_mutex_lock(&queue->lock);
+    done = queue->done; failed = queue->failed; rejected = queue->rejected; timed_out = queue->timed_out; steals = queue->steals;
+    receiving = queue->receiving; waiting = queue->waiting; running = queue->running; max_waiting = queue->max_waiting;
+    count = (done + failed < LATENCY_WINDOW) ? (int)(done + failed) : LATENCY_WINDOW;
+    memcpy(window, queue->latencies, count * sizeof(double));
+    mean = (done + failed > 0) ? queue->total_latency / (done + failed) : 0;
+    fprintf(out, "OK stats\nworkers %d\ncapacity %d\njobs_done %ld\njobs_failed %ld\njobs_rejected %ld\njobs_timed_out %ld\nsteals %ld\n",
+            queue->workers, queue->capacity, done, failed, rejected, timed_out, steals);
+    fprintf(out, "receiving %d\nqueue_depth %d\nmax_queue_depth %d\nrunning %d\n", receiving, waiting, max_waiting, running);
+    fprintf(out, "latency_mean_ms %.3f\nlatency_max_ms %.3f\n", mean * 1e3, queue->max_latency * 1e3);
+    pthread_mutex_unlock(&queue->lock);
+    qsort(window, count, sizeof(double), compare_doubles);
+    fprintf(out, "latency_p50_ms %.3f\nlatency_p95_ms %.3f\nlatency_p99_ms %.3f\n", latency_percentile(window, count, 0.5) * 1e3,
+            latency_percentile(window, count, 0.95) * 1e3, latency_percentile(window, count, 0.99) * 1e3);
+}
+
+/* Returns how many comma separated values a line holds. */
+int count_columns(const char* line)
+{
+    int columns = 1;
+    for (; *line != '\0'; line++)
+        columns += (*line == ',');
+    return columns;
+}
+
+/*
+Reads the d values of a line into point. Unlike the file reader of ./symnmf, a malformed line is an error rather than read as zeros,
+since a daemon can't trust its clients. Returns 0 on success and 1 if the line isn't d comma separated numbers.
+*/
+int parse_point(char* line, double* point, int d)
+{
+    int j;
+    char* end;
+    for (j = 0; j < d; j++)
+    {
+        point[j] = strtod(line, &end);
+        if (end == line || (j < d - 1 && *end != ','))
+            return 1;
+        line = end + 1;
+    }
+    while (*end == ' ' || *end == '\r' || *end == '\n')
+        end++;
+    return *end != '\0';
+}
+
+/*
+Reads the points of a request, up to an empty line or the end of the stream, into a NEW n*d matrix. line is a MAX_REQUEST_LINE buffer.
+Returns the matrix, or NULL if there are no points, they are malformed or memory runs out.
+*/
+double** read_request_points(FILE* in, char* line, int* n, int* d)
+{
+    int rows = 0, allocated = 64, failed = 0;
+    double **points = (double**)malloc(allocated * sizeof(double*)), **grown;
+    *n = 0; *d = 0;
+    while (points != NULL && !failed && fgets(line, MAX_REQUEST_LINE, in) != NULL && line[0] != '\n' && strcmp(line, "\r\n") != 0)
+    {
+        if (strchr(line, '\n') == NULL && !feof(in)) /* Longer than MAX_REQUEST_LINE */
+            failed = 1;
+        else if (rows == 0)
+            *d = count_columns(line);
+        if (!failed && rows == allocated)
+        {
+            grown = (double**)realloc(points, 2 * allocated * sizeof(double*));
+            failed = (grown == NULL);
+            if (!failed)
+            {
+                points = grown;
+                allocated *= 2;
+            }
+        }
+        if (!failed && (points[rows] = (double*)malloc(*d * sizeof(double))) != NULL)
+            rows++;
+        else
+            failed = 1;
+        if (!failed)
+            failed = parse_point(line, points[rows - 1], *d);
+    }
+    if (points == NULL || failed || rows == 0)
+    {
+        free_matrix(points, rows);
+        return NULL;
+    }
+    *n = rows;
+    return points;
+}
+
+/* Writes a rows*cols matrix in the format of print_matrix, formatting it in text (MAX_REQUEST_LINE bytes). */
+void write_matrix(FILE* out, double** M, int rows, int cols, char* text)
+{
+    int i;
+    for (i = 0; i < rows; i++)
+        write_row(out, M[i], cols, text, MAX_REQUEST_LINE);
+}
+
+/*
+Reads the request of a job from in (the request the acceptor received), runs it and writes the reply to out, the connection.
+Logs the job and its latency to stderr. The wait is from queueing the whole request, and the run excludes receiving it.
+Returns 0 if the job succeeded, 1 if it failed and 2 if it was a STATS request.
+*/
+int run_job(daemon_worker* worker, daemon_job* job, FILE* in, FILE* out)
+{
+    char goal[MAX_GOAL_LENGTH], extra;
+    const char* error = NULL;
+    int fields, n = 0, d = 0, k = 0, cols = 0;
+    unsigned long seed = RANDOM_SEED;
+    double started = now_seconds(), finished, **points = NULL, **result = NULL;
+    if (fgets(worker->line, MAX_REQUEST_LINE, in) == NULL)
+        error = "bad request";
+    else if ((fields = sscanf(worker->line, "%15s %d %lu %c", goal, &k, &seed, &extra)) == 1 && strcmp(goal, "STATS") == 0)
+    {
+        write_stats(worker->queue, out);
+        return 2;
+    }
+    else if (fields < 1 || (strcmp(goal, "symnmf") == 0 ? (fields < 2 || fields > 3) : fields != 1) ||
+             (strcmp(goal, "sym") != 0 && strcmp(goal, "ddg") != 0 && strcmp(goal, "norm") != 0 && strcmp(goal, "symnmf") != 0))
+        error = "bad request";
+    else if ((points = read_request_points(in, worker->line, &n, &d)) == NULL)
+        error = "bad points";
+    else if (strcmp(goal, "symnmf") == 0 && (k <= 0 || k >= n))
+        error = "bad k";
+    else if ((result = run_goal(goal, points, n, d, k, seed, &cols)) == NULL)
+        error = "out of memory";
+    finished = now_seconds();
+    if (error == NULL)
+    {
+        fprintf(out, "OK %d %d %.0f %.0f\n", n, cols, (started - job->queued_at) * 1e6, (finished - started) * 1e6);
+        write_matrix(out, result, n, cols, worker->line);
+    }
+    else
+    {
+        fprintf(out, "ERROR %s\n", error);
+        fflush(out);
+        drain_socket(fileno(out));
+    }
+    fprintf(stderr, "job %ld %s n=%d d=%d queued_behind=%d wait_ms=%.3f run_ms=%.3f%s%s\n", job->id, (error == NULL) ? goal : "-",
+            n, d, job->depth - 1, (started - job->queued_at) * 1e3, (finished - started) * 1e3, (error == NULL) ? "" : " error=", (error == NULL) ? "" : error);
+    free_matrix(points, n);
+    free_matrix(result, n);
+    return error != NULL;
+}
+
+/*
+Lets the client finish sending before the connection is closed, so closing with unread data doesn't reset the connection
+before the client reads the reply: stops writing and reads until the client closes its side (or the receive timeout).
+*/
+void drain_socket(int fd)
+{
+    char chunk[1024];
+    shutdown(fd, SHUT_WR);
+    while (read(fd, chunk, sizeof(chunk)) > 0)
+        ;
+}
+
+/* The loop of a worker thread: take a job, run it, record it, until the queue is stopping and drained. */
+void* worker_main(void* arg)
+{
+    daemon_worker* worker = (daemon_worker*)arg;
+    daemon_job job;
+    FILE *in, *out;
+    int status;
+    omp_set_num_threads(worker->queue->threads_per_job); /* The parallelism is across jobs */
+    while (take_job(worker->queue, worker->rank, &job) == 0)
+    {
+        status = 1;
+        in = fmemopen(job.request, job.length, "r");
+        out = fdopen(job.fd, "w");
+        if (in != NULL && out != NULL)
+            status = run_job(worker, &job, in, out);
+        if (in != NULL)
+            fclose(in);
+        if (out != NULL)
+            fclose(out);
+        else
+            close(job.fd);
+        free(job.request);
+        finish_job(worker->queue, status, now_seconds() - job.queued_at);
+    }
+    return NULL;
+}
+
+/*
+Returns 1 if the request received so far is whole: a request line that needs no points (STATS, or a malformed one, which fails anyway),
+or a request line followed by points and an empty line. Returns 0 otherwise. Only searches what wasn't searched before.
+*/
+int request_complete(pending_request* pending)
+{
+    char goal[MAX_GOAL_LENGTH];
+    char* first_end = strchr(pending->buffer, '\n');
+    size_t from;
+    if (first_end == NULL)
+        return pending->length >= MAX_REQUEST_LINE; /* A request line that long is malformed anyway */
+    if (sscanf(pending->buffer, "%15s", goal) != 1 || (strcmp(goal, "sym") != 0 && strcmp(goal, "ddg") != 0
+        && strcmp(goal, "norm") != 0 && strcmp(goal, "symnmf") != 0))
+        return 1;
+    from = (size_t)(first_end - pending->buffer);
+    if (pending->scanned > from)
+        from = pending->scanned;
+    pending->scanned = (pending->length >= 2) ? pending->length - 2 : 0; /* An empty line may straddle what came before and what comes next */
+    return strstr(pending->buffer + from, "\n\n") != NULL || strstr(pending->buffer + from, "\n\r\n") != NULL;
+}
+
+/*
+Receives what the connection of pending has sent since the last call (one read, which doesn't block, so the acceptor serves every connection in turn).
+Returns 0 while the request is incomplete, 1 once it is whole (See request_complete) or the client closed its side,
+and -1 if the client closed it without sending anything, the connection failed or memory ran out.
+*/
+int receive_request(pending_request* pending)
+{
+    ssize_t got;
+    char* grown;
+    if (pending->allocated - pending->length < COPY_CHUNK + 1)
+    {
+        grown = (char*)realloc(pending->buffer, 2 * pending->allocated);
+        if (grown == NULL)
+            return -1;
+        pending->buffer = grown;
+        pending->allocated *= 2;
+    }
+    do
+        got = recv(pending->fd, pending->buffer + pending->length, COPY_CHUNK, 0);
+    while (got < 0 && errno == EINTR);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (got <= 0)
+        return (got == 0 && pending->length > 0) ? 1 : -1;
+    pending->length += got;
+    pending->buffer[pending->length] = '\0';
+    return request_complete(pending);
+}
+
+/* Answers a connection whose request won't run with reply (unless it is NULL), and closes it. */
+void close_pending(job_queue* queue, pending_request* pending, const char* reply)
+{
+    if (reply != NULL && write(pending->fd, reply, strlen(reply)) < 0) { /* The client is gone anyway */ }
+    if (reply != NULL && strcmp(reply, TIMEOUT_REPLY) == 0)
+    {
+        pthread_mutex_lock(&queue->lock);
+        queue->timed_out++;
+        pthread_mutex_unlock(&queue->lock);
+    }
+    close(pending->fd);
+    free(pending->buffer);
+}
+
+/*
+Accepts a connection and starts receiving its request in pending[queue->receiving], turning it away as busy if capacity requests are already being received.
+*/
+void accept_connection(job_queue* queue, int listen_fd, pending_request* pending)
+{
+    int fd = accept(listen_fd, NULL, NULL);
+    pending_request* slot = &pending[queue->receiving];
+    if (fd < 0)
+        return;
+    if (queue->receiving == queue->capacity || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0
+        || (slot->buffer = (char*)malloc(2 * COPY_CHUNK)) == NULL)
+    {
+        pthread_mutex_lock(&queue->lock);
+        queue->rejected++;
+        pthread_mutex_unlock(&queue->lock);
+        if (write(fd, BUSY_REPLY, strlen(BUSY_REPLY)) < 0) { /* The client is gone anyway */ }
+        close(fd);
+        return;
+    }
+    slot->fd = fd;
+    slot->buffer[0] = '\0';
+    slot->length = 0;
+    slot->scanned = 0;
+    slot->allocated = 2 * COPY_CHUNK;
+    slot->accepted_at = now_seconds();
+    pthread_mutex_lock(&queue->lock);
+    queue->receiving++;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+Binds a listening Unix socket at socket_path. A socket file left behind by a daemon that was killed is replaced,
+but not one that a live daemon answers on, nor a file that isn't a socket. Returns the socket, or -1 on failure.
+*/
+int open_listening_socket(const char* socket_path)
+{
+    struct sockaddr_un address;
+    struct stat info;
+    int fd;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+        return -1;
+    if (lstat(socket_path, &info) == 0)
+    {
+        if (!S_ISSOCK(info.st_mode))
+            return -1;
+        fd = connect_socket(socket_path);
+        if (fd >= 0)
+        {
+            close(fd);
+            fprintf(stderr, "symnmfd: already serving on %s\n", socket_path);
+            return -1;
+        }
+        unlink(socket_path);
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Connects to the daemon at socket_path. Returns the connection, or -1 on failure. */
+int connect_socket(const char* socket_path)
+{
+    struct sockaddr_un address;
+    int fd;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+        return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/*
+Serves jobs on socket_path with a pool of workers threads (each running its jobs on threads_per_job OpenMP threads),
+turning connections away while capacity requests are already being received, or capacity jobs are already waiting.
+This thread receives the requests of all connections at once, with poll, and queues each one as a job once it is whole.
+A request that isn't whole receive_timeout seconds after its connection was accepted is answered with TIMEOUT_REPLY.
+Runs until SIGINT or SIGTERM, then finishes the queued jobs (requests still being received are turned away).
+Returns 0 after a clean stop, and 1 if serving couldn't start or polling failed.
+*/
+int serve(const char* socket_path, int workers, int capacity, int threads_per_job)
+{
+    job_queue queue;
+    daemon_worker* pool;
+    pthread_t* threads;
+    sigset_t blocked, previous;
+    struct sigaction action;
+    struct pollfd* polled;
+    struct timeval timeout;
+    pending_request* pending;
+    int listen_fd, r, status, started = 0, failed = 0;
+    memset(&queue, 0, sizeof(queue));
+    listen_fd = open_listening_socket(socket_path);
+    if (listen_fd < 0)
+        return 1;
+    pool = (daemon_worker*)calloc(workers, sizeof(daemon_worker));
+    threads = (pthread_t*)malloc(workers * sizeof(pthread_t));
+    pending = (pending_request*)malloc(capacity * sizeof(pending_request));
+    polled = (struct pollfd*)malloc((capacity + 1) * sizeof(struct pollfd)); /* The listening socket, then a connection per pending request */
+    failed = (pool == NULL || threads == NULL || pending == NULL || polled == NULL || open_job_queue(&queue, workers, capacity, threads_per_job) == 1);
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous); /* Only the acceptor handles the signals - the workers inherit the mask */
+    for (r = 0; !failed && r < workers; r++)
+    {
+        pool[r].queue = &queue;
+        pool[r].rank = r;
+        pool[r].line = (char*)malloc(MAX_REQUEST_LINE);
+        failed = (pool[r].line == NULL || pthread_create(&threads[r], NULL, worker_main, &pool[r]) != 0);
+        started += !failed;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN); /* A client that hangs up fails its own job, not the daemon */
+    if (!failed)
+        fprintf(stderr, "symnmfd: serving on %s with %d workers\n", socket_path, workers);
+    timeout.tv_sec = receive_timeout; /* Bounds how long a worker drains a client after an error reply (See drain_socket) */
+    timeout.tv_usec = 0;
+    while (!failed && !stop_requested)
+    {
+        polled[0].fd = listen_fd;
+        polled[0].events = POLLIN;
+        for (r = 0; r < queue.receiving; r++)
+        {
+            polled[r + 1].fd = pending[r].fd;
+            polled[r + 1].events = POLLIN;
+        }
+        if (poll(polled, queue.receiving + 1, ACCEPT_POLL_MS) < 0)
+        {
+            failed = (errno != EINTR);
+            continue;
+        }
+        for (r = queue.receiving - 1; r >= 0; r--) /* Backwards, since a request that is done is replaced by the last one */
+        {
+            status = (polled[r + 1].revents != 0) ? receive_request(&pending[r]) : 0;
+            if (status == 0 && now_seconds() - pending[r].accepted_at < receive_timeout)
+                continue;
+            if (status == 1 && fcntl(pending[r].fd, F_SETFL, fcntl(pending[r].fd, F_GETFL) & ~O_NONBLOCK) == 0
+                && setsockopt(pending[r].fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0
+                && enqueue_job(&queue, pending[r].fd, pending[r].buffer, pending[r].length) == 0)
+                ; /* The job owns the connection and the request now */
+            else
+                close_pending(&queue, &pending[r], (status == 0) ? TIMEOUT_REPLY : (status == 1) ? BUSY_REPLY : BAD_REQUEST_REPLY);
+            pthread_mutex_lock(&queue.lock);
+            pending[r] = pending[--queue.receiving];
+            pthread_mutex_unlock(&queue.lock);
+        }
+        if (polled[0].revents & POLLIN)
+            accept_connection(&queue, listen_fd, pending);
+    }
+    while (queue.receiving > 0)
+        close_pending(&queue, &pending[--queue.receiving], BUSY_REPLY);
+    if (queue.deques != NULL)
+    {
+        pthread_mutex_lock(&queue.lock);
+        queue.stopping = 1;
+        pthread_cond_broadcast(&queue.ready);
+        pthread_mutex_unlock(&queue.lock);
+    }
+    for (r = 0; r < started; r++)
+        pthread_join(threads[r], NULL);
+    close(listen_fd);
+    unlink(socket_path);
+    if (queue.deques != NULL)
+        close_job_queue(&queue);
+    for (r = 0; pool != NULL && r < workers; r++)
+        free(pool[r].line);
+    free(pool);
+    free(threads);
+    free(pending);
+    free(polled);
+    return failed;
+}
+
+/* Writes all len bytes of buffer to fd. Returns 0 on success and 1 on failure. */
+static int write_all(int fd, const char* buffer, size_t len)
+{
+    ssize_t written;
+    while (len > 0)
+    {
+        written = write(fd, buffer, len);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return 1;
+        buffer += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/*
+Sends request (and the points in filename, unless it is NULL) to the daemon at socket_path, and prints the reply without its OK line,
+so a job prints exactly what ./symnmf would. Returns 0 on success and 1 if the daemon can't be reached or the job failed.
+*/
+int submit(const char* socket_path, const char* request, const char* filename)
+{
+    char chunk[COPY_CHUNK];
+    size_t len;
+    int fd, sent = 0;
+    FILE *points = NULL, *reply;
+    signal(SIGPIPE, SIG_IGN); /* If the daemon rejects the job early, its reply says why */
+    if (filename != NULL && (points = fopen(filename, "rb")) == NULL)
+        return 1;
+    fd = connect_socket(socket_path);
+    if (fd < 0)
+    {
+        if (points != NULL)
+            fclose(points);
+        return 1;
+    }
+    sent = (write_all(fd, request, strlen(request)) == 0 && write_all(fd, "\n", 1) == 0);
+    while (sent && points != NULL && (len = fread(chunk, 1, sizeof(chunk), points)) > 0)
+        sent = (write_all(fd, chunk, len) == 0);
+    if (points != NULL)
+        fclose(points);
+    shutdown(fd, SHUT_WR);
+    reply = fdopen(fd, "r");
+    if (reply == NULL)
+    {
+        close(fd);
+        return 1;
+    }
+    if (fgets(chunk, sizeof(chunk), reply) == NULL || strncmp(chunk, "OK ", 3) != 0)
+    {
+        fprintf(stderr, "symnmfd: %s", ferror(reply) || feof(reply) ? "no reply\n" : chunk);
+        fclose(reply);
+        return 1;
+    }
+    while ((len = fread(chunk, 1, sizeof(chunk), reply)) > 0)
+        fwrite(chunk, 1, len, stdout);
+    fclose(reply);
+    return 0;
+}
+
+/*
+CMD args: serve SOCKET [workers [capacity [threads_per_job]]] - runs the daemon (by default one worker per core, 4 waiting jobs per worker and 1 thread per job),
+submit SOCKET goal file [k [seed]] - runs a job on the daemon and prints its result like ./symnmf goal file [k [seed]],
+stats SOCKET - prints the daemon's metrics.
+The daemon reads the SYMNMF_* modes from its own environment once, at start (checkpointing and worker processes are off, since jobs run concurrently),
+and RECEIVE_TIMEOUT_ENV for the seconds a client has to send its request.
+*/
+int main(int argc, char* argv[])
+{
+    char request[MAX_REQUEST_LINE];
+    int i, settings[3], status;
+    char* end;
+    if (argc >= 3 && strcmp(argv[1], "serve") == 0 && argc <= 6)
+    {
+        settings[0] = omp_get_num_procs(); settings[1] = 0; settings[2] = 1;
+        for (i = 3; i < argc; i++)
+        {
+            settings[i - 3] = (int)strtol(argv[i], &end, 10);
+            if (*end != '\0' || settings[i - 3] < 1)
+            {
+                printf(ERROR_MSG);
+                return 1;
+            }
+        }
+        read_env_modes();
+        if (getenv(RECEIVE_TIMEOUT_ENV) != NULL && atoi(getenv(RECEIVE_TIMEOUT_ENV)) > 0)
+            receive_timeout = atoi(getenv(RECEIVE_TIMEOUT_ENV));
+        checkpoint_path = NULL;
+        distributed_workers = 1;
+        status = serve(argv[2], settings[0], (settings[1] > 0) ? settings[1] : 4 * settings[0], settings[2]);
+    }
+    else if (argc == 3 && strcmp(argv[1], "stats") == 0)
+        status = submit(argv[2], "STATS", NULL);
+    else if (argc >= 5 && argc <= 7 && strcmp(argv[1], "submit") == 0 && strlen(argv[3]) < MAX_GOAL_LENGTH && (argc == 5 || strcmp(argv[3], "symnmf") == 0))
+    {
+        request[0] = '\0';
+        for (i = 3; i < argc; i++)
+        {
+            if (i != 4) /* The file is sent as the points, not in the request line */
+            {
+                strncat(request, argv[i], 64);
+                strcat(request, " ");
+            }
+        }
+        status = submit(argv[2], request, argv[4]);
+    }
+    else
+        status = 1;
+    if (status != 0)
+        printf(ERROR_MSG);
+    return status;
+}
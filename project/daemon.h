@@ -0,0 +1,89 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <pthread.h>
+
+/*
+A connection whose request the acceptor is still receiving (See receive_request). Nothing of a worker is taken until the whole request is in,
+so a client that is slow to send (or sends nothing) only costs a slot here, until RECEIVE_TIMEOUT.
+*/
+typedef struct {
+    int fd;
+    char* buffer; /* The request so far, '\0' terminated */
+    size_t length, allocated, scanned; /* scanned - how much of it was already searched for the end of the request */
+    double accepted_at;
+} pending_request;
+
+/* A job of the daemon: a connection and its whole request. Its reply is written by whichever worker runs it. */
+typedef struct {
+    int fd;
+    char* request; /* Owned by the job - freed once it ran */
+    size_t length;
+    long id;
+    double queued_at; /* Seconds on the monotonic clock (See now_seconds) */
+    int depth; /* Jobs waiting when it was queued, itself included */
+} daemon_job;
+
+/*
+The jobs queued on one worker. The worker takes its own jobs from the front, and idle workers steal from the back.
+A ring buffer of capacity jobs, guarded by lock.
+*/
+typedef struct {
+    daemon_job* jobs;
+    int capacity, head, count;
+    pthread_mutex_t lock;
+} job_deque;
+
+/*
+The bounded work-stealing queue of the daemon and its metrics. lock guards everything but the deques.
+receiving - connections whose request is still being received (never above capacity either),
+waiting - jobs queued and not yet started (never above capacity - further connections are turned away as busy),
+available - queued jobs no worker has claimed yet. A worker claims one before taking it from a deque, so the deques always hold at least available jobs.
+*/
+typedef struct {
+    job_deque* deques;
+    int workers, capacity, threads_per_job, next_deque;
+    int receiving, waiting, available, running, max_waiting, stopping;
+    long next_id, done, failed, rejected, timed_out, steals;
+    double total_latency, max_latency;
+    double* latencies; /* The latency of the last LATENCY_WINDOW jobs, a ring indexed by done + failed */
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} job_queue;
+
+/* What a worker needs to run: the queue and its own deque. */
+typedef struct {
+    job_queue* queue;
+    int rank;
+    char* line; /* MAX_REQUEST_LINE bytes to read the request into */
+} daemon_worker;
+
+/* Function declarations */
+int serve(const char* socket_path, int workers, int capacity, int threads_per_job);
+int submit(const char* socket_path, const char* request, const char* filename);
+
+/* Helper functions */
+double now_seconds(void);
+int open_job_queue(job_queue* queue, int workers, int capacity, int threads_per_job);
+void close_job_queue(job_queue* queue);
+int enqueue_job(job_queue* queue, int fd, char* request, size_t length);
+int take_job(job_queue* queue, int rank, daemon_job* job);
+void finish_job(job_queue* queue, int status, double latency);
+void* worker_main(void* arg);
+int run_job(daemon_worker* worker, daemon_job* job, FILE* in, FILE* out);
+double** read_request_points(FILE* in, char* line, int* n, int* d);
+int parse_point(char* line, double* point, int d);
+int count_columns(const char* line);
+void write_matrix(FILE* out, double** M, int rows, int cols, char* text);
+void write_stats(job_queue* queue, FILE* out);
+double latency_percentile(double* latencies, int count, double fraction);
+int compare_doubles(const void* a, const void* b);
+int open_listening_socket(const char* socket_path);
+int connect_socket(const char* socket_path);
+int receive_request(pending_request* pending);
+int request_complete(pending_request* pending);
+void accept_connection(job_queue* queue, int listen_fd, pending_request* pending);
+void close_pending(job_queue* queue, pending_request* pending, const char* reply);
+void drain_socket(int fd);
+
+#endif
@@ -0,0 +1,407 @@
+/*
+* distributed.c - SymNMF over worker processes that each own a slice of the rows of W
+* The driver forks the workers and coordinates them through pipes; H and the partial sums they exchange live in shared memory.
+* No worker ever holds more of W than its own rows, and the result is bit-identical to the single process one.
+*/
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L /* For fork, pipes, mmap and ftruncate, which -ansi hides */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "symnmf.h"
+#include "distributed.h"
+
+#define MAX_WORKERS 256
+
+/*
+Sets up everything the workers share: the mapping (backed by an unlinked temporary file, so it is shared across fork) and the pipes.
+The row pointers of H point into the mapping, and are inherited by the workers along with it.
+Returns 0 on success and 1 on failure (after undoing whatever was set up).
+*/
+int open_distributed_run(distributed_run* run, double** points, int n, int d, int k, int workers)
+{
+    int i, b;
+    size_t doubles;
+    double* next;
+    FILE* backing;
+    memset(run, 0, sizeof(*run));
+    run->n = n; run->d = d; run->k = k; run->points = points;
+    run->blocks = (n + REDUCTION_BLOCK - 1) / REDUCTION_BLOCK;
+    run->workers = (workers < run->blocks) ? workers : run->blocks; /* Every worker owns whole blocks */
+    doubles = 1 + 2 * (size_t)n * k + 4 * (size_t)n + 2 * (size_t)run->blocks * k * k;
+    run->shared_bytes = doubles * sizeof(double);
+    backing = tmpfile();
+    if (backing == NULL)
+        return 1;
+    if (ftruncate(fileno(backing), (off_t)run->shared_bytes) == 0)
+        run->shared = (double*)mmap(NULL, run->shared_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(backing), 0);
+    fclose(backing); /* The mapping keeps the memory alive */
+    if (run->shared == NULL || run->shared == (double*)MAP_FAILED)
+    {
+        run->shared = NULL;
+        return 1;
+    }
+    run->header = run->shared;
+    next = run->shared + 1;
+    for (b = 0; b < 2; b++)
+    {
+        run->H[b] = (double**)malloc(n * sizeof(double*));
+        if (run->H[b] == NULL)
+        {
+            close_distributed_run(run);
+            return 1;
+        }
+        for (i = 0; i < n; i++)
+            run->H[b][i] = next + (size_t)i * k;
+        next += (size_t)n * k;
+    }
+    run->scales = next; next += n;
+    run->D_neg_half = next; next += n;
+    run->row_values[0] = next; next += n;
+    run->row_values[1] = next; next += n;
+    run->partials[0] = next; next += (size_t)run->blocks * k * k;
+    run->partials[1] = next;
+    run->up = (int*)malloc(2 * run->workers * sizeof(int));
+    run->down = (int*)malloc(2 * run->workers * sizeof(int));
+    if (run->up == NULL || run->down == NULL)
+    {
+        close_distributed_run(run);
+        return 1;
+    }
+    for (i = 0; i < 2 * run->workers; i++)
+        run->up[i] = run->down[i] = -1;
+    for (i = 0; i < run->workers; i++)
+    {
+        if (pipe(run->up + 2 * i) != 0 || pipe(run->down + 2 * i) != 0)
+        {
+            close_distributed_run(run);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+Releases whatever open_distributed_run set up. Safe to call on a partly set up run.
+*/
+void close_distributed_run(distributed_run* run)
+{
+    int i;
+    for (i = 0; run->up != NULL && i < 2 * run->workers; i++)
+        if (run->up[i] >= 0)
+            close(run->up[i]);
+    for (i = 0; run->down != NULL && i < 2 * run->workers; i++)
+        if (run->down[i] >= 0)
+            close(run->down[i]);
+    free(run->up);
+    free(run->down);
+    free(run->H[0]);
+    free(run->H[1]);
+    if (run->shared != NULL)
+        munmap(run->shared, run->shared_bytes);
+    run->up = run->down = NULL;
+    run->H[0] = run->H[1] = NULL;
+    run->shared = NULL;
+}
+
+/*
+Puts the rows owned by worker rank into [first, last): an even share of the blocks of REDUCTION_BLOCK rows.
+Owning whole blocks lets every worker sum its blocks' part of (H^T)H exactly as gram_matrix would.
+*/
+void worker_rows(distributed_run* run, int rank, int* first, int* last)
+{
+    int first_block = (int)((long)rank * run->blocks / run->workers);
+    int last_block = (int)((long)(rank + 1) * run->blocks / run->workers);
+    *first = first_block * REDUCTION_BLOCK;
+    *last = (last_block * REDUCTION_BLOCK < run->n) ? last_block * REDUCTION_BLOCK : run->n;
+}
+
+/*
+Waits until every worker reaches the barrier. status is 'b', or 'e' to tell the driver this worker failed.
+Returns 0 when released, and 1 if the driver called the run off instead.
+*/
+int worker_barrier(distributed_run* run, int rank, char status)
+{
+    char reply = 0;
+    if (write(run->up[2 * rank + 1], &status, 1) != 1)
+        return 1;
+    if (read(run->down[2 * rank], &reply, 1) != 1 || reply != 'g')
+        return 1;
+    return 0;
+}
+
+/*
+Writes (H^T)H of every block of REDUCTION_BLOCK rows in [first, last) into its k*k slot of partials.
+HtH is scratch space for k row pointers.
+*/
+void worker_gram_partials(distributed_run* run, double** H, double* partials, int first, int last, double** HtH)
+{
+    int b, s, end, k = run->k;
+    for (b = first / REDUCTION_BLOCK; b * REDUCTION_BLOCK < last; b++)
+    {
+        end = ((b + 1) * REDUCTION_BLOCK < last) ? (b + 1) * REDUCTION_BLOCK : last;
+        memset(partials + (size_t)b * k * k, 0, (size_t)k * k * sizeof(double));
+        for (s = 0; s < k; s++)
+            HtH[s] = partials + (size_t)b * k * k + (size_t)s * k;
+        add_gram_rows(H, b * REDUCTION_BLOCK, end, k, HtH);
+    }
+}
+
+/*
+Puts (H^T)H into the k*k matrix HtH by adding the partial sums of all blocks in block order - the all-reduce of (H^T)H.
+Every worker does it on its own, and since the order is fixed they all get the very same matrix (the same one gram_matrix gives).
+*/
+void sum_gram_partials(distributed_run* run, double* partials, double** HtH)
+{
+    int b, s, j, k = run->k;
+    for (s = 0; s < k; s++)
+        for (j = 0; j < k; j++)
+            HtH[s][j] = 0.0;
+    for (b = 0; b < run->blocks; b++)
+        for (s = 0; s < k; s++)
+            for (j = 0; j < k; j++)
+                HtH[s][j] += partials[(size_t)b * k * k + (size_t)s * k + j];
+}
+
+/*
+Returns the sum of count values, added in the same order as ordered_sum in reproducible mode, but without any threads
+(OpenMP can't be used in a process forked from one that already used it).
+*/
+double block_ordered_sum(double* values, int count)
+{
+    int b, i, end;
+    double block_sum, sum = 0.0;
+    for (b = 0; b * REDUCTION_BLOCK < count; b++)
+    {
+        end = ((b + 1) * REDUCTION_BLOCK < count) ? (b + 1) * REDUCTION_BLOCK : count;
+        block_sum = 0.0;
+        for (i = b * REDUCTION_BLOCK; i < end; i++)
+            block_sum += values[i];
+        sum += block_sum;
+    }
+    return sum;
+}
+
+/*
+The work of worker rank, on its rows [first, last) of W (only those rows are ever computed):
+finds the kernel widths of its points from its rows of squared distances, builds its rows of the similarity matrix once all widths are in,
+and normalizes them once all degrees are in, draws its rows of H if draw_H is set
+(as init_H does, from the mean of W), then runs the iterations of update_H on its rows, meeting the other workers at one barrier per iteration.
+Returns 0 on success and 1 on failure.
+*/
+int run_worker(distributed_run* run, int rank, int draw_H, unsigned long seed)
+{
+    int first, last, i, j, it, count, cur = 0, k = run->k, n = run->n, failed;
+    int m = (local_scaling_neighbor < n - 1) ? local_scaling_neighbor : n - 1;
+    double sum, delta, high;
+    double nearest[MAX_LOCAL_SCALING_NEIGHBOR];
+    double **W, **HtH, **scratch;
+    const row_kernels* kernels = select_row_kernels(k);
+    worker_rows(run, rank, &first, &last);
+    W = alloc_matrix(last - first, n);
+    HtH = alloc_matrix(k, k);
+    scratch = (double**)malloc(k * sizeof(double*));
+    failed = (W == NULL || HtH == NULL || scratch == NULL);
+    for (i = first; i < last && !failed; i++) /* Squared distances of the rows, and their kernel widths */
+    {
+        count = 0;
+        for (j = 0; j < n; j++)
+        {
+            W[i - first][j] = (j == i) ? 0.0 : squared_euclidean_dist(run->points[i], run->points[j], run->d);
+            if (j != i && m > 0)
+                keep_nearest(nearest, &count, m, W[i - first][j]);
+        }
+        run->scales[i] = (m > 0) ? local_scale(nearest, count) : kernel_sigma;
+    }
+    if (worker_barrier(run, rank, failed ? 'e' : 'b') == 1 || failed)
+        failed = 1;
+    for (i = first; i < last && !failed; i++) /* Rows of A, and their degrees */
+    {
+        sum = 0.0;
+        for (j = 0; j < n; j++)
+        {
+            W[i - first][j] = (j == i) ? 0.0 : similarity(W[i - first][j], run->scales[i], run->scales[j]);
+            sum += W[i - first][j];
+        }
+        run->D_neg_half[i] = 1 / sqrt(sum + denominator_eps);
+    }
+    if (!failed && worker_barrier(run, rank, 'b') == 1)
+        failed = 1;
+    for (i = first; i < last && !failed; i++) /* Rows of W, and their sums */
+    {
+        sum = 0.0;
+        for (j = 0; j < n; j++)
+        {
+            W[i - first][j] = (run->D_neg_half[i] * W[i - first][j]) * run->D_neg_half[j];
+            sum += W[i - first][j];
+        }
+        run->row_values[0][i] = sum;
+    }
+    if (!failed && worker_barrier(run, rank, 'b') == 1)
+        failed = 1;
+    if (!failed && draw_H)
+    {
+        high = 2 * sqrt(block_ordered_sum(run->row_values[0], n) / ((double)n * n) / k);
+        for (i = first; i < last; i++)
+            for (j = 0; j < k; j++)
+                run->H[0][i][j] = high * uniform_draw(seed, (unsigned long)i * k + j);
+    }
+    if (!failed)
+        worker_gram_partials(run, run->H[0], run->partials[0], first, last, scratch);
+    if (!failed && worker_barrier(run, rank, 'b') == 1)
+        failed = 1;
+    for (it = 1; it <= max_iter && !failed; it++)
+    {
+        sum_gram_partials(run, run->partials[cur], HtH);
+        for (i = first; i < last; i++)
+        {
+            kernels->w_times_row(W[i - first], run->H[cur], run->H[1 - cur][i], n, k);
+            run->row_values[1 - cur][i] = kernels->update_row(run->H[cur][i], HtH, run->H[1 - cur][i], k);
+        }
+        worker_gram_partials(run, run->H[1 - cur], run->partials[1 - cur], first, last, scratch);
+        if (worker_barrier(run, rank, 'b') == 1)
+        {
+            failed = 1;
+            break;
+        }
+        delta = block_ordered_sum(run->row_values[1 - cur], n);
+        cur = 1 - cur;
+        if (rank == 0)
+            run->header[0] = it;
+        if (delta < eps) /* Every worker sees the same delta, so they all stop together */
+            break;
+    }
+    free_matrix(W, last - first);
+    free_matrix(HtH, k);
+    free(scratch);
+    return failed;
+}
+
+/*
+The driver's side of the barriers: waits for a byte from every worker and releases them all, until the workers are done.
+Every worker's pipe is only open in that worker, so it closes exactly when the worker exits - once all of them are closed the run finished.
+If a worker fails or exits while others still wait at a barrier, calls the run off and stops the others.
+Returns 0 if the workers finished and 1 otherwise.
+*/
+int drive_barriers(distributed_run* run)
+{
+    int r, arrived, exited;
+    char status, go = 'g', stop = 'x';
+    for (;;)
+    {
+        arrived = exited = 0;
+        for (r = 0; r < run->workers; r++)
+        {
+            if (read(run->up[2 * r], &status, 1) != 1)
+                exited++;
+            else if (status == 'b')
+                arrived++;
+        }
+        if (exited == run->workers)
+            return 0;
+        if (arrived < run->workers)
+            break;
+        for (r = 0; r < run->workers; r++)
+            if (write(run->down[2 * r + 1], &go, 1) != 1)
+                break;
+        if (r < run->workers)
+            break;
+    }
+    for (r = 0; r < run->workers; r++) /* Lets any worker still waiting at a barrier know the run is off */
+        if (write(run->down[2 * r + 1], &stop, 1) != 1)
+            continue;
+    return 1;
+}
+
+/*
+Closes the ends of the pipes that one process doesn't use: in worker rank all but the write end of its up pipe and the read end of its down pipe,
+and in the driver (rank -1) the write ends of all up pipes and the read ends of all down pipes.
+*/
+void keep_worker_pipes(distributed_run* run, int rank)
+{
+    int r, i;
+    for (r = 0; r < run->workers; r++)
+    {
+        for (i = 0; i < 2; i++)
+        {
+            if (rank < 0 ? i == 1 : (r != rank || i == 0))
+            {
+                close(run->up[2 * r + i]);
+                run->up[2 * r + i] = -1;
+            }
+            if (rank < 0 ? i == 0 : (r != rank || i == 1))
+            {
+                close(run->down[2 * r + i]);
+                run->down[2 * r + i] = -1;
+            }
+        }
+    }
+}
+
+/*
+Runs SymNMF on the n*d points with W row-partitioned across workers processes (at most one per block of REDUCTION_BLOCK rows).
+Each worker computes and keeps only its rows of W; the only things exchanged are the rows of H, the degrees, and the k*k partial sums of (H^T)H.
+If H is given it is the starting point (and stays the caller's), otherwise H is drawn from the seed as init_H would.
+Returns a NEW n*k matrix H, bit-identical to what optimizing_H gives on the full W, or a null pointer on failure.
+*/
+double** distributed_symnmf(double** points, int n, int d, int k, double** H, unsigned long seed, int workers)
+{
+    int i, r, status, failed = 0, started = 0;
+    pid_t* pids;
+    double** result = NULL;
+    void (*old_handler)(int);
+    distributed_run run;
+    if (workers > MAX_WORKERS)
+        workers = MAX_WORKERS;
+    if (workers < 1 || open_distributed_run(&run, points, n, d, k, workers) == 1)
+        return NULL;
+    if (H != NULL)
+        for (i = 0; i < n; i++)
+            memcpy(run.H[0][i], H[i], k * sizeof(double));
+    pids = (pid_t*)malloc(run.workers * sizeof(pid_t));
+    old_handler = signal(SIGPIPE, SIG_IGN); /* A worker that died shows up as a failed write, not as a signal that kills the driver */
+    fflush(NULL); /* So the workers don't inherit (and print again) anything still buffered */
+    for (r = 0; pids != NULL && r < run.workers; r++)
+    {
+        pids[r] = fork();
+        if (pids[r] < 0)
+        {
+            failed = 1;
+            break;
+        }
+        if (pids[r] == 0)
+        {
+            keep_worker_pipes(&run, r);
+            _exit(run_worker(&run, r, H == NULL, seed));
+        }
+        started++;
+    }
+    if (!failed && pids != NULL)
+        keep_worker_pipes(&run, -1);
+    if (pids == NULL || failed || drive_barriers(&run) == 1)
+    {
+        failed = 1;
+        for (r = 0; r < started; r++)
+            kill(pids[r], SIGTERM);
+    }
+    for (r = 0; r < started; r++)
+    {
+        if (waitpid(pids[r], &status, 0) != pids[r] || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    }
+    if (!failed && (result = alloc_matrix(n, k)) != NULL)
+        for (i = 0; i < n; i++)
+            memcpy(result[i], run.H[(int)run.header[0] % 2][i], k * sizeof(double));
+    signal(SIGPIPE, old_handler);
+    free(pids);
+    close_distributed_run(&run);
+    return result;
+}
@@ -0,0 +1,39 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+/*
+What the driver and every worker process share. The arrays live in one shared mapping, so a row written by one worker is seen by all.
+H and the per-block partial sums of (H^T)H are double buffered: every iteration reads one copy and writes the other,
+so a worker that runs ahead never overwrites what a slower one is still reading.
+*/
+typedef struct {
+    int n, d, k, workers, blocks;
+    double** points;
+    double* shared; /* The whole mapping: the header, then the arrays below */
+    size_t shared_bytes;
+    double* header; /* [0] - how many iterations ran, written by worker 0 before it exits */
+    double** H[2];
+    double* scales; /* The kernel width of every point (See point_scales) */
+    double* D_neg_half;
+    double* row_values[2]; /* Row sums of W, then the squared change of every row of H */
+    double* partials[2]; /* blocks*k*k - (H^T)H of every REDUCTION_BLOCK rows */
+    int* up; /* workers pipes, 2 fds each - worker r writes a byte to pipe r when it reaches a barrier ('e' if it failed) */
+    int* down; /* workers pipes, 2 fds each - the driver releases worker r from a barrier through pipe r */
+} distributed_run;
+
+/* Function declarations */
+double** distributed_symnmf(double** points, int n, int d, int k, double** H, unsigned long seed, int workers);
+
+/* Helper functions */
+int open_distributed_run(distributed_run* run, double** points, int n, int d, int k, int workers);
+void close_distributed_run(distributed_run* run);
+void worker_rows(distributed_run* run, int rank, int* first, int* last);
+int worker_barrier(distributed_run* run, int rank, char status);
+void worker_gram_partials(distributed_run* run, double** H, double* partials, int first, int last, double** HtH);
+void sum_gram_partials(distributed_run* run, double* partials, double** HtH);
+double block_ordered_sum(double* values, int count);
+int run_worker(distributed_run* run, int rank, int draw_H, unsigned long seed);
+int drive_barriers(distributed_run* run);
+void keep_worker_pipes(distributed_run* run, int rank);
+
+#endif
@@ -0,0 +1,130 @@
+/*
+* planner.c - Picking how symnmf takes W before anything is allocated
+* Estimates the peak memory, disk and runtime of every strategy from n, d and k alone, and picks the fastest one that fits a memory budget,
+* so a large n runs out-of-core or matrix-free instead of running out of memory (or into swap) on a dense W.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "symnmf.h"
+#include "planner.h"
+
+#define PLAN_ITERATIONS 100 /* Iterations the runtimes are estimated for - our data sets converge in 30 to 120 */
+#define KERNEL_CELL_SECONDS 8e-9 /* Computing one cell of W from two points, besides their distance */
+#define DIMENSION_SECONDS 1.5e-9 /* Every dimension of a distance */
+#define UPDATE_CELL_SECONDS 0.4e-9 /* Every cell of W times every column of H in an iteration */
+#define DISK_BYTES_PER_SECOND 500e6 /* Reading or writing W in a file (a W that doesn't fit the budget isn't in the page cache either) */
+#define PYTHON_CELL_BYTES 40.0 /* A cell of a matrix in a Python list - the pointer and the float object */
+#define MALLOC_OVERHEAD 16.0 /* Bytes malloc adds to every row */
+#define PROCESS_BYTES (8.0 * 1048576) /* What the process holds besides the matrices - code, libraries, stacks and I/O buffers */
+#define PYTHON_PROCESS_BYTES (64.0 * 1048576) /* The same for the interpreter with numpy, pandas and the module loaded */
+
+/*
+Returns the bytes of a matrix of rows arrays of cols doubles, with their pointers and what malloc adds to every row.
+*/
+double rows_bytes(double rows, double cols)
+{
+    return rows * (cols * sizeof(double) + sizeof(double*) + MALLOC_OVERHEAD);
+}
+
+/*
+Estimates what running symnmf on n points of dimension d with k clusters costs with every strategy, into estimates[STRATEGY_...].
+through_python - whether the points and H go through Python lists (symnmf.py), in an interpreter. W never does - every mode builds it in C.
+The estimates follow the modes that are set (in-place updates, the multilevel solver and the amount of threads), and the runtimes
+come from per-cell costs measured on a single core, so only their ratios are meant to be trusted.
+Returns the strategy with the lowest runtime whose memory fits within budget (any, if budget is not above 0), or -1 if none fits.
+*/
+int plan_symnmf(int n, int d, int k, double budget, int through_python, plan_estimate* estimates)
+{
+    int s, chosen = -1, threads = omp_get_max_threads();
+    double cells = (double)n * n, kernel = KERNEL_CELL_SECONDS + d * DIMENSION_SECONDS, update = cells * k * UPDATE_CELL_SECONDS / threads;
+    double panel_rows = PANEL_BYTES / (sizeof(double) * (double)n), coarse = (n < COARSE_ROWS) ? n : COARSE_ROWS;
+    double common = rows_bytes(n, d) + rows_bytes(n, k) + (in_place_updates ? rows_bytes(TILE_SIZE, k) : rows_bytes(n, k)) + 4.0 * n * sizeof(double)
+                    + (through_python ? PYTHON_PROCESS_BYTES : PROCESS_BYTES);
+    if (multilevel_solver)
+        common += 2 * rows_bytes(coarse, coarse); /* The coarsest graph built from W, and the one it is coarsened from */
+    if (through_python)
+        common += ((double)n * d + 2.0 * n * k) * PYTHON_CELL_BYTES; /* The points, and H in and out */
+    if (panel_rows < 1)
+        panel_rows = 1;
+    if (panel_rows > n)
+        panel_rows = n;
+    estimates[STRATEGY_DENSE].name = "dense";
+    estimates[STRATEGY_DENSE].memory = common + rows_bytes(n, n);
+    estimates[STRATEGY_DENSE].disk = 0;
+    estimates[STRATEGY_DENSE].seconds = cells * (kernel / 2 + UPDATE_CELL_SECONDS) / threads + PLAN_ITERATIONS * update;
+    estimates[STRATEGY_OUT_OF_CORE].name = "out-of-core";
+    estimates[STRATEGY_OUT_OF_CORE].memory = common + rows_bytes(panel_rows, n) + 2.0 * n * sizeof(double);
+    estimates[STRATEGY_OUT_OF_CORE].disk = cells * sizeof(double);
+    estimates[STRATEGY_OUT_OF_CORE].seconds = 2 * cells * kernel / threads + (PLAN_ITERATIONS + 1) * cells * sizeof(double) / DISK_BYTES_PER_SECOND + PLAN_ITERATIONS * update;
+    estimates[STRATEGY_MATRIX_FREE].name = "matrix-free";
+    estimates[STRATEGY_MATRIX_FREE].memory = common + 2.0 * n * sizeof(double) + rows_bytes(TILE_SIZE, n);
+    estimates[STRATEGY_MATRIX_FREE].disk = 0;
+    estimates[STRATEGY_MATRIX_FREE].seconds = 2 * cells * kernel / threads + PLAN_ITERATIONS * (cells * kernel / threads + update);
+    for (s = 0; s < STRATEGIES; s++)
+    {
+        estimates[s].fits = (budget <= 0 || estimates[s].memory <= budget);
+        if (estimates[s].fits && (chosen == -1 || estimates[s].seconds < estimates[chosen].seconds))
+            chosen = s;
+    }
+    return chosen;
+}
+
+/*
+Writes the estimates of plan_symnmf and the strategy it chose (-1 - none fits) to out, one line per strategy.
+*/
+void report_plan(FILE* out, int n, int d, int k, double budget, plan_estimate* estimates, int chosen)
+{
+    int s;
+    if (budget > 0)
+        fprintf(out, "plan: n=%d d=%d k=%d, memory budget %.1f MiB\n", n, d, k, budget / 1048576);
+    else
+        fprintf(out, "plan: n=%d d=%d k=%d, no memory budget\n", n, d, k);
+    for (s = 0; s < STRATEGIES; s++)
+        fprintf(out, "plan:   %-12s memory %10.1f MiB  disk %10.1f MiB  time %10.1f s%s\n", estimates[s].name,
+                estimates[s].memory / 1048576, estimates[s].disk / 1048576, estimates[s].seconds, estimates[s].fits ? "" : "  (does not fit)");
+    if (chosen >= 0)
+        fprintf(out, "plan: running %s\n", estimates[chosen].name);
+    else
+        fprintf(out, "plan: no strategy fits the budget\n");
+}
+
+/*
+Reads a size in bytes, optionally followed by K, M, G or T (powers of 1024, in either case) and an optional B, e.g. "512M" or "1.5GB".
+Returns the bytes, or -1 if text isn't such a size or isn't above 0.
+*/
+double parse_memory_size(const char* text)
+{
+    char* end;
+    double size = strtod(text, &end), unit = 1;
+    const char* units = "KMGT";
+    const char* found = (*end == '\0') ? NULL : strchr(units, (*end >= 'a' && *end <= 'z') ? *end - 'a' + 'A' : *end);
+    int power;
+    if (end == text || size <= 0)
+        return -1;
+    if (found != NULL)
+    {
+        for (power = 0; power <= found - units; power++)
+            unit *= 1024;
+        end++;
+    }
+    if (*end == 'B' || *end == 'b')
+        end++;
+    return (*end == '\0') ? size * unit : -1;
+}
+
+/*
+Reads the flag --memory-budget SIZE (See parse_memory_size) if it is the first of the argc arguments args, putting the size into budget.
+Returns how many arguments the flag took (0 if it isn't there), or -1 if SIZE is missing or isn't a size.
+*/
+int parse_budget_flag(int argc, char* args[], double* budget)
+{
+    if (argc < 1 || strcmp(args[0], "--memory-budget") != 0)
+        return 0;
+    if (argc < 2 || parse_memory_size(args[1]) < 0)
+        return -1;
+    *budget = parse_memory_size(args[1]);
+    return 2;
+}
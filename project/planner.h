@@ -0,0 +1,33 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <stdio.h>
+
+#define STRATEGIES 3 /* The ways symnmf can take W, in the order plan_symnmf estimates them */
+#define STRATEGY_DENSE 0 /* W in memory */
+#define STRATEGY_OUT_OF_CORE 1 /* W in a file, streamed through one panel at a time (See optimizing_H_out_of_core) */
+#define STRATEGY_MATRIX_FREE 2 /* W recomputed from the points on every iteration (See optimizing_H_matrix_free) */
+
+/*
+What plan_symnmf expects one strategy to cost. name - the strategy as SYMNMF_MODE calls it,
+memory - the peak bytes in memory, disk - the bytes of W on disk, seconds - the runtime of building W and PLAN_ITERATIONS iterations,
+fits - whether memory is within the budget.
+*/
+typedef struct {
+    const char* name;
+    double memory;
+    double disk;
+    double seconds;
+    int fits;
+} plan_estimate;
+
+/* Function declarations */
+int plan_symnmf(int n, int d, int k, double budget, int through_python, plan_estimate* estimates);
+void report_plan(FILE* out, int n, int d, int k, double budget, plan_estimate* estimates, int chosen);
+double parse_memory_size(const char* text);
+int parse_budget_flag(int argc, char* args[], double* budget);
+
+/* Helper functions */
+double rows_bytes(double rows, double cols);
+
+#endif
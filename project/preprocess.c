@@ -0,0 +1,416 @@
+/*
+* preprocess.c - Optional preprocessing of the points between read_data and similarity_matrix
+* Dropping exact duplicates, standardizing the columns and projecting onto the top principal components (randomized SVD),
+* which makes every distance in W cheaper when d is large (e.g. embeddings).
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "symnmf.h"
+#include "preprocess.h"
+
+#define PCA_OVERSAMPLING 10 /* Extra directions the randomized SVD samples beyond the p it keeps */
+#define PCA_POWER_ITERATIONS 2 /* Passes of (X X^T) that sharpen the sampled range towards the top components */
+#define JACOBI_MAX_SWEEPS 64
+
+/*
+Runs the preprocessing steps options asks for on the n*d points, replacing *points, *n and *d with the result.
+If options->dedup is set, *representative becomes a NEW array of the original n, holding the row every original point ended up in
+(See expand_rows), otherwise it is a null pointer. Returns 0 on success and 1 on memory allocation failure
+(*points and *n then still describe valid rows the caller must free).
+*/
+int preprocess_points(double*** points, int* n, int* d, const preprocess_options* options, int** representative)
+{
+    double** projected;
+    *representative = NULL;
+    if (options->dedup)
+    {
+        *representative = (int*)malloc(*n * sizeof(int));
+        if (*representative == NULL || drop_duplicates(*points, n, *d, *representative) == 1)
+            return 1;
+    }
+    if (options->standardize)
+        standardize_columns(*points, *n, *d);
+    if (options->pca_components > 0 && options->pca_components < *d && options->pca_components < *n)
+    {
+        projected = pca_project(*points, *n, *d, options->pca_components, options->seed);
+        if (projected == NULL)
+            return 1;
+        free_matrix(*points, *n);
+        *points = projected;
+        *d = options->pca_components;
+    }
+    return 0;
+}
+
+/*
+Reads the preprocessing flags at the start of the argc command line arguments args into options (and clears the rest of options):
+--dedup, --standardize and --pca P. Returns how many arguments the flags took, or -1 if a flag is unknown or P isn't a positive number.
+*/
+int parse_preprocess_flags(int argc, char* args[], preprocess_options* options)
+{
+    int used = 0;
+    char* end;
+    memset(options, 0, sizeof(*options));
+    while (used < argc && strncmp(args[used], "--", 2) == 0)
+    {
+        if (strcmp(args[used], "--dedup") == 0)
+            options->dedup = 1;
+        else if (strcmp(args[used], "--standardize") == 0)
+            options->standardize = 1;
+        else if (strcmp(args[used], "--pca") == 0 && used + 1 < argc)
+        {
+            options->pca_components = (int)strtol(args[++used], &end, 10);
+            if (*end != '\0' || options->pca_components <= 0)
+                return -1;
+        }
+        else
+            return -1;
+        used++;
+    }
+    return used;
+}
+
+/*
+Returns a hash of the point's coordinates (only the value matters, so 0 and -0 hash the same).
+*/
+unsigned long point_hash(double* point, int d)
+{
+    int j, b;
+    unsigned long h = 0, word;
+    unsigned char bytes[sizeof(double)];
+    double value;
+    for (j = 0; j < d; j++)
+    {
+        value = point[j] + 0.0; /* -0 + 0 is 0 */
+        memcpy(bytes, &value, sizeof(double));
+        for (b = 0; b + 4 <= (int)sizeof(double); b += 4)
+        {
+            word = (unsigned long)bytes[b] | ((unsigned long)bytes[b + 1] << 8) | ((unsigned long)bytes[b + 2] << 16) | ((unsigned long)bytes[b + 3] << 24);
+            h = hash32(h ^ word);
+        }
+    }
+    return h;
+}
+
+/*
+Returns 1 if both points of dimension d have exactly the same coordinates, and 0 otherwise.
+*/
+int same_point(double* point1, double* point2, int d)
+{
+    int j;
+    for (j = 0; j < d; j++)
+        if (point1[j] != point2[j])
+            return 0;
+    return 1;
+}
+
+/*
+Drops exact duplicates from the n points IN PLACE, keeping the first occurrence of every point in its original order, and updates n.
+The rows of dropped points are freed. representative (of the original n) gets the new row of every original point.
+Duplicates are found with a hash table of the points, in O(nd). Returns 0 on success and 1 on memory allocation failure (nothing is dropped then).
+*/
+int drop_duplicates(double** points, int* n, int d, int* representative)
+{
+    int i, kept = 0, slot, size = 1;
+    int* table;
+    while (size < 2 * *n)
+        size *= 2;
+    table = (int*)malloc(size * sizeof(int));
+    if (table == NULL)
+        return 1;
+    for (slot = 0; slot < size; slot++)
+        table[slot] = -1;
+    for (i = 0; i < *n; i++)
+    {
+        slot = (int)(point_hash(points[i], d) & (unsigned long)(size - 1));
+        while (table[slot] != -1 && !same_point(points[table[slot]], points[i], d))
+            slot = (slot + 1) & (size - 1); /* Linear probing */
+        if (table[slot] != -1)
+        {
+            representative[i] = table[slot];
+            free(points[i]);
+            continue;
+        }
+        table[slot] = kept;
+        representative[i] = kept;
+        points[kept++] = points[i];
+    }
+    free(table);
+    *n = kept;
+    return 0;
+}
+
+/*
+Scales every column of the n*d points IN PLACE to mean 0 and (population) variance 1. A constant column becomes all 0.
+*/
+void standardize_columns(double** points, int n, int d)
+{
+    int i, j;
+    double mean, var;
+    #pragma omp parallel for private(i, mean, var) schedule(static)
+    for (j = 0; j < d; j++)
+    {
+        mean = 0.0;
+        for (i = 0; i < n; i++)
+            mean += points[i][j];
+        mean /= n;
+        var = 0.0;
+        for (i = 0; i < n; i++)
+            var += (points[i][j] - mean) * (points[i][j] - mean);
+        var /= n;
+        for (i = 0; i < n; i++)
+            points[i][j] = (var > 0) ? (points[i][j] - mean) / sqrt(var) : 0.0;
+    }
+}
+
+/*
+Subtracts the mean of every column of the n*d points from it, IN PLACE. Distances between the points don't change.
+*/
+void center_columns(double** points, int n, int d)
+{
+    int i, j;
+    double mean;
+    #pragma omp parallel for private(i, mean) schedule(static)
+    for (j = 0; j < d; j++)
+    {
+        mean = 0.0;
+        for (i = 0; i < n; i++)
+            mean += points[i][j];
+        mean /= n;
+        for (i = 0; i < n; i++)
+            points[i][j] -= mean;
+    }
+}
+
+/*
+Given a rows*cols matrix M, replaces its columns IN PLACE with an orthonormal basis of their span (modified Gram-Schmidt).
+A column that is (numerically) in the span of the ones before it becomes all 0.
+*/
+void orthonormalize_columns(double** M, int rows, int cols)
+{
+    int i, c, prev;
+    double dot, norm;
+    for (c = 0; c < cols; c++)
+    {
+        for (prev = 0; prev < c; prev++)
+        {
+            dot = 0.0;
+            for (i = 0; i < rows; i++)
+                dot += M[i][prev] * M[i][c];
+            for (i = 0; i < rows; i++)
+                M[i][c] -= dot * M[i][prev];
+        }
+        norm = 0.0;
+        for (i = 0; i < rows; i++)
+            norm += M[i][c] * M[i][c];
+        norm = sqrt(norm);
+        for (i = 0; i < rows; i++)
+            M[i][c] = (norm > 1e-12) ? M[i][c] / norm : 0.0;
+    }
+}
+
+/*
+Given a rows*inner matrix A and an inner*cols matrix B, returns their NEW rows*cols product AB.
+If memory allocation error occurs, returns a null pointer.
+*/
+double** times_matrix(double** A, double** B, int rows, int inner, int cols)
+{
+    int i, t, j;
+    double** AB = alloc_matrix(rows, cols);
+    if (AB == NULL)
+        return NULL;
+    #pragma omp parallel for private(t, j) schedule(static)
+    for (i = 0; i < rows; i++)
+        for (t = 0; t < inner; t++)
+            for (j = 0; j < cols; j++)
+                AB[i][j] += A[i][t] * B[t][j];
+    return AB;
+}
+
+/*
+Given a rows*cols_a matrix A and a rows*cols_b matrix B, returns their NEW cols_a*cols_b product (A^T)B.
+Every cell sums over the rows in order, so the result doesn't depend on the threads. If memory allocation error occurs, returns a null pointer.
+*/
+double** transposed_times_matrix(double** A, double** B, int rows, int cols_a, int cols_b)
+{
+    int i, s, j;
+    double** AtB = alloc_matrix(cols_a, cols_b);
+    if (AtB == NULL)
+        return NULL;
+    #pragma omp parallel for private(i, j) schedule(static)
+    for (s = 0; s < cols_a; s++)
+        for (i = 0; i < rows; i++)
+            for (j = 0; j < cols_b; j++)
+                AtB[s][j] += A[i][s] * B[i][j];
+    return AtB;
+}
+
+/*
+Finds the eigenvalues and eigenvectors of the symmetric m*m matrix A with the cyclic Jacobi method, destroying A.
+Puts the eigenvalues into values (unsorted) and the matching eigenvectors into the columns of the m*m matrix vectors.
+Returns the amount of sweeps it took.
+*/
+int symmetric_eigen(double** A, int m, double* values, double** vectors)
+{
+    int p, q, r, sweep;
+    double off, total, theta, t, c, s, x, y;
+    for (p = 0; p < m; p++)
+        for (q = 0; q < m; q++)
+            vectors[p][q] = (p == q) ? 1.0 : 0.0;
+    for (sweep = 0; sweep < JACOBI_MAX_SWEEPS; sweep++)
+    {
+        off = total = 0.0;
+        for (p = 0; p < m; p++)
+            for (q = 0; q < m; q++)
+            {
+                total += A[p][q] * A[p][q];
+                if (p != q)
+                    off += A[p][q] * A[p][q];
+            }
+        if (off <= 1e-30 * total)
+            break;
+        for (p = 0; p < m; p++)
+            for (q = p + 1; q < m; q++)
+            {
+                if (A[p][q] == 0.0)
+                    continue;
+                theta = (A[q][q] - A[p][p]) / (2 * A[p][q]);
+                t = ((theta >= 0) ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1));
+                c = 1 / sqrt(t * t + 1);
+                s = t * c;
+                for (r = 0; r < m; r++) /* A J */
+                {
+                    x = A[r][p]; y = A[r][q];
+                    A[r][p] = c * x - s * y;
+                    A[r][q] = s * x + c * y;
+                }
+                for (r = 0; r < m; r++) /* J^T (A J) */
+                {
+                    x = A[p][r]; y = A[q][r];
+                    A[p][r] = c * x - s * y;
+                    A[q][r] = s * x + c * y;
+                }
+                for (r = 0; r < m; r++)
+                {
+                    x = vectors[r][p]; y = vectors[r][q];
+                    vectors[r][p] = c * x - s * y;
+                    vectors[r][q] = s * x + c * y;
+                }
+            }
+    }
+    for (p = 0; p < m; p++)
+        values[p] = A[p][p];
+    return sweep;
+}
+
+/*
+Given the n*d points, returns a NEW n*p matrix of their coordinates along their top p principal components (1 <= p < d).
+The points are centered IN PLACE first. The components come from a randomized SVD (Halko, Martinsson and Tropp):
+X is multiplied by p + PCA_OVERSAMPLING random directions (drawn from seed), sharpened by PCA_POWER_ITERATIONS passes of X X^T,
+and the small matrix B = Q^T X of the resulting orthonormal basis Q is decomposed exactly - so X is only read O(PCA_POWER_ITERATIONS) times.
+If memory allocation error occurs, returns a null pointer.
+*/
+double** pca_project(double** points, int n, int d, int p, unsigned long seed)
+{
+    int i, j, c, best, l = (p + PCA_OVERSAMPLING < d) ? p + PCA_OVERSAMPLING : d, it, failed = 0;
+    double tmp;
+    double **omega, **Q = NULL, **Z, **B = NULL, **BBt = NULL, **U = NULL, **result = NULL;
+    double* values = (double*)malloc(l * sizeof(double));
+    int* order = (int*)malloc(l * sizeof(int));
+    if (l > n)
+        l = n;
+    center_columns(points, n, d);
+    omega = alloc_matrix(d, l);
+    if (omega == NULL || values == NULL || order == NULL)
+        failed = 1;
+    for (i = 0; i < d && !failed; i++)
+        for (j = 0; j < l; j++)
+            omega[i][j] = 2 * uniform_draw(seed, (unsigned long)i * l + j) - 1;
+    if (!failed && (Q = times_matrix(points, omega, n, d, l)) == NULL)
+        failed = 1;
+    free_matrix(omega, d);
+    if (!failed)
+        orthonormalize_columns(Q, n, l);
+    for (it = 0; it < PCA_POWER_ITERATIONS && !failed; it++)
+    {
+        Z = transposed_times_matrix(points, Q, n, d, l); /* d*l: X^T Q */
+        if (Z == NULL)
+        {
+            failed = 1;
+            break;
+        }
+        orthonormalize_columns(Z, d, l);
+        free_matrix(Q, n);
+        Q = times_matrix(points, Z, n, d, l);
+        free_matrix(Z, d);
+        if (Q == NULL)
+            failed = 1;
+        else
+            orthonormalize_columns(Q, n, l);
+    }
+    if (!failed && (B = transposed_times_matrix(Q, points, n, l, d)) == NULL) /* l*d: Q^T X */
+        failed = 1;
+    if (!failed)
+    {
+        BBt = alloc_matrix(l, l);
+        U = alloc_matrix(l, l);
+        result = alloc_matrix(n, p);
+        failed = (BBt == NULL || U == NULL || result == NULL);
+    }
+    if (!failed)
+    {
+        for (i = 0; i < l; i++)
+            for (j = 0; j < l; j++)
+                for (c = 0; c < d; c++)
+                    BBt[i][j] += B[i][c] * B[j][c];
+        symmetric_eigen(BBt, l, values, U); /* B B^T = U S^2 U^T, so X V ~ Q B V = Q U S */
+        for (c = 0; c < l; c++)
+            order[c] = c;
+        for (c = 0; c < p; c++) /* The p largest eigenvalues first */
+        {
+            best = c;
+            for (j = c + 1; j < l; j++)
+                if (values[order[j]] > values[order[best]])
+                    best = j;
+            j = order[c]; order[c] = order[best]; order[best] = j;
+        }
+        #pragma omp parallel for private(c, j, tmp) schedule(static)
+        for (i = 0; i < n; i++)
+            for (c = 0; c < p; c++)
+            {
+                tmp = 0.0;
+                for (j = 0; j < l; j++)
+                    tmp += Q[i][j] * U[j][order[c]];
+                result[i][c] = tmp * sqrt(values[order[c]] > 0 ? values[order[c]] : 0.0);
+            }
+    }
+    else
+    {
+        free_matrix(result, n);
+        result = NULL;
+    }
+    free_matrix(Q, n);
+    free_matrix(B, l);
+    free_matrix(BBt, l);
+    free_matrix(U, l);
+    free(values);
+    free(order);
+    return result;
+}
+
+/*
+Given a matrix M with a row for every kept point (See drop_duplicates), returns a NEW n*cols matrix with a row for every original point -
+a copy of the row of the point it was a duplicate of. If memory allocation error occurs, returns a null pointer.
+*/
+double** expand_rows(double** M, int cols, int* representative, int n)
+{
+    int i;
+    double** expanded = alloc_matrix(n, cols);
+    if (expanded == NULL)
+        return NULL;
+    for (i = 0; i < n; i++)
+        memcpy(expanded[i], M[representative[i]], cols * sizeof(double));
+    return expanded;
+}
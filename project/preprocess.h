@@ -0,0 +1,33 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+/*
+Which preprocessing steps to run on the points before W is built (See preprocess_points). They run in this order.
+dedup - drop exact duplicate points, standardize - scale every column to mean 0 and variance 1,
+pca_components - if above 0 (and below d and n), project the points onto that many principal components, found with a randomized SVD drawn from seed.
+*/
+typedef struct {
+    int dedup;
+    int standardize;
+    int pca_components;
+    unsigned long seed;
+} preprocess_options;
+
+/* Function declarations */
+int parse_preprocess_flags(int argc, char* args[], preprocess_options* options);
+int preprocess_points(double*** points, int* n, int* d, const preprocess_options* options, int** representative);
+int drop_duplicates(double** points, int* n, int d, int* representative);
+void standardize_columns(double** points, int n, int d);
+double** pca_project(double** points, int n, int d, int p, unsigned long seed);
+double** expand_rows(double** M, int cols, int* representative, int n);
+
+/* Helper functions */
+unsigned long point_hash(double* point, int d);
+int same_point(double* point1, double* point2, int d);
+void center_columns(double** points, int n, int d);
+void orthonormalize_columns(double** M, int rows, int cols);
+double** times_matrix(double** A, double** B, int rows, int inner, int cols);
+double** transposed_times_matrix(double** A, double** B, int rows, int cols_a, int cols_b);
+int symmetric_eigen(double** A, int m, double* values, double** vectors);
+
+#endif
@@ -1,10 +1,25 @@
+import subprocess
 from setuptools import Extension, setup
+from setuptools.command.build_ext import build_ext
 
-module = Extension("symnmfmodule", sources=['symnmfmodule.c'])# Temp - Erase later # , 'symnmfalgo.c'])
+
+class build_ext_with_library(build_ext):
+    """Builds libsymnmf (with the Makefile's release flags) before the module that links against it."""
+    def run(self):
+        subprocess.check_call(['make', 'libsymnmf.so'])
+        super().run()
+
+
+# The module is only the Python binding - the algorithms come from libsymnmf, which is looked up next to the module.
+# OpenMP is only needed for the threads of the native pool (See set_pool in symnmfmodule.c).
+module = Extension("symnmfmodule", sources=['symnmfmodule.c'],
+                   libraries=['symnmf'], library_dirs=['.'], runtime_library_dirs=['$ORIGIN'],
+                   extra_compile_args=['-fopenmp'], extra_link_args=['-fopenmp'])
 setup(name='symnmfmodule',
      version='1.0',
      description='Python wrapper for custom C extension',
-     ext_modules=[module])
+     ext_modules=[module],
+     cmdclass={'build_ext': build_ext_with_library})
 
 # install by running in terminal:
-# python3 setup.py build_ext --inplace
\ No newline at end of file
+# python3 setup.py build_ext --inplace
@@ -3,40 +3,247 @@
 * This file provides an executable interface for the symNMF functions.
 */
 
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L /* For fileno, posix_fadvise and fsync, which -ansi hides */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
-/* #include "symnmf.h" */
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "symnmf.h"
+#include "distributed.h"
+#include "preprocess.h"
+#include "batch.h"
+#include "planner.h"
 
-#define max_iter 300
-#define eps 1e-4
-#define denominator_eps 1e-7
 #define beta 0.5
 #define SEPARATOR ","
 #define ERROR_MSG "An Error Has Occurred\n"
-#define MAX_LINE_LENGTH 1024
+#define MATRIX_FILE_MAGIC "SNM2" /* First bytes of every binary matrix file */
+#define MATRIX_HEADER_BYTES (4 + 3 * (long)sizeof(int) + (long)sizeof(double) + (long)sizeof(unsigned long)) /* The magic bytes, rows, cols, panel_rows, mean and fingerprint */
+#define TWO_POW_26 67108864.0
+#define TWO_POW_53 9007199254740992.0
+#define REDUCTIONS_ENV "SYMNMF_REDUCTIONS" /* Set to "fast" to let sums depend on the amount of threads */
+#define UPDATE_ENV "SYMNMF_UPDATE" /* Set to "in-place" to update H in place, one block of rows at a time */
+#define KERNELS_ENV "SYMNMF_KERNELS" /* Set to "generic" to never use the kernels specialized for a fixed k */
+#define MAX_FIXED_K 16 /* Largest k with specialized kernels (See DEFINE_FIXED_K_KERNELS) */
+#define SOLVER_ENV "SYMNMF_SOLVER" /* Set to "multilevel" to solve on coarsened graphs first (See optimizing_H_multilevel) */
+#define COARSEST_ROWS 128 /* Coarsening stops once a graph has at most this many rows */
+#define MAX_LEVELS 32
+#define SIGMA_ENV "SYMNMF_SIGMA" /* The width of the similarity kernel (See kernel_sigma) */
+#define LOCAL_SCALING_ENV "SYMNMF_LOCAL_SCALING" /* Set to m to scale every point by the distance to its m-th nearest neighbour */
+#define CHECKPOINT_ENV "SYMNMF_CHECKPOINT" /* Set to a file to checkpoint into and resume from (See checkpoint_path) */
+#define CHECKPOINT_EVERY_ENV "SYMNMF_CHECKPOINT_EVERY" /* Iterations between checkpoints */
+#define CHECKPOINT_INTERVAL 10 /* Default iterations between checkpoints */
+#define CHECKPOINT_MAGIC "CKP2" /* First bytes of the trailer that follows H in a checkpoint file */
+#define CHECKPOINT_W_SUFFIX ".W" /* A dense W is persisted next to the checkpoint, in a file named like it with this suffix */
+#define LABEL_STOP_ENV "SYMNMF_LABEL_STOP" /* Set to a window of iterations to stop once the hard labels are stable for that long */
+#define LABEL_TOLERANCE_ENV "SYMNMF_LABEL_TOLERANCE" /* The fraction of rows whose label may change in a window that is still stable */
+#define LABEL_CHECK_INTERVAL 5 /* Iterations between comparisons of the hard labels */
+#define LABEL_OBJECTIVE_GUARD 1e-3 /* Largest relative change of the objective between two label checks that still lets the labels stop a run */
+#define FIRST_TOUCH_ENV "SYMNMF_FIRST_TOUCH" /* Set to "serial" to have one thread zero all of an n*n matrix (See parallel_first_touch) */
+#define MEMORY_BUDGET_ENV "SYMNMF_MEMORY_BUDGET" /* Set to a size (See parse_memory_size) to let the planner pick how symnmf takes W */
+#define W_FILE_ENV "SYMNMF_W_FILE" /* Where W is written when the planner picks out-of-core (as in symnmf.py) */
+#define DEFAULT_W_FILE "symnmf_W.bin"
+#define SPARSE_TILES_ENV "SYMNMF_SPARSE_TILES" /* Set to a threshold to skip the tiles of W with no larger cell (See sparse_tile_threshold) */
+#define WORKERS_ENV "SYMNMF_WORKERS" /* Set to a number above 1 to run symnmf on that many worker processes (See distributed.c) */
+#if ULONG_MAX / 4294967295UL > 4294967295UL
+#define FAST_FORMAT_LIMIT 1e15 /* format_fixed4 rounds smaller values itself - their scaled mantissa fits in an unsigned long */
+#else
+#define FAST_FORMAT_LIMIT 0.0 /* No 64-bit unsigned long - every value goes through sprintf */
+#endif
+#define WRITE_BUFFER 65536 /* Bytes of text print_matrix formats before handing them to stdio */
+#define STREAM_TEXT_BYTES (2 * 1024 * 1024) /* Approximate size of the text of one block of rows of a streamed result */
+
+/*
+Everything but main makes up libsymnmf, which the executable and the Python module link against.
+The Makefile builds the library with SYMNMF_LIBRARY defined (leaving main out) and the executable's object with SYMNMF_CLI defined (leaving only main).
+*/
+#ifndef SYMNMF_CLI
+
+/*
+If not 0 (the default), every sum that spans rows is split into fixed blocks of REDUCTION_BLOCK rows whose partial sums are
+added in block order, so results are bit-identical for any amount of threads. If 0, OpenMP combines the per-thread sums in whatever order they finish.
+*/
+int reproducible_reductions = 1;
+
+/*
+If not 0, H is updated in place, one block of rows at a time (block Gauss-Seidel), instead of into a second n*k matrix (Jacobi, the default).
+The in-place updates use less memory and usually converge in fewer iterations, but do not give the same H as the default.
+*/
+int in_place_updates = 0;
+
+/*
+If not 0 (the default), the row kernels specialized for k (2..MAX_FIXED_K) are used when there is one, instead of the generic ones.
+Both give bit-identical results, only the speed differs.
+*/
+int fixed_k_kernels = 1;
+
+/*
+If not 0, optimizing_H_from_source solves on a hierarchy of coarsened graphs first, and only refines the result on W itself.
+*/
+int multilevel_solver = 0;
+
+/*
+If above 1, run_symnmf splits the rows of W among that many worker processes (See distributed_symnmf), none of which holds all of W.
+The result is the same H as with a single process.
+*/
+int distributed_workers = 1;
+
+/*
+The width sigma of the similarity kernel: A[i][j] = exp(-||x_i - x_j||^2 / (2 * sigma^2)). The default 1 is the kernel of the instructions.
+*/
+double kernel_sigma = 1.0;
+
+/*
+If above 0 (local scaling, also known as self-tuning), every point i gets its own width sigma_i - the distance to its local_scaling_neighbor-th
+nearest neighbour - and A[i][j] = exp(-||x_i - x_j||^2 / (2 * sigma_i * sigma_j)). Dense regions get narrow kernels and sparse ones wide kernels.
+*/
+int local_scaling_neighbor = 0;
+
+/*
+If not a null pointer, optimizing_H writes a checkpoint into this file every checkpoint_interval iterations and once it is done, and if the file
+already holds a checkpoint of the same n, k and checkpoint_fingerprint, resumes from it instead of starting over (See write_checkpoint).
+A dense W is persisted once, next to the checkpoint, so a resumed run doesn't have to build it again.
+*/
+const char* checkpoint_path = NULL;
+int checkpoint_interval = CHECKPOINT_INTERVAL;
+
+/*
+The fingerprint of the input being optimized (See input_fingerprint), which every checkpoint records. Whoever sets checkpoint_path and
+starts an optimization sets it too (run_symnmf does). 0 stands for an unknown input, whose checkpoints are written but never resumed from.
+*/
+unsigned long checkpoint_fingerprint = 0;
+
+/*
+If above 0, optimizing_H also stops once the hard labels (argmax of every row of H) have been stable for label_stop_window iterations,
+as long as the objective moved by at most LABEL_OBJECTIVE_GUARD (relatively) since the previous check. Every LABEL_CHECK_INTERVAL iterations,
+the labels are compared to those the window started with, and if more than label_stop_tolerance of the rows changed, a new window starts.
+With the default tolerance of 0, a single changed label starts a new window. Rows on the border of two clusters may keep flipping for long,
+so a small tolerance (say 0.02) may stop much sooner, but the labels of a full run can then have drifted further, one window after another.
+Either way, H itself (and so any soft membership) is less converged. A window of 0 (the default) never stops on labels.
+*/
+int label_stop_window = 0;
+double label_stop_tolerance = 0.0;
+
+/*
+If not 0 (the default), every row of W is allocated and first written by the thread that works on that row in the updates (See alloc_matrix_first_touch),
+so on a NUMA machine its pages land on that thread's node, instead of all on the node of the thread that allocated W.
+It only changes where the pages are, never the results. It pays off when the threads are pinned (e.g. OMP_PROC_BIND=spread OMP_PLACES=cores),
+since an unpinned thread may move away from its rows.
+*/
+int parallel_first_touch = 1;
+
+/*
+If above 0, run_symnmf first estimates the memory and runtime of every way of taking W (See plan_symnmf), reports them on stderr
+and runs the fastest one whose peak memory fits within these many bytes - or exits with an error right away if none does.
+0 (the default) always builds a dense W.
+*/
+double memory_budget = 0.0;
+
+/*
+If not below 0, every TILE_SIZE*TILE_SIZE tile of a dense W whose cells are all at most this threshold is set to 0 before the iterations,
+and the products WH skip those tiles instead of multiplying their zeros (See build_tile_index). The fill - the part of W left in
+non-empty tiles - is reported on stderr. A threshold of 0 only skips tiles that already are 0 (far apart points underflow the kernel to 0),
+so H is the same as without it. Above 0, H is that of the thresholded W. How many tiles are empty depends on the order of the points:
+points of the same cluster next to each other in the input make W block diagonal. -1 (the default) never skips tiles.
+*/
+double sparse_tile_threshold = -1.0;
 
 /* Function declarations */
 double squared_euclidean_dist(double* point1, double* point2, int dimension);
-double** get_column(double** M, int rows_num, int j);
+double similarity(double sq_dist, double scale_i, double scale_j);
+void keep_nearest(double* nearest, int* count, int m, double sq_dist);
+double local_scale(double* nearest, int count);
+double* point_scales(double** datapoints, int n, int d);
 double** optimizing_H(double** H, int rows_num, int cols_num, double** W);
+double** optimizing_H_matrix_free(double** H, int n, int k, double** datapoints, int d);
+double** optimizing_H_out_of_core(double** H, int n, int k, const char* filename);
+double** run_symnmf(double** points, int n, int d, int k, unsigned long seed);
+double** run_symnmf_without_dense_W(double** points, int n, int d, int k, unsigned long seed, int strategy, const char* persisted_W);
 int update_H(double** W, double** H, double** new_H, int n, int k);
 double** similarity_matrix(double** datapoints, int n, int d);
+double** locally_scaled_similarity_matrix(double** A, double** datapoints, int n, int d);
+void mirror_upper_triangle(double** A, int n);
 double** diagonal_degree_matrix(double** A, int n);
 double** normalized_similarity_matrix(double** sim_matrix, int n);
+double** normalized_similarity_from_points(double** datapoints, int n, int d);
 
 double **read_data(const char *filename, int *n, int *d);
+double **read_points(const char *filename, char line[], int *n, int *d);
 void print_matrix(double **matrix, int rows, int cols);
+int format_fixed4(double x, char* text);
+int format_row(double* row, int cols, char* text, size_t capacity);
+void write_row(FILE* out, double* row, int cols, char* text, size_t capacity);
+int stream_selected_algorithm(const char* goal, double** points, int n, int d);
+void similarity_row(double** datapoints, int n, int d, double* scales, double* D_neg_half, int i, double* row);
 
 /* Helper functions */
 double** run_selected_algorithm(const char* goal, double** A, double** points, int n, int d);
 double **create_points_matrix(FILE *fp, char line[], int *n, int *d);
 double sq_frobenius_norm(double** A, int rows_num, int cols_num, double** B);
+double* degree_vector(double** A, int n);
+double* inv_sqrt_degree_vector(double** A, int n);
+void normalize_in_place(double** A, double* D_neg_half, int n);
 void free_matrix(double** M, int len);
 double** multiply_matrix(double** matrixA, double** matrixB, int m, int n, int k); /* A - m x n, B - n x k */
 double matrix_mult_cell(double** A, int A_cols_num ,double** B, int i, int j);
-void update_H_cell(double **W, double **H, double **new_H, double **HtH_col, int n, int k, int i, int j);
+double** alloc_matrix(int rows, int cols);
+double** alloc_matrix_first_touch(int rows, int cols);
+double** gram_matrix(double** H, int n, int k);
+void add_gram_rows(double** H, int first, int last, int k, double** HtH);
+double ordered_sum(double* values, int count);
+void read_env_modes(void);
+void w_times_row(double* W_row, double** H, double* WH_row, int n, int k);
+void tiled_w_times_row(double* W_row, double** H, double* WH_row, int n, int k, const int* tiles, int count);
+double update_row(double* H_row, double** HtH, double* WH_new_row, int k);
+DECLARE_FIXED_K_KERNELS(2) DECLARE_FIXED_K_KERNELS(3) DECLARE_FIXED_K_KERNELS(4) DECLARE_FIXED_K_KERNELS(5)
+DECLARE_FIXED_K_KERNELS(6) DECLARE_FIXED_K_KERNELS(7) DECLARE_FIXED_K_KERNELS(8) DECLARE_FIXED_K_KERNELS(9)
+DECLARE_FIXED_K_KERNELS(10) DECLARE_FIXED_K_KERNELS(11) DECLARE_FIXED_K_KERNELS(12) DECLARE_FIXED_K_KERNELS(13)
+DECLARE_FIXED_K_KERNELS(14) DECLARE_FIXED_K_KERNELS(15) DECLARE_FIXED_K_KERNELS(16)
+const row_kernels* select_row_kernels(int k);
+void dense_w_times_H(double** W, double** H, double** WH, int first, int last, int n, int k);
+void tiled_w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k);
+int build_tile_index(w_source* src, int n, double threshold);
+void free_tile_index(w_source* src);
+void matrix_free_w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k);
+int w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k);
+void apply_update(double** H, double** HtH, double** WH_new, double* row_deltas, double* row_traces, int first, int last, int k);
+int update_H_from_source(w_source* src, double** H, double** new_H, double* row_deltas, int n, int k, double* delta);
+int update_H_in_place(w_source* src, double** H, double** block, int block_rows, double* row_deltas, int n, int k, double* delta);
+double** optimizing_H_from_source(double** H, int rows_num, int cols_num, w_source* src);
+double** optimizing_H_single_level(double** H, int rows_num, int cols_num, w_source* src, const char* checkpoint);
+int labels_changed(double** H, int n, int k, int* labels, int* reference);
+double** optimizing_H_multilevel(double** H, int n, int k, w_source* src, const char* checkpoint);
+double source_sq_norm(w_source* src, int n);
+double sq_norm(double** A, int rows, int cols);
+int w_source_rows(w_source* src, int first, int last, int n, double** buffer, double** rows);
+int landmark_aggregates(w_source* src, int n, int n_coarse, int* aggregate);
+int heavy_edge_matching(w_source* src, int n, int* sizes, int* aggregate);
+double** coarse_graph(w_source* src, int n, int* aggregate, int n_coarse);
+double** restrict_H(double** H, int n, int k, int* aggregate, int* children, int n_coarse);
+double** prolong_H(double** H_coarse, int n, int k, int* aggregate, int* children);
+double* matrix_free_inv_sqrt_degrees(double** datapoints, int n, int d, double* scales);
+double matrix_free_mean(double** datapoints, int n, int d, double* scales, double* D_neg_half);
+void init_w_source(w_source* src);
+double matrix_mean(double** M, int rows, int cols);
+unsigned long hash32(unsigned long x);
+unsigned long input_fingerprint(double** points, int n, int d, unsigned long seed);
+double uniform_draw(unsigned long seed, unsigned long index);
+double** init_H(double** W, int n, int k, unsigned long seed);
+double** init_H_from_mean(double mean, int n, int k, unsigned long seed);
+int write_matrix_header(FILE* fp, int rows, int cols, int panel_rows, double mean, unsigned long fingerprint);
+FILE* open_matrix_file(const char* filename, int* rows, int* cols, int* panel_rows, double* mean, unsigned long* fingerprint);
+int normalized_similarity_to_file(double** datapoints, int n, int d, const char* filename);
+int write_matrix_file(const char* filename, double** M, int rows, int cols);
+double** read_matrix_file(const char* filename, int* rows, int* cols);
+int write_checkpoint(const char* filename, double** H, int n, int k, int iteration, double delta, const char* W_path, unsigned long fingerprint);
+int read_checkpoint(const char* filename, double** H, int n, int k, unsigned long fingerprint, int* iteration, double* delta, char* W_path);
+int temp_file_name(const char* filename, const char* suffix, char* name);
+int out_of_core_w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k);
 void exit_with_error();
 void free_mat_and_exit(double **mat, int n);
 
@@ -56,33 +263,30 @@ void free_mat_and_exit(double **mat, int n) {
 
 /*
 Given an opened file fp, an array big enough to hold every line from fp and the dimensions of the points represented in fp, returns a n*d point matrix of the points in the file.
+If memory allocation error occurs, returns a null pointer.
 */
 double **create_points_matrix(FILE *fp, char line[], int *n, int *d)
 {
     int i, j;
-    char *token;
+    char *token, *rest;
     double **points = (double **)malloc(*n * sizeof(double *)); /* Allocate memory for data points matrix */
     if (points == NULL) {
-        fclose(fp);
-        exit_with_error();
+        return NULL;
     }
     for (i = 0; i < *n; i++) { /* Allocate memory for each row */
         points[i] = (double *)malloc(*d * sizeof(double));
-        if (points[i] == NULL) { /* If theres a problem in allocation, free previously allocated memory and exit */
-            for (j = 0; j < i; j++) 
-                free(points[j]);
-            free(points);
-            fclose(fp);
-            exit_with_error();
+        if (points[i] == NULL) { /* If theres a problem in allocation, free previously allocated memory */
+            free_matrix(points, i);
+            return NULL;
         }
     }
     i = 0;
     while (fgets(line, MAX_LINE_LENGTH, fp) != NULL && i < *n) { /* Read data points from file */
-        token = strtok(line, SEPARATOR); /* Like "split" in Python */
+        token = strtok_r(line, SEPARATOR, &rest); /* Like "split" in Python - strtok_r, so batch jobs can read files concurrently */
         j = 0;
         while (token != NULL && j < *d) {
             points[i][j] = atof(token);
-            token = strtok(NULL, SEPARATOR); /* String to float */
+            token = strtok_r(NULL, SEPARATOR, &rest); /* String to float */
             j++;
         }
         i++;
@@ -90,26 +294,24 @@ double **create_points_matrix(FILE *fp, char line[], int *n, int *d)
     return points;
 }
 
-/* 
-Reads data points from a file.
-Parameters: filename - Path to the input file, n - Pointer in which to store the number of data points, d - Pointer in which to store the dimension of each data point
-Returns: Double pointer to the data points matrix (n x d)
+/*
+Reads data points from a file, like read_data, into line (of MAX_LINE_LENGTH bytes).
+Returns the n*d matrix, or a null pointer if the file can't be opened or memory allocation error occurs.
 */
-double **read_data(const char *filename, int *n, int *d) {
+double **read_points(const char *filename, char line[], int *n, int *d) {
     FILE *fp;
     double **points;
-    char line[MAX_LINE_LENGTH];
-    char *token;
+    char *token, *rest;
     fp = fopen(filename, "r"); /* Open file */
     if (fp == NULL) {
-        exit_with_error();
+        return NULL;
     }
     *n = 0; *d = 0; /* Count num of points and dimensions */
     if (fgets(line, MAX_LINE_LENGTH, fp) != NULL) { /* Read first line to count dimensions (=d) */
-        token = strtok(line, SEPARATOR); /* Like "split" in py */
+        token = strtok_r(line, SEPARATOR, &rest); /* Like "split" in py */
         while (token != NULL) {
             (*d)++;
-            token = strtok(NULL, SEPARATOR);
+            token = strtok_r(NULL, SEPARATOR, &rest);
         }
         (*n)++;
     }
@@ -121,6 +323,21 @@ double **read_data(const char *filename, int *n, int *d) {
     return points;
 }
 
+/* 
+Reads data points from a file.
+Parameters: filename - Path to the input file, n - Pointer in which to store the number of data points, d - Pointer in which to store the dimension of each data point
+Returns: Double pointer to the data points matrix (n x d)
+*/
+double **read_data(const char *filename, int *n, int *d) {
+    double **points;
+    char line[MAX_LINE_LENGTH];
+    points = read_points(filename, line, n, d);
+    if (points == NULL) {
+        exit_with_error();
+    }
+    return points;
+}
+
 /*
 * free_matrix - Frees memory allocated for a matrix
 * n - Number of rows
@@ -141,11 +358,18 @@ void free_matrix(double **data, int n) {
 
 /*
 Receives a matrix alongside its dimensions, and prints it out row by row.
+The rows are formatted with format_fixed4 into one buffer that is written out as it fills, instead of a printf per cell.
 */
 void print_matrix(double **matrix, int rows, int cols) {
     int i, j;
-    
-    for (i = 0; i < rows; i++) {
+    char* text = (char*)malloc(WRITE_BUFFER);
+    if (text != NULL) {
+        for (i = 0; i < rows; i++)
+            write_row(stdout, matrix[i], cols, text, WRITE_BUFFER);
+        free(text);
+        return;
+    }
+    for (i = 0; i < rows; i++) { /* No buffer - cell by cell */
         for (j = 0; j < cols; j++) {
             printf("%.4f", matrix[i][j]);
             if (j < cols - 1) {
@@ -156,33 +380,134 @@ void print_matrix(double **matrix, int rows, int cols) {
     }
 }
 
+/*
+Writes x into text exactly as sprintf(text, "%.4f", x) would, and returns the number of characters written (not counting the terminating null).
+x*10^4 is rounded from the 53-bit mantissa of x in integer arithmetic, to the nearest integer with ties to even like printf,
+so no digit ever differs. Values of magnitude FAST_FORMAT_LIMIT and above, infinities and NaN are left to sprintf.
+text needs room for MAX_CELL_TEXT characters.
+*/
+int format_fixed4(double x, char* text)
+{
+    char digits[24];
+    int exponent, shift, count = 0, len = 0;
+    unsigned long scaled, rest, half, rounded;
+    double magnitude = (x < 0) ? -x : x;
+    if (!(magnitude < FAST_FORMAT_LIMIT)) /* Also catches NaN */
+        return sprintf(text, "%.4f", x);
+    scaled = (unsigned long)ldexp(frexp(magnitude, &exponent), 53) * 625; /* magnitude*10^4 = scaled * 2^(exponent-49) */
+    shift = 49 - exponent;
+    if (shift <= 0)
+        rounded = scaled << -shift;
+    else if (shift >= 64) /* scaled < 2^63, so magnitude*10^4 < 1/2 */
+        rounded = 0;
+    else
+    {
+        rounded = scaled >> shift;
+        rest = scaled & ((1UL << shift) - 1);
+        half = 1UL << (shift - 1);
+        if (rest > half || (rest == half && (rounded & 1)))
+            rounded++;
+    }
+    if (x < 0 || (x == 0 && 1 / x < 0)) /* printf keeps the sign of negative values that round to 0, and of -0 */
+        text[len++] = '-';
+    for (; count < 5 || rounded > 0; rounded /= 10) /* At least one digit before the point */
+        digits[count++] = (char)('0' + rounded % 10);
+    while (count > 4)
+        text[len++] = digits[--count];
+    text[len++] = '.';
+    while (count > 0)
+        text[len++] = digits[--count];
+    text[len] = '\0';
+    return len;
+}
 
 /*
-Calculate the Diagonal Degree Matrix D for a given similarity matrix A.
-Uses a 2D array representation (array of arrays).
+Formats a row of cols cells the way print_matrix prints it (separators and the newline included) into text, which can hold capacity characters.
+Returns the length of the text, or -1 if it doesn't fit.
 */
-double** diagonal_degree_matrix(double** A, int n) {
-    double** D = (double**)malloc(n * sizeof(double*));
-    int i, j; double sum;
-    if (D == NULL) {
-        exit_with_error();
+int format_row(double* row, int cols, char* text, size_t capacity)
+{
+    char cell[MAX_CELL_TEXT + 1];
+    size_t used = 0, len;
+    int j;
+    for (j = 0; j < cols; j++)
+    {
+        if (capacity - used >= MAX_CELL_TEXT + 2)
+            used += format_fixed4(row[j], text + used);
+        else
+        {
+            len = format_fixed4(row[j], cell);
+            if (capacity - used < len + 2)
+                return -1;
+            memcpy(text + used, cell, len);
+            used += len;
+        }
+        text[used++] = (j < cols - 1) ? SEPARATOR[0] : '\n';
     }
-    /* Allocate memory for each row and init to 0 */
-    for (i = 0; i < n; i++) {
-        D[i] = (double*)calloc(n, sizeof(double));
-        if (D[i] == NULL) {
-            free_mat_and_exit(D, i);
+    return (int)used;
+}
+
+/*
+Writes a row of cols cells to out the way print_matrix prints it, formatting it into text (of capacity characters, at least MAX_CELL_TEXT + 2)
+and writing the text out whenever it fills up.
+*/
+void write_row(FILE* out, double* row, int cols, char* text, size_t capacity)
+{
+    size_t used = 0;
+    int j;
+    for (j = 0; j < cols; j++)
+    {
+        if (capacity - used < MAX_CELL_TEXT + 2)
+        {
+            fwrite(text, 1, used, out);
+            used = 0;
         }
+        used += format_fixed4(row[j], text + used);
+        text[used++] = (j < cols - 1) ? SEPARATOR[0] : '\n';
     }
-    /* Calc degrees */
-    for (i = 0; i < n; i++) {
+    fwrite(text, 1, used, out);
+}
+
+
+/*
+Given an n*n similarity matrix A, returns a NEW array of length n holding the degree of every vertex (the sum of its row in A).
+If memory allocation error occurs, returns a null pointer.
+*/
+double* degree_vector(double** A, int n) {
+    int i, j; double sum;
+    double* degrees = (double*)malloc(n * sizeof(double));
+    if (degrees == NULL)
+        return NULL;
+    #pragma omp parallel for private(j, sum) schedule(static)
+    for (i = 0; i < n; i++) { /* Every row is summed by one thread, in order - the same for any amount of threads */
         sum = 0.0;
-        /* Sum the i-th row of A to get the degree */
-        for (j = 0; j < n; j++) {
+        for (j = 0; j < n; j++) /* Sum the i-th row of A to get the degree */
             sum += A[i][j];
-        }
-        D[i][i] = sum; /* All other elements remain zero (from calloc) */
+        degrees[i] = sum;
+    }
+    return degrees;
+}
+
+/*
+Calculate the Diagonal Degree Matrix D for a given similarity matrix A.
+Uses a 2D array representation (array of arrays).
+If memory allocation error occurs, frees what it allocated and returns a null pointer - the caller decides whether that ends the process.
+*/
+double** diagonal_degree_matrix(double** A, int n) {
+    double** D;
+    double* degrees = degree_vector(A, n);
+    int i;
+    if (degrees == NULL) {
+        return NULL;
+    }
+    D = alloc_matrix(n, n);
+    if (D == NULL) {
+        free(degrees);
+        return NULL;
     }
+    for (i = 0; i < n; i++)
+        D[i][i] = degrees[i]; /* All other elements remain zero (from alloc_matrix) */
+    free(degrees);
     return D;
 }
 
@@ -216,235 +541,2035 @@ double squared_euclidean_dist(double* point1, double* point2, int dimension)
 }
 
 /*
-Given two NON-EMPTY matrices A,B and A's dimensions, calculates the squared Frobenius norm of A-B.
-Assumes both matrices have the same dimensions.
+The cell of A of two points at squared distance sq_dist, whose kernel widths are scale_i and scale_j (See kernel_sigma and local_scaling_neighbor).
+The widths are multiplied first, so the cell doesn't depend on the order of the points.
 */
-double sq_frobenius_norm(double** A, int rows_num, int cols_num, double** B)
-{ 
-    int i,j;
-    double sum = 0;
-    for(i=0; i < rows_num; i++)
-        for(j=0; j < cols_num; j++)
-            sum += pow(A[i][j] - B[i][j], 2);
-    return sum;
+double similarity(double sq_dist, double scale_i, double scale_j)
+{
+    return exp(-sq_dist / (2 * (scale_i * scale_j)));
 }
 
 /*
-Given a n*m matrix M, its amount of rows and an int 0<=j<m, returns a 1*n matrix consisting only of M's j-th column, transposed.
-If memory allocation error occurs, returns a null pointer.
+Keeps the m smallest squared distances seen so far, in increasing order, in nearest (of length m, count of them filled so far).
 */
-double** get_column(double** M, int rows_num, int j)
-{   
+void keep_nearest(double* nearest, int* count, int m, double sq_dist)
+{
     int i;
-    double** ret = (double**)malloc(1 * sizeof(double*));
-    if (ret == NULL)
+    if (*count == m && sq_dist >= nearest[m - 1])
+        return;
+    i = (*count < m) ? (*count)++ : m - 1;
+    for (; i > 0 && nearest[i - 1] > sq_dist; i--)
+        nearest[i] = nearest[i - 1];
+    nearest[i] = sq_dist;
+}
+
+/*
+The local scale of a point from the squared distances keep_nearest kept for it: the distance to the farthest of them (the m-th nearest neighbour).
+A point with at least m duplicates would get 0, so it gets kernel_sigma instead.
+*/
+double local_scale(double* nearest, int count)
+{
+    if (count == 0 || nearest[count - 1] <= 0.0)
+        return kernel_sigma;
+    return sqrt(nearest[count - 1]);
+}
+
+/*
+Given the points and their dimensions, returns a NEW array of length n holding the kernel width of every point:
+kernel_sigma for all of them, or their local scales if local_scaling_neighbor is set.
+For the modes that never store A, where the local scales cost one pass over all pairs of points (similarity_matrix finds them in the pass that builds A).
+If memory allocation error occurs, returns a null pointer.
+*/
+double* point_scales(double** datapoints, int n, int d)
+{
+    int i, j, count, m = (local_scaling_neighbor < n - 1) ? local_scaling_neighbor : n - 1;
+    double nearest[MAX_LOCAL_SCALING_NEIGHBOR];
+    double* scales = (double*)malloc(n * sizeof(double));
+    if (scales == NULL)
         return NULL;
-    ret[0] = (double*)malloc(rows_num * sizeof(double));
-    if (ret[0] == NULL)
+    #pragma omp parallel for private(j, count, nearest) schedule(static)
+    for (i = 0; i < n; i++) {
+        count = 0;
+        for (j = 0; j < n && m > 0; j++)
+            if (j != i)
+                keep_nearest(nearest, &count, m, squared_euclidean_dist(datapoints[i], datapoints[j], d));
+        scales[i] = (m > 0) ? local_scale(nearest, count) : kernel_sigma;
+    }
+    return scales;
+}
+
+/*
+Given two NON-EMPTY matrices A,B and A's dimensions, calculates the squared Frobenius norm of A-B.
+Assumes both matrices have the same dimensions.
+*/
+double sq_frobenius_norm(double** A, int rows_num, int cols_num, double** B)
+{ 
+    int i,j;
+    double row_sum, sum;
+    double* row_sums = (double*)malloc(rows_num * sizeof(double));
+    if (row_sums == NULL) /* Still deterministic, just not parallel */
     {
-        free_matrix(ret, 0);
-        return NULL;
+        sum = 0;
+        for(i=0; i < rows_num; i++)
+            for(j=0; j < cols_num; j++)
+                sum += pow(A[i][j] - B[i][j], 2);
+        return sum;
     }
+    #pragma omp parallel for private(j, row_sum) schedule(static)
     for(i=0; i < rows_num; i++)
-        ret[0][i] = M[i][j];
-    return ret;
-
+    {
+        row_sum = 0;
+        for(j=0; j < cols_num; j++)
+            row_sum += pow(A[i][j] - B[i][j], 2);
+        row_sums[i] = row_sum;
+    }
+    sum = ordered_sum(row_sums, rows_num);
+    free(row_sums);
+    return sum;
 }
 
 /*
-Given the current iteration's H matrix, a pointer to the new H matrix and all needed values (including a cell coordinate (i,j) in H), updates the new H's cell in place (i,j).
+Returns the squared Frobenius norm of a (small) rows*cols matrix, summed sequentially.
 */
-void update_H_cell(double **W, double **H, double **new_H, double **HtH_col, int n, int k, int i, int j)
+double sq_norm(double** A, int rows, int cols)
 {
-    double numerator, denominator, cell_multiplier;
-    numerator = matrix_mult_cell(W, n, H, i, j);
-    denominator = matrix_mult_cell(H, k, HtH_col, i, 0) + denominator_eps; /* This epsilon is added to avoid division by zero. */
-    cell_multiplier = numerator / denominator;
-    cell_multiplier *= beta;
-    cell_multiplier += (1 - beta);
-    new_H[i][j] = H[i][j]*cell_multiplier;
+    int i, j;
+    double sum = 0.0;
+    for (i = 0; i < rows; i++)
+        for (j = 0; j < cols; j++)
+            sum += A[i][j] * A[i][j];
+    return sum;
 }
 
-
 /*
-Given a n*n graph laplacian W, a current n*k iteration matrix H and a pointer to an ALREADY EXISTING n*k matrix new_H,
-changes the values in the new_H matrix IN PLACE to be the new values, as per the instructions (See 1.4.2).
-If memory allocation error occurs, returns 1. if finished successfully, returns 0.
+Returns the squared Frobenius norm of W, taking W from wherever src says it lives, TILE_SIZE rows at a time.
+The row sums are added with ordered_sum. The norm is never negative, so if memory allocation (or reading W) fails, returns -1.
 */
-int update_H(double** W, double** H, double** new_H, int n, int k){
-    double** Ht_row; /* The needed row in H^T to calculate the matrix product (H^T)H. Will be a 1*n matrix.*/
-    int i,j,s;
-    double** HtH_col = (double**)malloc(k * sizeof(double*)); /* The needed column in (H^T)H to calculate the denominator. Is a k*1 matrix. */
-    if(HtH_col == NULL)
-        return 1;
-    for(j=0; j<k; j++){
-        HtH_col[j] = (double*)calloc(1, sizeof(double));
-        if(HtH_col[j] == NULL)
+double source_sq_norm(w_source* src, int n)
+{
+    int first, last, i, j, failed = 0;
+    double sum, **rows = (double**)malloc(TILE_SIZE * sizeof(double*));
+    double **buffer = (src->W == NULL) ? alloc_matrix(TILE_SIZE, n) : NULL, *row_sums = (double*)malloc(n * sizeof(double));
+    if (rows == NULL || row_sums == NULL || (src->W == NULL && buffer == NULL))
+        failed = 1;
+    for (first = 0; !failed && first < n; first += TILE_SIZE)
+    {
+        last = (first + TILE_SIZE < n) ? first + TILE_SIZE : n;
+        failed = w_source_rows(src, first, last, n, buffer, rows);
+        if (failed)
+            continue;
+        #pragma omp parallel for private(j) schedule(static)
+        for (i = first; i < last; i++)
         {
-            free_matrix(HtH_col, j);
-            return 1;
-        }
-    }
-    for(j=0; j<k; j++){
-        for(s=0; s<k; s++){ /* Calculates the necessary column of (H^T)H for the denominator. */
-            Ht_row = get_column(H, n, s);
-            if(Ht_row == NULL){
-                free_matrix(HtH_col, k);
-                return 1;
-            }
-            HtH_col[s][0] = matrix_mult_cell(Ht_row, n, H, 0, j);
-            free_matrix(Ht_row, 1);
+            row_sums[i] = 0.0;
+            for (j = 0; j < n; j++)
+                row_sums[i] += rows[i - first][j] * rows[i - first][j];
         }
-        for(i=0; i<n; i++)
-            update_H_cell(W, H, new_H, HtH_col, n, k, i, j);
     }
-    return 0;
+    sum = failed ? -1 : ordered_sum(row_sums, n);
+    free(rows);
+    free(row_sums);
+    free_matrix(buffer, TILE_SIZE);
+    return sum;
 }
 
-
 /*
-Given a starting matrix H, its dimensions and a graph laplacian W, perform the optimization algorithm INPLACE in the instructions.
-Returns an optimized H (Will use the same pointer that H was given through).
+Returns the sum of count values. In reproducible mode (see reproducible_reductions) the values are summed in fixed blocks of
+REDUCTION_BLOCK in parallel, and the block sums are added in order, so the result is the same for every amount of threads.
 */
-double** optimizing_H(double** H, int rows_num, int cols_num, double** W)
+double ordered_sum(double* values, int count)
 {
-    int i, j;
-    double **tmp, **new_H = (double**)malloc(rows_num * sizeof(double*));
-    if (new_H == NULL)
+    int b, i, blocks = (count + REDUCTION_BLOCK - 1) / REDUCTION_BLOCK, end;
+    double block_sum, sum = 0.0;
+    double* partials = NULL;
+    if (!reproducible_reductions)
     {
-        free_mat_and_exit(H, rows_num);
+        #pragma omp parallel for reduction(+:sum) schedule(static)
+        for (i = 0; i < count; i++)
+            sum += values[i];
+        return sum;
     }
-    for (j=0; j < rows_num; j++)
+    if (blocks > 1)
+        partials = (double*)malloc(blocks * sizeof(double));
+    if (partials == NULL) /* A single block (or no memory for the partial sums) - just sum in order */
     {
-        new_H[j] = (double*)calloc(cols_num, sizeof(double));
-        if(new_H[j] == NULL)
-        {
-            free_matrix(H, rows_num);
-            free_matrix(new_H, j);
-            exit_with_error();
-        }
+        for (i = 0; i < count; i++)
+            sum += values[i];
+        return sum;
     }
-    for (i=1; i<=max_iter; i++) /* Does the actual work */
+    #pragma omp parallel for private(i, end, block_sum) schedule(static)
+    for (b = 0; b < blocks; b++)
     {
-        if(update_H(W, H, new_H, rows_num, cols_num) == 1) /* Updates H and puts the updated version into new_H. 1 will be returned iff an error occurs during the update. */
-        {
-            free_matrix(H, rows_num);
-            free_matrix(new_H, rows_num);
-            exit_with_error();
-        }
-        if(sq_frobenius_norm(new_H, rows_num, cols_num , H) < eps) /* We have reached convergence - end the loop. */
-            i = max_iter + 1;
-        tmp = H; /* Always makes the new matrix be in pointer H for code consistency. */
-        H = new_H;
-        new_H = tmp;
+        end = (b + 1) * REDUCTION_BLOCK < count ? (b + 1) * REDUCTION_BLOCK : count;
+        block_sum = 0.0;
+        for (i = b * REDUCTION_BLOCK; i < end; i++)
+            block_sum += values[i];
+        partials[b] = block_sum;
     }
-    free_matrix(new_H, rows_num);
-    return H;
+    for (b = 0; b < blocks; b++)
+        sum += partials[b];
+    free(partials);
+    return sum;
 }
 
 /*
-Receives a m*n matrix A and a n*k matrix B alongside their dimensions, and returns the product matrix AB.
+Reads the modes set through the environment: REDUCTIONS_ENV=fast turns reproducible_reductions off,
+UPDATE_ENV=in-place turns in_place_updates on,
+KERNELS_ENV=generic turns fixed_k_kernels off, SOLVER_ENV=multilevel turns multilevel_solver on,
+WORKERS_ENV sets distributed_workers, SIGMA_ENV sets kernel_sigma, LOCAL_SCALING_ENV sets local_scaling_neighbor,
+CHECKPOINT_ENV sets checkpoint_path, CHECKPOINT_EVERY_ENV sets checkpoint_interval,
+LABEL_STOP_ENV sets label_stop_window, LABEL_TOLERANCE_ENV sets label_stop_tolerance, FIRST_TOUCH_ENV=serial turns parallel_first_touch off,
+MEMORY_BUDGET_ENV sets memory_budget and SPARSE_TILES_ENV sets sparse_tile_threshold.
+Values that are out of range are ignored.
 */
-double** multiply_matrix(double** matrixA, double** matrixB, int m, int n, int k) {
-    int i, j, l, p;
-    double** product = malloc(m * sizeof(double*));
-    if (product == NULL) return NULL;
-    for (i = 0; i < m; i++) {
-        product[i] = malloc(k * sizeof(double));
-        if (product[i] == NULL) {
-            /* Clean up previously allocated memory */
-            for (p = 0; p < i; p++) {
-                free(product[p]);
-            }
-            free(product);
-            return NULL;
-        }
-        /* Initialize to zero (still more efficient than calloc) */
-        for (j = 0; j < k; j++) {
-            product[i][j] = 0.0;
-        }
-    }
-    /* Optimized loop order for better cache locality */
-    for (i = 0; i < m; i++) {
-        for (l = 0; l < n; l++) {
-            const double a_il = matrixA[i][l]; /* Hear me out: Cache this value */
-            for (j = 0; j < k; j++) {
-                product[i][j] += a_il * matrixB[l][j];
-            }
-        }
-    }
-    return product;
+void read_env_modes(void)
+{
+    char* end;
+    const char* mode = getenv(REDUCTIONS_ENV);
+    reproducible_reductions = !(mode != NULL && strcmp(mode, "fast") == 0);
+    mode = getenv(UPDATE_ENV);
+    in_place_updates = (mode != NULL && strcmp(mode, "in-place") == 0);
+    mode = getenv(KERNELS_ENV);
+    fixed_k_kernels = !(mode != NULL && strcmp(mode, "generic") == 0);
+    mode = getenv(SOLVER_ENV);
+    multilevel_solver = (mode != NULL && strcmp(mode, "multilevel") == 0);
+    mode = getenv(WORKERS_ENV);
+    distributed_workers = (mode != NULL) ? atoi(mode) : 1;
+    mode = getenv(SIGMA_ENV);
+    kernel_sigma = (mode != NULL && atof(mode) > 0) ? atof(mode) : 1.0;
+    mode = getenv(LOCAL_SCALING_ENV);
+    local_scaling_neighbor = (mode != NULL && atoi(mode) > 0) ? atoi(mode) : 0;
+    if (local_scaling_neighbor > MAX_LOCAL_SCALING_NEIGHBOR)
+        local_scaling_neighbor = MAX_LOCAL_SCALING_NEIGHBOR;
+    checkpoint_path = getenv(CHECKPOINT_ENV);
+    if (checkpoint_path != NULL && (checkpoint_path[0] == '\0' || strlen(checkpoint_path) + strlen(CHECKPOINT_W_SUFFIX) >= MAX_PATH_LENGTH))
+        checkpoint_path = NULL;
+    mode = getenv(CHECKPOINT_EVERY_ENV);
+    checkpoint_interval = (mode != NULL && atoi(mode) > 0) ? atoi(mode) : CHECKPOINT_INTERVAL;
+    mode = getenv(LABEL_STOP_ENV);
+    label_stop_window = (mode != NULL && atoi(mode) > 0) ? atoi(mode) : 0;
+    mode = getenv(LABEL_TOLERANCE_ENV);
+    label_stop_tolerance = (mode != NULL && atof(mode) > 0 && atof(mode) < 1) ? atof(mode) : 0.0;
+    mode = getenv(FIRST_TOUCH_ENV);
+    parallel_first_touch = !(mode != NULL && strcmp(mode, "serial") == 0);
+    mode = getenv(MEMORY_BUDGET_ENV);
+    memory_budget = (mode != NULL && parse_memory_size(mode) > 0) ? parse_memory_size(mode) : 0.0;
+    mode = getenv(SPARSE_TILES_ENV);
+    sparse_tile_threshold = (mode != NULL && mode[0] != '\0' && strtod(mode, &end) >= 0 && *end == '\0') ? strtod(mode, NULL) : -1.0;
 }
 
 /*
-Given an array of arrays representing points, the amount of points (n) and the dimension of every point (d),
-returns the n*n similarity matrix of the points. Assumes all points are of dimension d.
+Allocates a rows*cols matrix (array of arrays) with all cells set to 0.
+If memory allocation error occurs, returns a null pointer.
 */
-double** similarity_matrix(double** datapoints, int n, int d){
-    double** A = malloc(n * sizeof(double*));
-    int i, j;
-    if(A == NULL)
+double** alloc_matrix(int rows, int cols)
+{
+    int i;
+    double** M = (double**)malloc(rows * sizeof(double*));
+    if (M == NULL)
         return NULL;
-    for (i = 0; i < n; i++){
-        A[i] = malloc(n * sizeof(double));
-        if(A[i] == NULL)
+    for (i = 0; i < rows; i++)
+    {
+        M[i] = (double*)calloc(cols, sizeof(double));
+        if (M[i] == NULL)
         {
-            free_matrix(A, i);
+            free_matrix(M, i);
             return NULL;
         }
     }
-    for (i = 0; i < n; i++){
-        for (j = 0; j < n; j++){
-            if (i != j){
-                A[i][j] = exp(-squared_euclidean_dist(*(datapoints + i), *(datapoints + j), d) / 2);
-            } else {
-                A[i][j] = 0;
-            }
-        }
-    }
-    return A;
+    return M;
 }
 
 /*
-Given an n*n similarity matrix and the value of n, returns the normalized similarity matrix.
+Like alloc_matrix, but if parallel_first_touch is set, every row is allocated and zeroed by the thread that gets it in a static split of the rows,
+which is the split of the row-parallel loops of the updates (dense_w_times_H and apply_update over all rows) - so the pages of a row are first
+touched, and placed, on the NUMA node of the thread that will read it on every iteration. The in-place updates split every block of rows instead.
+If memory allocation error occurs, returns a null pointer.
 */
-double** normalized_similarity_matrix(double** sim_matrix, int n){
-    int i;
-    double** temp, **normalized;
-    double** D = diagonal_degree_matrix(sim_matrix, n);
-    double** D_neg_half = calloc(n, sizeof(double*));
-    if(D_neg_half == NULL)
+double** alloc_matrix_first_touch(int rows, int cols)
+{
+    int i, failed = 0;
+    double** M = (double**)malloc(rows * sizeof(double*));
+    if (M == NULL)
+        return NULL;
+    #pragma omp parallel for reduction(|:failed) schedule(static) if(parallel_first_touch)
+    for (i = 0; i < rows; i++)
     {
-        free_mat_and_exit(D, n);
-    }
-    for (i = 0; i < n; i++){
-        D_neg_half[i] = calloc(n, sizeof(double));
-        if(D_neg_half[i] == NULL)
-        {
-            free_matrix(D, n);
-            free_matrix(D_neg_half, i);
-            exit_with_error();
-        }
+        M[i] = (double*)malloc(cols * sizeof(double)); /* Not calloc - fresh pages it maps are only touched by the memset */
+        if (M[i] == NULL)
+            failed = 1;
+        else
+            memset(M[i], 0, cols * sizeof(double));
     }
-    for (i = 0; i < n; i++){
-        D_neg_half[i][i] = 1 / sqrt(D[i][i] + denominator_eps);
+    if (failed)
+    {
+        free_matrix(M, rows); /* Skips the rows that are null pointers */
+        return NULL;
     }
-    temp = multiply_matrix(D_neg_half, sim_matrix, n, n, n);
-    normalized = multiply_matrix(temp, D_neg_half, n, n, n);
-    free_matrix(D, n);
-    free_matrix(D_neg_half, n);
-    free_matrix(temp, n);
-    return normalized;
+    return M;
 }
 
-
 /*
-Receives a String for which algorithm to run, a temporary matrix pointer A, a n*d matrix representing points and its dimensions, and returns the algorithm's result matrix.
+Adds (H^T)H of rows first..last-1 of H into the k*k matrix HtH.
 */
-double** run_selected_algorithm(const char* goal, double** A, double** points, int n, int d) {
-    double** result = NULL;
+void add_gram_rows(double** H, int first, int last, int k, double** HtH)
+{
+    int i, s, j;
+    for (s = 0; s < k; s++)
+        for (j = 0; j < k; j++)
+            for (i = first; i < last; i++)
+                HtH[s][j] += H[i][s] * H[i][j];
+}
 
-    if (strcmp(goal, "sym") == 0) { /* Goal: calculate similarity matrix */
+/*
+Given a n*k matrix H, returns the k*k matrix (H^T)H.
+The rows are split into blocks of REDUCTION_BLOCK, each block's k*k partial product is computed by one thread,
+and in reproducible mode the partial products are added in block order (see reproducible_reductions).
+If memory allocation error occurs, returns a null pointer.
+*/
+double** gram_matrix(double** H, int n, int k)
+{
+    int b, s, j, blocks = (n + REDUCTION_BLOCK - 1) / REDUCTION_BLOCK, end, failed = 0;
+    double** partial;
+    double*** partials;
+    double** HtH = alloc_matrix(k, k);
+    if (HtH == NULL)
+        return NULL;
+    if (blocks <= 1 || (partials = (double***)calloc(blocks, sizeof(double**))) == NULL)
+    {
+        add_gram_rows(H, 0, n, k, HtH);
+        return HtH;
+    }
+    #pragma omp parallel for private(end, partial, s, j) reduction(|:failed) schedule(static)
+    for (b = 0; b < blocks; b++)
+    {
+        end = (b + 1) * REDUCTION_BLOCK < n ? (b + 1) * REDUCTION_BLOCK : n;
+        partial = alloc_matrix(k, k);
+        if (partial == NULL)
+        {
+            failed = 1;
+            continue;
+        }
+        add_gram_rows(H, b * REDUCTION_BLOCK, end, k, partial);
+        if (reproducible_reductions)
+        {
+            partials[b] = partial; /* Added below, in block order */
+            continue;
+        }
+        #pragma omp critical
+        {
+            for (s = 0; s < k; s++)
+                for (j = 0; j < k; j++)
+                    HtH[s][j] += partial[s][j];
+        }
+        free_matrix(partial, k);
+    }
+    for (b = 0; b < blocks; b++)
+    {
+        if (partials[b] == NULL)
+            continue;
+        for (s = 0; s < k; s++)
+            for (j = 0; j < k; j++)
+                HtH[s][j] += partials[b][s][j];
+        free_matrix(partials[b], k);
+    }
+    free(partials);
+    if (failed)
+    {
+        free_matrix(HtH, k);
+        return NULL;
+    }
+    return HtH;
+}
+
+/*
+The generic row kernel of WH: writes the k cells of the row of WH of the given row of W, summing over the n rows of H in order.
+*/
+void w_times_row(double* W_row, double** H, double* WH_row, int n, int k)
+{
+    int l, j;
+    double w_il;
+    for (j = 0; j < k; j++)
+        WH_row[j] = 0.0;
+    for (l = 0; l < n; l++) {
+        w_il = W_row[l];
+        for (j = 0; j < k; j++)
+            WH_row[j] += w_il * H[l][j];
+    }
+}
+
+/*
+Like w_times_row, but only sums over the columns of the count tiles of TILE_SIZE columns listed (in ascending order) in tiles.
+The cells are summed in the same order as w_times_row does, so if all the other cells of W_row are 0, the results are the same.
+*/
+void tiled_w_times_row(double* W_row, double** H, double* WH_row, int n, int k, const int* tiles, int count)
+{
+    int t, l, l_end, j;
+    double w_il;
+    for (j = 0; j < k; j++)
+        WH_row[j] = 0.0;
+    for (t = 0; t < count; t++) {
+        l_end = (tiles[t] + 1) * TILE_SIZE < n ? (tiles[t] + 1) * TILE_SIZE : n;
+        for (l = tiles[t] * TILE_SIZE; l < l_end; l++) {
+            w_il = W_row[l];
+            for (j = 0; j < k; j++)
+                WH_row[j] += w_il * H[l][j];
+        }
+    }
+}
+
+/*
+The generic row kernel of the update (See 1.4.2): given a row of H and the same row of WH, replaces the row of WH IN PLACE
+with the updated row of H and returns sum((new_H_row - H_row)^2).
+*/
+double update_row(double* H_row, double** HtH, double* WH_new_row, int k)
+{
+    int j, p;
+    double denominator, cell_multiplier, new_cell, row_delta = 0.0;
+    for (j = 0; j < k; j++) {
+        denominator = 0.0;
+        for (p = 0; p < k; p++)
+            denominator += H_row[p] * HtH[p][j];
+        denominator += denominator_eps; /* This epsilon is added to avoid division by zero. */
+        cell_multiplier = WH_new_row[j] / denominator;
+        cell_multiplier *= beta;
+        cell_multiplier += (1 - beta);
+        new_cell = H_row[j]*cell_multiplier;
+        row_delta += (new_cell - H_row[j]) * (new_cell - H_row[j]);
+        WH_new_row[j] = new_cell;
+    }
+    return row_delta;
+}
+
+/*
+Defines w_times_row_kK, update_row_kK and tiled_w_times_row_kK, copies of the generic row kernels where k is the constant K.
+With the bounds known, the compiler can unroll the loops over k and keep the row being summed (or updated) in registers
+instead of going back to memory for every cell. The cells are still summed in the same order, so the results are the same.
+*/
+#define DEFINE_FIXED_K_KERNELS(K) \
+void w_times_row_k##K(double* W_row, double** H, double* WH_row, int n, int k) \
+{ \
+    int l, j; \
+    double w_il, *H_row, sums[K]; \
+    (void)k; \
+    for (j = 0; j < K; j++) \
+        sums[j] = 0.0; \
+    for (l = 0; l < n; l++) { \
+        w_il = W_row[l]; \
+        H_row = H[l]; \
+        for (j = 0; j < K; j++) \
+            sums[j] += w_il * H_row[j]; \
+    } \
+    for (j = 0; j < K; j++) \
+        WH_row[j] = sums[j]; \
+} \
+double update_row_k##K(double* H_row, double** HtH, double* WH_new_row, int k) \
+{ \
+    int j, p; \
+    double h[K], denominator, cell_multiplier, new_cell, row_delta = 0.0; \
+    (void)k; \
+    for (j = 0; j < K; j++) \
+        h[j] = H_row[j]; \
+    for (j = 0; j < K; j++) { \
+        denominator = 0.0; \
+        for (p = 0; p < K; p++) \
+            denominator += h[p] * HtH[p][j]; \
+        denominator += denominator_eps; \
+        cell_multiplier = WH_new_row[j] / denominator; \
+        cell_multiplier *= beta; \
+        cell_multiplier += (1 - beta); \
+        new_cell = h[j]*cell_multiplier; \
+        row_delta += (new_cell - h[j]) * (new_cell - h[j]); \
+        WH_new_row[j] = new_cell; \
+    } \
+    return row_delta; \
+} \
+void tiled_w_times_row_k##K(double* W_row, double** H, double* WH_row, int n, int k, const int* tiles, int count) \
+{ \
+    int t, l, l_end, j; \
+    double w_il, *H_row, sums[K]; \
+    (void)k; \
+    for (j = 0; j < K; j++) \
+        sums[j] = 0.0; \
+    for (t = 0; t < count; t++) { \
+        l_end = (tiles[t] + 1) * TILE_SIZE < n ? (tiles[t] + 1) * TILE_SIZE : n; \
+        for (l = tiles[t] * TILE_SIZE; l < l_end; l++) { \
+            w_il = W_row[l]; \
+            H_row = H[l]; \
+            for (j = 0; j < K; j++) \
+                sums[j] += w_il * H_row[j]; \
+        } \
+    } \
+    for (j = 0; j < K; j++) \
+        WH_row[j] = sums[j]; \
+}
+
+DEFINE_FIXED_K_KERNELS(2) DEFINE_FIXED_K_KERNELS(3) DEFINE_FIXED_K_KERNELS(4) DEFINE_FIXED_K_KERNELS(5)
+DEFINE_FIXED_K_KERNELS(6) DEFINE_FIXED_K_KERNELS(7) DEFINE_FIXED_K_KERNELS(8) DEFINE_FIXED_K_KERNELS(9)
+DEFINE_FIXED_K_KERNELS(10) DEFINE_FIXED_K_KERNELS(11) DEFINE_FIXED_K_KERNELS(12) DEFINE_FIXED_K_KERNELS(13)
+DEFINE_FIXED_K_KERNELS(14) DEFINE_FIXED_K_KERNELS(15) DEFINE_FIXED_K_KERNELS(16)
+
+/*
+Returns the row kernels to use for the given k: the ones specialized for it if there are any (and fixed_k_kernels is set), else the generic ones.
+*/
+const row_kernels* select_row_kernels(int k)
+{
+    static const row_kernels generic = {w_times_row, update_row, tiled_w_times_row};
+    static const row_kernels fixed[MAX_FIXED_K - 1] = {
+        {w_times_row_k2, update_row_k2, tiled_w_times_row_k2}, {w_times_row_k3, update_row_k3, tiled_w_times_row_k3},
+        {w_times_row_k4, update_row_k4, tiled_w_times_row_k4}, {w_times_row_k5, update_row_k5, tiled_w_times_row_k5},
+        {w_times_row_k6, update_row_k6, tiled_w_times_row_k6}, {w_times_row_k7, update_row_k7, tiled_w_times_row_k7},
+        {w_times_row_k8, update_row_k8, tiled_w_times_row_k8}, {w_times_row_k9, update_row_k9, tiled_w_times_row_k9},
+        {w_times_row_k10, update_row_k10, tiled_w_times_row_k10}, {w_times_row_k11, update_row_k11, tiled_w_times_row_k11},
+        {w_times_row_k12, update_row_k12, tiled_w_times_row_k12}, {w_times_row_k13, update_row_k13, tiled_w_times_row_k13},
+        {w_times_row_k14, update_row_k14, tiled_w_times_row_k14}, {w_times_row_k15, update_row_k15, tiled_w_times_row_k15},
+        {w_times_row_k16, update_row_k16, tiled_w_times_row_k16}
+    };
+    if (fixed_k_kernels && k >= 2 && k <= MAX_FIXED_K)
+        return &fixed[k - 2];
+    return &generic;
+}
+
+/*
+Given W as a dense n*n matrix and a n*k matrix H, writes rows first..last-1 of the product WH into rows 0..last-first-1 of the ALREADY EXISTING matrix WH.
+Rows of WH are independent, so they are split between the threads.
+*/
+void dense_w_times_H(double** W, double** H, double** WH, int first, int last, int n, int k)
+{
+    int i;
+    const row_kernels* kernels = select_row_kernels(k);
+    #pragma omp parallel for schedule(static)
+    for (i = first; i < last; i++)
+        kernels->w_times_row(W[i], H, WH[i - first], n, k);
+}
+
+/*
+Like dense_w_times_H, but every row only goes over the non-empty tiles of its tile row (See build_tile_index), skipping the others.
+*/
+void tiled_w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k)
+{
+    int i, t;
+    const row_kernels* kernels = select_row_kernels(k);
+    #pragma omp parallel for private(t) schedule(static)
+    for (i = first; i < last; i++)
+    {
+        t = i / TILE_SIZE;
+        kernels->tiled_w_times_row(src->W[i], H, WH[i - first], n, k, src->tile_columns + src->tile_offsets[t], src->tile_offsets[t + 1] - src->tile_offsets[t]);
+    }
+}
+
+/*
+Given the dense n*n W of src, sets to 0 every TILE_SIZE*TILE_SIZE tile of W whose cells are all at most threshold, and indexes the
+remaining tiles into src->tile_offsets and src->tile_columns, so the products WH skip the empty ones (See tiled_w_times_H).
+Every tile is judged by its own cells, so a tile may be kept while its mirror image is dropped, only if they differ around the threshold.
+Reports the tiles and cells of W that are left to stderr.
+Returns 0 on success, and 1 if memory allocation fails - then W is unchanged and src has no index.
+*/
+int build_tile_index(w_source* src, int n, double threshold)
+{
+    int tiles = (n + TILE_SIZE - 1) / TILE_SIZE, a, b, i, j, i_end, j_end, count = 0;
+    double cells = 0.0, **W = src->W;
+    unsigned char* empty = (unsigned char*)malloc((size_t)tiles * tiles);
+    src->tile_offsets = (int*)malloc((tiles + 1) * sizeof(int));
+    if (empty == NULL || src->tile_offsets == NULL)
+    {
+        free(empty);
+        free_tile_index(src);
+        return 1;
+    }
+    #pragma omp parallel for private(b, i, j, i_end, j_end) schedule(dynamic)
+    for (a = 0; a < tiles; a++)
+    {
+        i_end = (a + 1) * TILE_SIZE < n ? (a + 1) * TILE_SIZE : n;
+        for (b = 0; b < tiles; b++)
+        {
+            j_end = (b + 1) * TILE_SIZE < n ? (b + 1) * TILE_SIZE : n;
+            empty[a * tiles + b] = 1;
+            for (i = a * TILE_SIZE; i < i_end && empty[a * tiles + b]; i++)
+                for (j = b * TILE_SIZE; j < j_end; j++)
+                    if (W[i][j] > threshold)
+                    {
+                        empty[a * tiles + b] = 0;
+                        break;
+                    }
+        }
+    }
+    src->tile_offsets[0] = 0;
+    for (a = 0; a < tiles; a++)
+    {
+        for (b = 0; b < tiles; b++)
+            count += !empty[a * tiles + b];
+        src->tile_offsets[a + 1] = count;
+    }
+    src->tile_columns = (int*)malloc((count > 0 ? count : 1) * sizeof(int));
+    if (src->tile_columns == NULL)
+    {
+        free(empty);
+        free_tile_index(src);
+        return 1;
+    }
+    #pragma omp parallel for private(b, i, j, i_end, j_end) schedule(dynamic)
+    for (a = 0; a < tiles; a++)
+    {
+        i_end = (a + 1) * TILE_SIZE < n ? (a + 1) * TILE_SIZE : n;
+        j = src->tile_offsets[a];
+        for (b = 0; b < tiles; b++)
+        {
+            if (!empty[a * tiles + b])
+            {
+                src->tile_columns[j++] = b;
+                continue;
+            }
+            j_end = (b + 1) * TILE_SIZE < n ? (b + 1) * TILE_SIZE : n;
+            for (i = a * TILE_SIZE; i < i_end; i++)
+                memset(W[i] + b * TILE_SIZE, 0, (j_end - b * TILE_SIZE) * sizeof(double));
+        }
+    }
+    for (a = 0; a < tiles; a++)
+        for (b = 0; b < tiles; b++)
+            if (!empty[a * tiles + b])
+                cells += (double)(((a + 1) * TILE_SIZE < n ? TILE_SIZE : n - a * TILE_SIZE)) * ((b + 1) * TILE_SIZE < n ? TILE_SIZE : n - b * TILE_SIZE);
+    fprintf(stderr, "sparse tiles: n=%d, %d of %d tiles of W are non-empty, fill %.1f%%\n", n, count, tiles * tiles, 100.0 * cells / ((double)n * n));
+    free(empty);
+    return 0;
+}
+
+/*
+Frees the tile index of src (See build_tile_index), if it has one.
+*/
+void free_tile_index(w_source* src)
+{
+    free(src->tile_offsets);
+    free(src->tile_columns);
+    src->tile_offsets = NULL;
+    src->tile_columns = NULL;
+}
+
+/*
+Given the points W is built from and the diagonal of D^(-1/2), writes rows first..last-1 of the product WH into rows 0..last-first-1 of the ALREADY EXISTING matrix WH without ever storing W.
+W is recomputed tile by tile (TILE_SIZE*TILE_SIZE cells at a time), so the points and rows of H of a tile stay in cache while they are reused.
+Every row of WH still sums its terms in the same order as dense_w_times_H, so both modes give the same result.
+*/
+void matrix_free_w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k)
+{
+    int ib, pb, i, p, j, i_end, p_end;
+    double w_ip;
+    #pragma omp parallel for private(pb, i, p, j, i_end, p_end, w_ip) schedule(static)
+    for (ib = first; ib < last; ib += TILE_SIZE) {
+        i_end = (ib + TILE_SIZE < last) ? ib + TILE_SIZE : last;
+        for (i = ib; i < i_end; i++)
+            for (j = 0; j < k; j++)
+                WH[i - first][j] = 0.0;
+        for (pb = 0; pb < n; pb += TILE_SIZE) {
+            p_end = (pb + TILE_SIZE < n) ? pb + TILE_SIZE : n;
+            for (i = ib; i < i_end; i++) {
+                for (p = pb; p < p_end; p++) {
+                    if (p == i) /* The diagonal of A (and W) is 0 */
+                        continue;
+                    w_ip = (src->D_neg_half[i] * similarity(squared_euclidean_dist(src->points[i], src->points[p], src->d), src->scales[i], src->scales[p])) * src->D_neg_half[p];
+                    for (j = 0; j < k; j++)
+                        WH[i - first][j] += w_ip * H[p][j];
+                }
+            }
+        }
+    }
+}
+
+/*
+Writes rows first..last-1 of the product WH into rows 0..last-first-1 of the ALREADY EXISTING matrix WH, taking W from wherever src says it lives.
+Returns 0 on success and 1 if W could not be read.
+*/
+int w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k)
+{
+    if (src->W != NULL && src->tile_offsets != NULL)
+        tiled_w_times_H(src, H, WH, first, last, n, k);
+    else if (src->W != NULL)
+        dense_w_times_H(src->W, H, WH, first, last, n, k);
+    else if (src->W_file != NULL)
+        return out_of_core_w_times_H(src, H, WH, first, last, n, k);
+    else
+        matrix_free_w_times_H(src, H, WH, first, last, n, k);
+    return 0;
+}
+
+/*
+Given H, (H^T)H, and the ALREADY EXISTING matrix WH_new holding rows first..last-1 of WH (in its rows 0..last-first-1),
+replaces those rows IN PLACE with the updated rows of H (See 1.4.2), so no separate buffer is needed for WH.
+Also puts the squared norm of every row's change, sum((new_H - H)^2), into row_deltas[first..last-1] - this is the
+convergence test, fused into the update so that every cell is only read and written once per iteration.
+If row_traces is not a null pointer, row_traces[i] also gets the dot product of row i of H and of WH first (the objective needs their sum, See iteration_hook).
+*/
+void apply_update(double** H, double** HtH, double** WH_new, double* row_deltas, double* row_traces, int first, int last, int k)
+{
+    int i, j;
+    const row_kernels* kernels = select_row_kernels(k);
+    #pragma omp parallel for private(j) schedule(static)
+    for (i = first; i < last; i++)
+    {
+        if (row_traces != NULL)
+        {
+            row_traces[i] = 0.0;
+            for (j = 0; j < k; j++)
+                row_traces[i] += H[i][j] * WH_new[i - first][j];
+        }
+        row_deltas[i] = kernels->update_row(H[i], HtH, WH_new[i - first], k);
+    }
+}
+
+/*
+Like update_H, but takes W from src, and puts the squared Frobenius norm of new_H - H into delta.
+row_deltas is scratch space of length n. new_H first receives WH, which is then turned into the new H in place.
+If memory allocation error (or a read error of W) occurs, returns 1. if finished successfully, returns 0.
+*/
+int update_H_from_source(w_source* src, double** H, double** new_H, double* row_deltas, int n, int k, double* delta)
+{
+    double** HtH = gram_matrix(H, n, k);
+    if (HtH == NULL)
+        return 1;
+    if (w_times_H(src, H, new_H, 0, n, n, k) == 1)
+    {
+        free_matrix(HtH, k);
+        return 1;
+    }
+    apply_update(H, HtH, new_H, row_deltas, src->row_traces, 0, n, k);
+    *delta = ordered_sum(row_deltas, n);
+    if (src->row_traces != NULL)
+        src->gram_sq_norm = sq_norm(HtH, k, k);
+    free_matrix(HtH, k);
+    return 0;
+}
+
+/*
+The in-place (block Gauss-Seidel) variant of update_H_from_source, which needs a single n*k matrix H.
+The rows are updated one block (of block_rows rows) at a time, straight into H. The products WH of a block are taken
+from the current H, so they already see the rows of the blocks before it that were updated in this iteration.
+(H^T)H is taken once, at the start of the iteration. block is scratch space of block_rows*k and row_deltas of length n.
+If memory allocation error (or a read error of W) occurs, returns 1. if finished successfully, returns 0.
+*/
+int update_H_in_place(w_source* src, double** H, double** block, int block_rows, double* row_deltas, int n, int k, double* delta)
+{
+    int first, last, i;
+    double** HtH = gram_matrix(H, n, k);
+    if (HtH == NULL)
+        return 1;
+    for (first = 0; first < n; first += block_rows)
+    {
+        last = (first + block_rows < n) ? first + block_rows : n;
+        if (w_times_H(src, H, block, first, last, n, k) == 1)
+        {
+            free_matrix(HtH, k);
+            return 1;
+        }
+        apply_update(H, HtH, block, row_deltas, src->row_traces, first, last, k);
+        for (i = first; i < last; i++)
+            memcpy(H[i], block[i - first], k * sizeof(double));
+    }
+    *delta = ordered_sum(row_deltas, n);
+    if (src->row_traces != NULL)
+        src->gram_sq_norm = sq_norm(HtH, k, k);
+    free_matrix(HtH, k);
+    return 0;
+}
+
+/*
+Given a n*n graph laplacian W, a current n*k iteration matrix H and a pointer to an ALREADY EXISTING n*k matrix new_H,
+changes the values in the new_H matrix IN PLACE to be the new values, as per the instructions (See 1.4.2).
+If memory allocation error occurs, returns 1. if finished successfully, returns 0.
+*/
+int update_H(double** W, double** H, double** new_H, int n, int k){
+    int ret;
+    double delta;
+    w_source src;
+    double* row_deltas = (double*)malloc(n * sizeof(double));
+    if (row_deltas == NULL)
+        return 1;
+    init_w_source(&src);
+    src.W = W;
+    ret = update_H_from_source(&src, H, new_H, row_deltas, n, k, &delta);
+    free(row_deltas);
+    return ret;
+}
+
+/*
+Given a starting matrix H, its dimensions and the place to take W from, perform the optimization algorithm INPLACE in the instructions.
+If multilevel_solver is set, goes through optimizing_H_multilevel instead.
+Returns an optimized H (Will use the same pointer that H was given through), or frees H and returns a null pointer on failure.
+*/
+double** optimizing_H_from_source(double** H, int rows_num, int cols_num, w_source* src)
+{
+    int iteration;
+    double delta;
+    if (multilevel_solver && (checkpoint_path == NULL || read_checkpoint(checkpoint_path, NULL, rows_num, cols_num, checkpoint_fingerprint, &iteration, &delta, NULL) == 1))
+        return optimizing_H_multilevel(H, rows_num, cols_num, src, checkpoint_path); /* A run that resumes is already past the coarse levels */
+    return optimizing_H_single_level(H, rows_num, cols_num, src, checkpoint_path);
+}
+
+/*
+Given a starting matrix H, its dimensions and the place to take W from, runs the iterations of the optimization algorithm on W itself.
+If in_place_updates is set, uses update_H_in_place, so only H itself (and one block of rows) is kept instead of two n*k matrices.
+If checkpoint is not a null pointer, resumes from the checkpoint in that file (if it has one of this H's dimensions and checkpoint_fingerprint),
+and writes a checkpoint every checkpoint_interval iterations and at the end. A dense W without a file is persisted next to the checkpoint first.
+If src has an iteration hook, calls it after every iteration, and stops early if it asks to.
+If label_stop_window is set, also stops early once the hard labels are stable (See label_stop_window).
+If sparse_tile_threshold is set and W is dense, the empty tiles of W are dropped first (See build_tile_index) - W is changed IN PLACE.
+Returns an optimized H (Will use the same pointer that H was given through). If memory allocation (or reading W) fails, frees H and returns
+a null pointer instead of exiting, so the caller decides what a failure means - the Python module runs this on its own pool threads.
+*/
+double** optimizing_H_single_level(double** H, int rows_num, int cols_num, w_source* src, const char* checkpoint)
+{
+    int i, iteration = 0, done, failed, stop = 0, stable_since, indexed = 0, *labels = NULL, *reference = NULL, block_rows = TILE_SIZE; /* The same blocks in every mode, so all modes still give the same H */
+    char W_path[MAX_PATH_LENGTH];
+    double delta = eps, W_sq_norm = 0.0, objective = 0.0, last_objective = sqrt(-1.0) /* NaN */, **tmp, **new_H, *row_deltas = (double*)malloc(rows_num * sizeof(double));
+    if (block_rows > rows_num)
+        block_rows = rows_num;
+    new_H = in_place_updates ? alloc_matrix(block_rows, cols_num) : alloc_matrix(rows_num, cols_num); /* In place, new_H is just the block */
+    if (new_H == NULL || row_deltas == NULL)
+    {
+        free_matrix(H, rows_num);
+        free_matrix(new_H, in_place_updates ? block_rows : rows_num);
+        free(row_deltas);
+        return NULL;
+    }
+    if (checkpoint != NULL && read_checkpoint(checkpoint, H, rows_num, cols_num, checkpoint_fingerprint, &iteration, &delta, NULL) == 0 && delta < eps)
+        iteration = max_iter; /* The checkpointed run had already converged */
+    if (checkpoint != NULL && src->W_path == NULL && src->W != NULL) /* Persist W, so a resumed run can skip building it */
+    {
+        strcpy(W_path, checkpoint);
+        strcat(W_path, CHECKPOINT_W_SUFFIX);
+        if (write_matrix_file(W_path, src->W, rows_num, rows_num) == 0)
+            src->W_path = W_path;
+    }
+    if (src->W != NULL && src->tile_offsets == NULL && sparse_tile_threshold >= 0) /* Without memory for the index, every tile is multiplied */
+        indexed = (build_tile_index(src, rows_num, sparse_tile_threshold) == 0);
+    if (src->on_iteration != NULL || label_stop_window > 0) /* Without the traces or ||W||^2, the hook still runs and gets NaN for the objective */
+    {
+        src->row_traces = (double*)malloc(rows_num * sizeof(double));
+        W_sq_norm = (src->row_traces == NULL) ? -1 : source_sq_norm(src, rows_num);
+    }
+    if (label_stop_window > 0 && (labels = (int*)malloc(2 * rows_num * sizeof(int))) != NULL) /* Without memory for the labels, only delta stops the run */
+    {
+        reference = labels + rows_num; /* The labels the current window started with */
+        labels_changed(H, rows_num, cols_num, reference, reference);
+    }
+    stable_since = iteration;
+    for (i=iteration+1; i<=max_iter; i++) /* Does the actual work */
+    {
+        if (in_place_updates)
+            failed = update_H_in_place(src, H, new_H, block_rows, row_deltas, rows_num, cols_num, &delta);
+        else
+            failed = update_H_from_source(src, H, new_H, row_deltas, rows_num, cols_num, &delta); /* Updates H and puts the updated version into new_H */
+        if(failed == 1) /* 1 will be returned iff an error occurs during the update. */
+        {
+            free_matrix(H, rows_num);
+            H = NULL;
+            break;
+        }
+        if (!in_place_updates)
+        {
+            tmp = H; /* Always makes the new matrix be in pointer H for code consistency. */
+            H = new_H;
+            new_H = tmp;
+        }
+        if (src->on_iteration != NULL || labels != NULL)
+            objective = (src->row_traces == NULL || W_sq_norm < 0) ? sqrt(-1.0) /* NaN */ : W_sq_norm - 2 * ordered_sum(src->row_traces, rows_num) + src->gram_sq_norm;
+        if (src->on_iteration != NULL)
+            stop = (src->on_iteration(src->hook_context, i, delta, objective) != 0);
+        if (labels != NULL && i % LABEL_CHECK_INTERVAL == 0) /* A NaN objective never passes the guard, so it never stops the run */
+        {
+            if (labels_changed(H, rows_num, cols_num, labels, reference) > label_stop_tolerance * rows_num)
+            {
+                memcpy(reference, labels, rows_num * sizeof(int));
+                stable_since = i;
+            }
+            if (i - stable_since >= label_stop_window && fabs(objective - last_objective) <= LABEL_OBJECTIVE_GUARD * fabs(objective))
+                stop = 1;
+            last_objective = objective;
+        }
+        done = (delta < eps || i == max_iter || stop);
+        if (checkpoint != NULL && (done || i % checkpoint_interval == 0)) /* If the write fails, the previous checkpoint is still whole */
+            write_checkpoint(checkpoint, H, rows_num, cols_num, i, delta, src->W_path, checkpoint_fingerprint);
+        if(delta < eps || stop) /* We have reached convergence (or were asked to stop) - end the loop. */
+            i = max_iter + 1;
+    }
+    if (src->W_path == W_path)
+        src->W_path = NULL; /* It was only lent for the run */
+    free(src->row_traces);
+    src->row_traces = NULL;
+    if (indexed)
+        free_tile_index(src);
+    free(labels);
+    free_matrix(new_H, in_place_updates ? block_rows : rows_num);
+    free(row_deltas);
+    return H;
+}
+
+/*
+Given H, its dimensions and earlier labels of its rows (reference), sets every labels[i] to the hard label of row i of H - the column of its largest cell,
+the first one on ties, like np.argmax - and returns the amount of rows whose label differs from the reference. labels may be the reference itself.
+*/
+int labels_changed(double** H, int n, int k, int* labels, int* reference)
+{
+    int i, j, best, changed = 0;
+    for (i = 0; i < n; i++)
+    {
+        best = 0;
+        for (j = 1; j < k; j++)
+            if (H[i][j] > H[i][best])
+                best = j;
+        changed += (reference[i] != best);
+        labels[i] = best;
+    }
+    return changed;
+}
+
+/*
+Given a starting matrix H, its dimensions and a graph laplacian W, perform the optimization algorithm INPLACE in the instructions.
+Returns an optimized H (Will use the same pointer that H was given through), or frees H and returns a null pointer on failure.
+*/
+double** optimizing_H(double** H, int rows_num, int cols_num, double** W)
+{
+    w_source src;
+    init_w_source(&src);
+    src.W = W;
+    return optimizing_H_from_source(H, rows_num, cols_num, &src);
+}
+
+/*
+Given the points, their dimensions and kernel widths (See point_scales), returns a NEW array of length n holding the diagonal of D^(-1/2), without storing A.
+Every row of A is recomputed on the fly and summed in the same order as degree_vector does.
+If memory allocation error occurs, returns a null pointer.
+*/
+double* matrix_free_inv_sqrt_degrees(double** datapoints, int n, int d, double* scales)
+{
+    int i, j;
+    double sum;
+    double* D_neg_half = (double*)malloc(n * sizeof(double));
+    if (D_neg_half == NULL)
+        return NULL;
+    #pragma omp parallel for private(j, sum) schedule(static)
+    for (i = 0; i < n; i++) {
+        sum = 0.0;
+        for (j = 0; j < n; j++)
+            if (j != i)
+                sum += similarity(squared_euclidean_dist(datapoints[i], datapoints[j], d), scales[i], scales[j]);
+        D_neg_half[i] = 1 / sqrt(sum + denominator_eps);
+    }
+    return D_neg_half;
+}
+
+/*
+Given the points, their kernel widths and the diagonal of D^(-1/2), returns the mean of all cells of W without storing it (needed to initialize H, see 1.4.1).
+Every cell is computed and summed exactly as matrix_mean sums a dense W, so both give the same mean (and so the same initial H).
+The mean is never negative, so if memory allocation error occurs, returns -1.
+*/
+double matrix_free_mean(double** datapoints, int n, int d, double* scales, double* D_neg_half)
+{
+    int i, j;
+    double row_sum, sum;
+    double* row_sums = (double*)calloc(n, sizeof(double));
+    if (row_sums == NULL)
+        return -1;
+    #pragma omp parallel for private(j, row_sum) schedule(static)
+    for (i = 0; i < n; i++) {
+        row_sum = 0.0;
+        for (j = 0; j < n; j++)
+            if (j != i)
+                row_sum += (D_neg_half[i] * similarity(squared_euclidean_dist(datapoints[i], datapoints[j], d), scales[i], scales[j])) * D_neg_half[j];
+        row_sums[i] = row_sum;
+    }
+    sum = ordered_sum(row_sums, n);
+    free(row_sums);
+    return sum / ((double)n * n);
+}
+
+/*
+Given a starting n*k matrix H and the n*d points, performs the optimization algorithm without ever storing W.
+Memory is O(nd + nk) instead of O(n^2), at the cost of recomputing W on every iteration.
+Returns an optimized H (Will use the same pointer that H was given through), or frees H and returns a null pointer on failure.
+*/
+double** optimizing_H_matrix_free(double** H, int n, int k, double** datapoints, int d)
+{
+    w_source src;
+    init_w_source(&src);
+    src.points = datapoints; src.d = d;
+    src.scales = point_scales(datapoints, n, d);
+    src.D_neg_half = (src.scales == NULL) ? NULL : matrix_free_inv_sqrt_degrees(datapoints, n, d, src.scales);
+    if (src.D_neg_half == NULL)
+    {
+        free(src.scales);
+        free_matrix(H, n);
+        return NULL;
+    }
+    H = optimizing_H_from_source(H, n, k, &src);
+    free(src.D_neg_half);
+    free(src.scales);
+    return H;
+}
+
+/*
+Sets every field of src to "nothing", so the caller only has to fill the fields of the mode it wants.
+*/
+void init_w_source(w_source* src)
+{
+    src->W = NULL;
+    src->W_file = NULL;
+    src->panel_rows = 0;
+    src->panel = NULL;
+    src->points = NULL;
+    src->d = 0;
+    src->D_neg_half = NULL;
+    src->scales = NULL;
+    src->W_path = NULL;
+    src->on_iteration = NULL;
+    src->hook_context = NULL;
+    src->row_traces = NULL;
+    src->gram_sq_norm = 0.0;
+    src->tile_offsets = NULL;
+    src->tile_columns = NULL;
+}
+
+/*
+Writes the header of a binary matrix file: the magic bytes, the dimensions, how many rows are in a panel, the mean of all cells
+and the fingerprint of the points the matrix was built from (See input_fingerprint), or 0 if it wasn't built from points.
+The cells follow the header row by row as raw doubles. Returns 0 on success and 1 on failure.
+*/
+int write_matrix_header(FILE* fp, int rows, int cols, int panel_rows, double mean, unsigned long fingerprint)
+{
+    if (fwrite(MATRIX_FILE_MAGIC, 1, 4, fp) != 4 || fwrite(&rows, sizeof(int), 1, fp) != 1 || fwrite(&cols, sizeof(int), 1, fp) != 1
+        || fwrite(&panel_rows, sizeof(int), 1, fp) != 1 || fwrite(&mean, sizeof(double), 1, fp) != 1 || fwrite(&fingerprint, sizeof(unsigned long), 1, fp) != 1)
+        return 1;
+    return 0;
+}
+
+/*
+Opens a binary matrix file for reading and reads its header into the given pointers (any of which may be NULL).
+Leaves the file positioned at the first cell. If the file can't be opened or isn't a matrix file, returns a null pointer.
+*/
+FILE* open_matrix_file(const char* filename, int* rows, int* cols, int* panel_rows, double* mean, unsigned long* fingerprint)
+{
+    char magic[4];
+    int r, c, p;
+    double m;
+    unsigned long f;
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return NULL;
+    if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, MATRIX_FILE_MAGIC, 4) != 0 || fread(&r, sizeof(int), 1, fp) != 1
+        || fread(&c, sizeof(int), 1, fp) != 1 || fread(&p, sizeof(int), 1, fp) != 1 || fread(&m, sizeof(double), 1, fp) != 1
+        || fread(&f, sizeof(unsigned long), 1, fp) != 1 || r <= 0 || c <= 0 || p <= 0)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    if (rows != NULL) *rows = r;
+    if (cols != NULL) *cols = c;
+    if (panel_rows != NULL) *panel_rows = p;
+    if (mean != NULL) *mean = m;
+    if (fingerprint != NULL) *fingerprint = f;
+    return fp;
+}
+
+/*
+Given the points and their dimensions, writes the n*n normalized similarity matrix W to a binary matrix file, one row panel at a time.
+Only one panel (about PANEL_BYTES) of W is in memory at any moment, so W may be much larger than RAM.
+The header records the fingerprint of the points and the kernel (See input_fingerprint, with seed 0), so a W file can be checked before it is reused.
+Returns 0 on success and 1 on failure.
+*/
+int normalized_similarity_to_file(double** datapoints, int n, int d, const char* filename)
+{
+    int panel_rows, pb, p_end, i, j, failed = 0;
+    double row_sum, sum = 0.0;
+    double** panel;
+    FILE* fp;
+    double* D_neg_half = NULL;
+    double* scales = point_scales(datapoints, n, d);
+    unsigned long fingerprint = input_fingerprint(datapoints, n, d, 0);
+    if (scales != NULL)
+        D_neg_half = matrix_free_inv_sqrt_degrees(datapoints, n, d, scales);
+    if (D_neg_half == NULL)
+    {
+        free(scales);
+        return 1;
+    }
+    panel_rows = PANEL_BYTES / ((int)sizeof(double) * n);
+    if (panel_rows < 1)
+        panel_rows = 1;
+    if (panel_rows > n)
+        panel_rows = n;
+    panel = alloc_matrix(panel_rows, n);
+    fp = fopen(filename, "wb");
+    if (panel == NULL || fp == NULL || write_matrix_header(fp, n, n, panel_rows, 0.0, fingerprint) == 1)
+        failed = 1;
+    for (pb = 0; pb < n && !failed; pb += panel_rows)
+    {
+        p_end = (pb + panel_rows < n) ? pb + panel_rows : n;
+        #pragma omp parallel for private(j) schedule(static)
+        for (i = pb; i < p_end; i++)
+            for (j = 0; j < n; j++)
+                panel[i - pb][j] = (i == j) ? 0 : (D_neg_half[i] * similarity(squared_euclidean_dist(datapoints[i], datapoints[j], d), scales[i], scales[j])) * D_neg_half[j];
+        for (i = pb; i < p_end && !failed; i++)
+        {
+            row_sum = 0.0;
+            for (j = 0; j < n; j++)
+                row_sum += panel[i - pb][j];
+            sum += row_sum;
+            if (fwrite(panel[i - pb], sizeof(double), n, fp) != (size_t)n)
+                failed = 1;
+        }
+    }
+    if (!failed) /* Now that all of W was seen, fill in its mean */
+        failed = (fseek(fp, 0, SEEK_SET) != 0 || write_matrix_header(fp, n, n, panel_rows, sum / ((double)n * n), fingerprint) == 1);
+    if (fp != NULL && fclose(fp) != 0)
+        failed = 1;
+    free_matrix(panel, panel_rows);
+    free(D_neg_half);
+    free(scales);
+    return failed;
+}
+
+/*
+Puts filename followed by suffix into name (of MAX_PATH_LENGTH). Returns 0 on success and 1 if it doesn't fit.
+*/
+int temp_file_name(const char* filename, const char* suffix, char* name)
+{
+    if (strlen(filename) + strlen(suffix) >= MAX_PATH_LENGTH)
+        return 1;
+    strcpy(name, filename);
+    strcat(name, suffix);
+    return 0;
+}
+
+/*
+Writes the rows*cols matrix M to a binary matrix file (See write_matrix_header), which optimizing_H_out_of_core can stream.
+The file is written under a temporary name and renamed into place, so it is either the whole new matrix or whatever was there before.
+Returns 0 on success and 1 on failure.
+*/
+int write_matrix_file(const char* filename, double** M, int rows, int cols)
+{
+    int i, failed, panel_rows = PANEL_BYTES / ((int)sizeof(double) * cols);
+    char temp[MAX_PATH_LENGTH];
+    FILE* fp;
+    if (temp_file_name(filename, TEMP_SUFFIX, temp) == 1 || (fp = fopen(temp, "wb")) == NULL)
+        return 1;
+    if (panel_rows < 1)
+        panel_rows = 1;
+    if (panel_rows > rows)
+        panel_rows = rows;
+    failed = write_matrix_header(fp, rows, cols, panel_rows, matrix_mean(M, rows, cols), 0);
+    for (i = 0; i < rows && !failed; i++)
+        failed = (fwrite(M[i], sizeof(double), cols, fp) != (size_t)cols);
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) /* On the disk before it replaces the old file */
+        failed = 1;
+    if (fclose(fp) != 0 || failed || rename(temp, filename) != 0)
+    {
+        remove(temp);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Reads a whole binary matrix file into a NEW matrix, putting its dimensions into rows and cols.
+If the file can't be read or memory allocation error occurs, returns a null pointer.
+*/
+double** read_matrix_file(const char* filename, int* rows, int* cols)
+{
+    int i;
+    double** M = NULL;
+    FILE* fp = open_matrix_file(filename, rows, cols, NULL, NULL, NULL);
+    if (fp == NULL)
+        return NULL;
+    M = alloc_matrix_first_touch(*rows, *cols); /* Mostly a W - place its rows before fread touches them all from this thread */
+    for (i = 0; M != NULL && i < *rows; i++)
+    {
+        if (fread(M[i], sizeof(double), *cols, fp) != (size_t)*cols)
+        {
+            free_matrix(M, *rows);
+            M = NULL;
+        }
+    }
+    fclose(fp);
+    return M;
+}
+
+/*
+Writes a checkpoint of optimizing_H: the n*k matrix H as a binary matrix file, followed by a trailer with CHECKPOINT_MAGIC, the fingerprint
+of the input (See input_fingerprint), the iteration H is the result of, the delta of that iteration (the convergence state)
+and the path of the file W is persisted in ("" if none).
+Written under a temporary name and renamed into place, so a crash mid-write leaves the previous checkpoint whole.
+Returns 0 on success and 1 on failure.
+*/
+int write_checkpoint(const char* filename, double** H, int n, int k, int iteration, double delta, const char* W_path, unsigned long fingerprint)
+{
+    int i, length = (W_path == NULL) ? 0 : (int)strlen(W_path), failed;
+    char temp[MAX_PATH_LENGTH];
+    FILE* fp;
+    if (temp_file_name(filename, TEMP_SUFFIX, temp) == 1 || (fp = fopen(temp, "wb")) == NULL)
+        return 1;
+    failed = write_matrix_header(fp, n, k, n, 0.0, 0);
+    for (i = 0; i < n && !failed; i++)
+        failed = (fwrite(H[i], sizeof(double), k, fp) != (size_t)k);
+    if (!failed)
+        failed = (fwrite(CHECKPOINT_MAGIC, 1, 4, fp) != 4 || fwrite(&fingerprint, sizeof(unsigned long), 1, fp) != 1 || fwrite(&iteration, sizeof(int), 1, fp) != 1 || fwrite(&delta, sizeof(double), 1, fp) != 1
+            || fwrite(&length, sizeof(int), 1, fp) != 1 || fwrite(W_path == NULL ? "" : W_path, 1, length, fp) != (size_t)length);
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+        failed = 1;
+    if (fclose(fp) != 0 || failed || rename(temp, filename) != 0)
+    {
+        remove(temp);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Reads the checkpoint in filename (See write_checkpoint) if it is one of an n*k H of the input with this fingerprint (which isn't 0):
+H into H (unless it is a null pointer), and the trailer into iteration, delta and W_path (unless it is a null pointer, else of MAX_PATH_LENGTH).
+Returns 0 on success and 1 if there is no such checkpoint.
+*/
+int read_checkpoint(const char* filename, double** H, int n, int k, unsigned long fingerprint, int* iteration, double* delta, char* W_path)
+{
+    int i, rows, cols, it, length, failed = 0;
+    unsigned long input;
+    char magic[4], path[MAX_PATH_LENGTH];
+    double d;
+    FILE* fp = open_matrix_file(filename, &rows, &cols, NULL, NULL, NULL);
+    if (fp == NULL)
+        return 1;
+    if (rows != n || cols != k || fseek(fp, MATRIX_HEADER_BYTES + (long)n * k * (long)sizeof(double), SEEK_SET) != 0
+        || fread(magic, 1, 4, fp) != 4 || memcmp(magic, CHECKPOINT_MAGIC, 4) != 0 || fread(&input, sizeof(unsigned long), 1, fp) != 1
+        || fingerprint == 0 || input != fingerprint || fread(&it, sizeof(int), 1, fp) != 1
+        || fread(&d, sizeof(double), 1, fp) != 1 || fread(&length, sizeof(int), 1, fp) != 1 || length < 0 || length >= MAX_PATH_LENGTH
+        || fread(path, 1, length, fp) != (size_t)length || it < 0 || it > max_iter)
+        failed = 1;
+    if (!failed && H != NULL) /* The trailer checks out, so H is whole */
+    {
+        failed = (fseek(fp, MATRIX_HEADER_BYTES, SEEK_SET) != 0);
+        for (i = 0; i < n && !failed; i++)
+            failed = (fread(H[i], sizeof(double), k, fp) != (size_t)k);
+    }
+    fclose(fp);
+    if (failed)
+        return 1;
+    path[length] = '\0';
+    *iteration = it;
+    *delta = d;
+    if (W_path != NULL)
+        strcpy(W_path, path);
+    return 0;
+}
+
+/*
+Given a source whose W lives in a binary matrix file, writes rows first..last-1 of the product WH into rows 0..last-first-1 of the ALREADY EXISTING matrix WH.
+W is read one row panel at a time into src->panel. Before a panel is multiplied,
+the kernel is asked to start reading the next one in the background, so the disk works while the threads compute.
+Returns 0 on success and 1 if the file could not be read.
+*/
+int out_of_core_w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k)
+{
+    int pb, p_end, i;
+    long header_size = MATRIX_HEADER_BYTES;
+    long row_size = (long)n * (long)sizeof(double);
+    const row_kernels* kernels = select_row_kernels(k);
+    if (fseek(src->W_file, header_size + first * row_size, SEEK_SET) != 0)
+        return 1;
+    for (pb = first; pb < last; pb += src->panel_rows)
+    {
+        p_end = (pb + src->panel_rows < last) ? pb + src->panel_rows : last;
+        for (i = pb; i < p_end; i++)
+            if (fread(src->panel[i - pb], sizeof(double), n, src->W_file) != (size_t)n)
+                return 1;
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(fileno(src->W_file), header_size + p_end * row_size, src->panel_rows * row_size, POSIX_FADV_WILLNEED);
+#endif
+        #pragma omp parallel for schedule(static)
+        for (i = pb; i < p_end; i++)
+            kernels->w_times_row(src->panel[i - pb], H, WH[i - first], n, k);
+    }
+    return 0;
+}
+
+/*
+Given a starting n*k matrix H and a binary matrix file holding W (see normalized_similarity_to_file),
+performs the optimization algorithm while streaming W from the disk on every iteration. Only one panel of W is in memory at a time.
+Returns an optimized H (Will use the same pointer that H was given through), or frees H and returns a null pointer on failure.
+*/
+double** optimizing_H_out_of_core(double** H, int n, int k, const char* filename)
+{
+    int rows, cols;
+    w_source src;
+    init_w_source(&src);
+    src.W_file = open_matrix_file(filename, &rows, &cols, &src.panel_rows, NULL, NULL);
+    if (src.W_file == NULL)
+    {
+        free_matrix(H, n);
+        return NULL;
+    }
+    if (rows != n || cols != n || (src.panel = alloc_matrix(src.panel_rows, n)) == NULL)
+    {
+        fclose(src.W_file);
+        free_matrix(H, n);
+        return NULL;
+    }
+    src.W_path = filename;
+    H = optimizing_H_from_source(H, n, k, &src);
+    free_matrix(src.panel, src.panel_rows);
+    fclose(src.W_file);
+    return H;
+}
+
+/*
+Points rows[0..last-first-1] at rows first..last-1 of W, taking W from wherever src says it lives.
+A dense W lends its own rows. Otherwise the rows are read (out-of-core) or recomputed (matrix-free) into buffer, which needs last-first rows of n.
+Returns 0 on success and 1 if W could not be read.
+*/
+int w_source_rows(w_source* src, int first, int last, int n, double** buffer, double** rows)
+{
+    int i, p;
+    if (src->W != NULL)
+    {
+        for (i = first; i < last; i++)
+            rows[i - first] = src->W[i];
+        return 0;
+    }
+    if (src->W_file != NULL)
+    {
+        if (fseek(src->W_file, MATRIX_HEADER_BYTES + first * ((long)n * (long)sizeof(double)), SEEK_SET) != 0)
+            return 1;
+        for (i = first; i < last; i++)
+        {
+            if (fread(buffer[i - first], sizeof(double), n, src->W_file) != (size_t)n)
+                return 1;
+            rows[i - first] = buffer[i - first];
+        }
+        return 0;
+    }
+    #pragma omp parallel for private(p) schedule(static)
+    for (i = first; i < last; i++)
+    {
+        for (p = 0; p < n; p++)
+            buffer[i - first][p] = (p == i) ? 0.0 : (src->D_neg_half[i] * similarity(squared_euclidean_dist(src->points[i], src->points[p], src->d), src->scales[i], src->scales[p])) * src->D_neg_half[p];
+        rows[i - first] = buffer[i - first];
+    }
+    return 0;
+}
+
+/*
+Coarsens the n rows of W into n_coarse aggregates around landmarks: n_coarse rows drawn from RANDOM_SEED (a partial shuffle),
+with every other row joining the landmark it is most similar to. Puts the aggregate of row i into aggregate[i].
+W is only read once, TILE_SIZE rows at a time. Returns 0 on success and 1 on failure.
+*/
+int landmark_aggregates(w_source* src, int n, int n_coarse, int* aggregate)
+{
+    int i, j, best, tmp, first, last, failed = 0;
+    int* order = (int*)malloc(n * sizeof(int));
+    double** rows = (double**)malloc(TILE_SIZE * sizeof(double*));
+    double** buffer = (src->W == NULL) ? alloc_matrix(TILE_SIZE, n) : NULL;
+    if (order == NULL || rows == NULL || (src->W == NULL && buffer == NULL))
+        failed = 1;
+    for (i = 0; i < n && !failed; i++)
+    {
+        order[i] = i;
+        aggregate[i] = -1;
+    }
+    for (i = 0; i < n_coarse && !failed; i++) /* The landmarks end up in order[0..n_coarse-1] */
+    {
+        j = i + (int)(uniform_draw(RANDOM_SEED, i) * (n - i));
+        tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+        aggregate[order[i]] = i;
+    }
+    for (first = 0; first < n && !failed; first += TILE_SIZE)
+    {
+        last = (first + TILE_SIZE < n) ? first + TILE_SIZE : n;
+        if (w_source_rows(src, first, last, n, buffer, rows) == 1)
+        {
+            failed = 1;
+            break;
+        }
+        #pragma omp parallel for private(j, best) schedule(static)
+        for (i = first; i < last; i++)
+        {
+            if (aggregate[i] >= 0) /* A landmark */
+                continue;
+            best = 0;
+            for (j = 1; j < n_coarse; j++)
+                if (rows[i - first][order[j]] > rows[i - first][order[best]])
+                    best = j;
+            aggregate[i] = best;
+        }
+    }
+    free(order);
+    free(rows);
+    free_matrix(buffer, TILE_SIZE);
+    return failed;
+}
+
+/*
+Coarsens the n rows of W by heavy-edge matching: every row not matched yet is matched with the unmatched row it has the heaviest edge to
+(rows with no edge left stay on their own). An edge is weighed by its mean over the original points, W[i][j]/(sizes[i]*sizes[j]), where sizes[i]
+is how many original points row i stands for - so large aggregates don't keep absorbing each other. Puts the aggregate of row i into aggregate[i].
+Returns the amount of aggregates, or -1 on failure.
+*/
+int heavy_edge_matching(w_source* src, int n, int* sizes, int* aggregate)
+{
+    int i, j, best, first, last, n_coarse = 0;
+    double weight, best_weight;
+    double** rows = (double**)malloc(TILE_SIZE * sizeof(double*));
+    double** buffer = (src->W == NULL) ? alloc_matrix(TILE_SIZE, n) : NULL;
+    if (rows == NULL || (src->W == NULL && buffer == NULL))
+        n_coarse = -1;
+    for (i = 0; i < n; i++)
+        aggregate[i] = -1;
+    for (first = 0; first < n && n_coarse >= 0; first += TILE_SIZE)
+    {
+        last = (first + TILE_SIZE < n) ? first + TILE_SIZE : n;
+        if (w_source_rows(src, first, last, n, buffer, rows) == 1)
+        {
+            n_coarse = -1;
+            break;
+        }
+        for (i = first; i < last; i++) /* In order - every match depends on the ones before it */
+        {
+            if (aggregate[i] >= 0)
+                continue;
+            best = -1;
+            best_weight = 0.0;
+            for (j = 0; j < n; j++)
+            {
+                weight = rows[i - first][j] / ((double)sizes[i] * sizes[j]);
+                if (j != i && aggregate[j] < 0 && weight > best_weight)
+                {
+                    best = j;
+                    best_weight = weight;
+                }
+            }
+            aggregate[i] = n_coarse;
+            if (best >= 0)
+                aggregate[best] = n_coarse;
+            n_coarse++;
+        }
+    }
+    free(rows);
+    free_matrix(buffer, TILE_SIZE);
+    return n_coarse;
+}
+
+/*
+Returns a NEW n_coarse*n_coarse matrix holding the coarse graph of W: cell (a,b) is the sum of W[i][j] over the rows i of aggregate a
+and the columns j of aggregate b (in matrix terms, P^T W P where P maps rows to their aggregates). W is only read once, TILE_SIZE rows at a time.
+If memory allocation error (or a read error of W) occurs, returns a null pointer.
+*/
+double** coarse_graph(w_source* src, int n, int* aggregate, int n_coarse)
+{
+    int i, j, first, last;
+    double *row, *coarse_row;
+    double** rows = (double**)malloc(TILE_SIZE * sizeof(double*));
+    double** buffer = (src->W == NULL) ? alloc_matrix(TILE_SIZE, n) : NULL;
+    double** coarse = alloc_matrix(n_coarse, n_coarse);
+    if (rows == NULL || (src->W == NULL && buffer == NULL) || coarse == NULL)
+    {
+        free(rows);
+        free_matrix(buffer, TILE_SIZE);
+        free_matrix(coarse, n_coarse);
+        return NULL;
+    }
+    for (first = 0; first < n; first += TILE_SIZE)
+    {
+        last = (first + TILE_SIZE < n) ? first + TILE_SIZE : n;
+        if (w_source_rows(src, first, last, n, buffer, rows) == 1)
+        {
+            free_matrix(coarse, n_coarse);
+            coarse = NULL;
+            break;
+        }
+        for (i = first; i < last; i++) /* In order, so the sums don't depend on the threads */
+        {
+            row = rows[i - first];
+            coarse_row = coarse[aggregate[i]];
+            for (j = 0; j < n; j++)
+                coarse_row[aggregate[j]] += row[j];
+        }
+    }
+    free(rows);
+    free_matrix(buffer, TILE_SIZE);
+    return coarse;
+}
+
+/*
+Returns a NEW n_coarse*k matrix to start the coarse graph's optimization from: row a is the row of H of the first row of aggregate a,
+times children[a] (the amount of rows in a). The scale matches the coarse graph, whose cells are sums over both aggregates (See prolong_H).
+If memory allocation error occurs, returns a null pointer.
+*/
+double** restrict_H(double** H, int n, int k, int* aggregate, int* children, int n_coarse)
+{
+    int i, j;
+    char* seen = (char*)calloc(n_coarse, sizeof(char));
+    double** H_coarse = alloc_matrix(n_coarse, k);
+    if (seen == NULL || H_coarse == NULL)
+    {
+        free(seen);
+        free_matrix(H_coarse, n_coarse);
+        return NULL;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (seen[aggregate[i]])
+            continue;
+        seen[aggregate[i]] = 1;
+        for (j = 0; j < k; j++)
+            H_coarse[aggregate[i]][j] = children[aggregate[i]] * H[i][j];
+    }
+    free(seen);
+    return H_coarse;
+}
+
+/*
+Returns a NEW n*k matrix with the coarse solution spread back over the n rows: row i is the row of its aggregate a divided by children[a].
+If W is close to H(H^T) with similar rows within every aggregate, the coarse graph is close to H_coarse(H_coarse^T) where a row of H_coarse
+is the sum of the rows of its aggregate - so dividing by the size of the aggregate gives back the rows of H.
+If memory allocation error occurs, returns a null pointer.
+*/
+double** prolong_H(double** H_coarse, int n, int k, int* aggregate, int* children)
+{
+    int i, j;
+    double** H = alloc_matrix(n, k);
+    if (H == NULL)
+        return NULL;
+    #pragma omp parallel for private(j) schedule(static)
+    for (i = 0; i < n; i++)
+        for (j = 0; j < k; j++)
+            H[i][j] = H_coarse[aggregate[i]][j] / children[aggregate[i]];
+    return H;
+}
+
+/*
+Given a starting n*k matrix H and the place to take W from, performs the optimization algorithm on a hierarchy of coarsened graphs:
+W is coarsened (straight to landmarks if it is large, then by heavy-edge matching) until a graph has at most COARSEST_ROWS rows (or 4k),
+H is restricted down to that graph and optimized there, and the result is prolonged back one level at a time, each level warm-starting the
+iterations of the next one - so W itself only needs the few iterations that polish an already good H. Only the coarse graphs are stored.
+The checkpoint (See optimizing_H_single_level) and the iteration hook of src only apply to the iterations on W itself.
+Returns an optimized H (not necessarily through the same pointer). If memory allocation (or reading W) fails, frees H and returns a null pointer.
+*/
+double** optimizing_H_multilevel(double** H, int n, int k, w_source* src, const char* checkpoint)
+{
+    int levels = 0, l, i, m, n_coarse, failed = 0, h_rows = n;
+    int rows[MAX_LEVELS + 1];
+    int *aggregate[MAX_LEVELS], *children[MAX_LEVELS], *sizes = (int*)malloc(n * sizeof(int)), *next_sizes;
+    double** graph[MAX_LEVELS + 1];
+    double** next_H;
+    w_source level_src[MAX_LEVELS + 1];
+    rows[0] = n;
+    graph[0] = NULL;
+    level_src[0] = *src;
+    for (i = 0; i < n && sizes != NULL; i++)
+        sizes[i] = 1;
+    failed = (sizes == NULL);
+    while (!failed && levels < MAX_LEVELS && rows[levels] > COARSEST_ROWS && rows[levels] > 4 * k)
+    {
+        m = rows[levels];
+        aggregate[levels] = (int*)malloc(m * sizeof(int));
+        if (aggregate[levels] == NULL)
+        {
+            failed = 1;
+            break;
+        }
+        if (m > 2 * COARSE_ROWS && COARSE_ROWS > 4 * k) /* Matching would leave too large a graph to store */
+            n_coarse = (landmark_aggregates(&level_src[levels], m, COARSE_ROWS, aggregate[levels]) == 0) ? COARSE_ROWS : -1;
+        else
+            n_coarse = heavy_edge_matching(&level_src[levels], m, sizes, aggregate[levels]);
+        if (n_coarse < 0 || n_coarse * 10 > m * 9) /* Failed, or barely coarsened - stop here */
+        {
+            failed = (n_coarse < 0);
+            free(aggregate[levels]);
+            break;
+        }
+        children[levels] = (int*)calloc(n_coarse, sizeof(int));
+        next_sizes = (int*)calloc(n_coarse, sizeof(int));
+        graph[levels + 1] = (children[levels] == NULL || next_sizes == NULL) ? NULL : coarse_graph(&level_src[levels], m, aggregate[levels], n_coarse);
+        if (graph[levels + 1] == NULL)
+        {
+            free(children[levels]);
+            free(next_sizes);
+            free(aggregate[levels]);
+            failed = 1;
+            break;
+        }
+        for (i = 0; i < m; i++)
+        {
+            children[levels][aggregate[levels][i]]++;
+            next_sizes[aggregate[levels][i]] += sizes[i];
+        }
+        free(sizes);
+        sizes = next_sizes;
+        levels++;
+        rows[levels] = n_coarse;
+        init_w_source(&level_src[levels]);
+        level_src[levels].W = graph[levels];
+    }
+    free(sizes);
+    for (l = 0; l < levels && !failed; l++) /* Down to the coarsest graph */
+    {
+        next_H = restrict_H(H, h_rows, k, aggregate[l], children[l], rows[l + 1]);
+        if (next_H == NULL)
+        {
+            failed = 1;
+            break;
+        }
+        free_matrix(H, h_rows);
+        H = next_H;
+        h_rows = rows[l + 1];
+    }
+    if (!failed)
+        failed = ((H = optimizing_H_single_level(H, h_rows, k, &level_src[levels], (levels == 0) ? checkpoint : NULL)) == NULL);
+    for (l = levels - 1; l >= 0; l--) /* And back up, optimizing on every level */
+    {
+        next_H = failed ? NULL : prolong_H(H, rows[l], k, aggregate[l], children[l]);
+        if (next_H == NULL)
+            failed = 1;
+        else
+        {
+            free_matrix(H, h_rows);
+            H = next_H;
+            h_rows = rows[l];
+        }
+        free_matrix(graph[l + 1], rows[l + 1]);
+        free(aggregate[l]);
+        free(children[l]);
+        if (!failed)
+            failed = ((H = optimizing_H_single_level(H, h_rows, k, &level_src[l], (l == 0) ? checkpoint : NULL)) == NULL);
+    }
+    if (failed)
+    {
+        free_matrix(H, h_rows);
+        return NULL;
+    }
+    return H;
+}
+
+/*
+Receives a m*n matrix A and a n*k matrix B alongside their dimensions, and returns the product matrix AB.
+*/
+double** multiply_matrix(double** matrixA, double** matrixB, int m, int n, int k) {
+    int i, j, l, p;
+    double** product = malloc(m * sizeof(double*));
+    if (product == NULL) return NULL;
+    for (i = 0; i < m; i++) {
+        product[i] = malloc(k * sizeof(double));
+        if (product[i] == NULL) {
+            /* Clean up previously allocated memory */
+            for (p = 0; p < i; p++) {
+                free(product[p]);
+            }
+            free(product);
+            return NULL;
+        }
+        /* Initialize to zero (still more efficient than calloc) */
+        for (j = 0; j < k; j++) {
+            product[i][j] = 0.0;
+        }
+    }
+    /* Optimized loop order for better cache locality */
+    for (i = 0; i < m; i++) {
+        for (l = 0; l < n; l++) {
+            const double a_il = matrixA[i][l]; /* Hear me out: Cache this value */
+            for (j = 0; j < k; j++) {
+                product[i][j] += a_il * matrixB[l][j];
+            }
+        }
+    }
+    return product;
+}
+
+/*
+Given an array of arrays representing points, the amount of points (n) and the dimension of every point (d),
+returns the n*n similarity matrix of the points. Assumes all points are of dimension d.
+The matrix is symmetric, so every kernel value is computed once, into the upper triangle, which is then mirrored row by row.
+The rows are allocated with alloc_matrix_first_touch, and filled in parallel.
+With local scaling the matrix first holds the squared distances, from which every row finds its local scale, and only then the kernel values,
+so every distance is still computed once.
+*/
+double** similarity_matrix(double** datapoints, int n, int d){
+    double** A = alloc_matrix_first_touch(n, n);
+    int i, j;
+    if (local_scaling_neighbor > 0)
+        return locally_scaled_similarity_matrix(A, datapoints, n, d);
+    if(A == NULL)
+        return NULL;
+    #pragma omp parallel for private(j) schedule(dynamic, TILE_SIZE)
+    for (i = 0; i < n; i++){ /* The diagonal stays 0 */
+        for (j = i + 1; j < n; j++)
+            A[i][j] = similarity(squared_euclidean_dist(*(datapoints + i), *(datapoints + j), d), kernel_sigma, kernel_sigma);
+    }
+    mirror_upper_triangle(A, n);
+    return A;
+}
+
+/*
+Copies the upper triangle of the n*n matrix A into its lower triangle. Every thread writes only its own rows (the static split of alloc_matrix_first_touch).
+*/
+void mirror_upper_triangle(double** A, int n)
+{
+    int i, j;
+    #pragma omp parallel for private(j) schedule(static)
+    for (i = 0; i < n; i++)
+        for (j = 0; j < i; j++)
+            A[i][j] = A[j][i];
+}
+
+/*
+similarity_matrix with local scaling, given the zeroed matrix A it allocated (or a null pointer). Returns A, or a null pointer on failure.
+*/
+double** locally_scaled_similarity_matrix(double** A, double** datapoints, int n, int d)
+{
+    int i, j, count, m = (local_scaling_neighbor < n - 1) ? local_scaling_neighbor : n - 1;
+    double nearest[MAX_LOCAL_SCALING_NEIGHBOR];
+    double* scales = (A == NULL) ? NULL : (double*)malloc(n * sizeof(double));
+    if (scales == NULL)
+    {
+        free_matrix(A, n);
+        return NULL;
+    }
+    #pragma omp parallel for private(j) schedule(dynamic, TILE_SIZE)
+    for (i = 0; i < n; i++) { /* The squared distances (the diagonal stays 0) */
+        for (j = i + 1; j < n; j++)
+            A[i][j] = squared_euclidean_dist(datapoints[i], datapoints[j], d);
+    }
+    #pragma omp parallel for private(j, count, nearest) schedule(static)
+    for (i = 0; i < n; i++) { /* The local scales, from the upper triangle (row i holds (i, j) for j > i, and column i for j < i) */
+        count = 0;
+        for (j = 0; j < n && m > 0; j++)
+            if (j != i)
+                keep_nearest(nearest, &count, m, (j > i) ? A[i][j] : A[j][i]);
+        scales[i] = (m > 0) ? local_scale(nearest, count) : kernel_sigma;
+    }
+    #pragma omp parallel for private(j) schedule(dynamic, TILE_SIZE)
+    for (i = 0; i < n; i++)
+        for (j = i + 1; j < n; j++)
+            A[i][j] = similarity(A[i][j], scales[i], scales[j]);
+    mirror_upper_triangle(A, n);
+    free(scales);
+    return A;
+}
+
+/*
+Given an n*n similarity matrix A, returns a NEW array of length n holding the diagonal of D^(-1/2), i.e. 1/sqrt(deg(i)).
+If memory allocation error occurs, returns a null pointer.
+*/
+double* inv_sqrt_degree_vector(double** A, int n){
+    int i;
+    double* D_neg_half = degree_vector(A, n);
+    if(D_neg_half == NULL)
+        return NULL;
+    for (i = 0; i < n; i++)
+        D_neg_half[i] = 1 / sqrt(D_neg_half[i] + denominator_eps);
+    return D_neg_half;
+}
+
+/*
+Given an n*n matrix A and the diagonal of D^(-1/2), replaces A IN PLACE with D^(-1/2)*A*D^(-1/2).
+Since both sides are diagonal, every cell is just scaled by its row's and column's factors - no matrix products are needed.
+Rows are split between the threads like in alloc_matrix_first_touch, so every thread works on the rows on its own NUMA node.
+*/
+void normalize_in_place(double** A, double* D_neg_half, int n){
+    int i, j;
+    #pragma omp parallel for private(j) schedule(static)
+    for (i = 0; i < n; i++)
+        for (j = 0; j < n; j++)
+            A[i][j] = (D_neg_half[i] * A[i][j]) * D_neg_half[j];
+}
+
+/*
+Given an n*n similarity matrix and the value of n, returns a NEW normalized similarity matrix (sim_matrix is left untouched).
+If memory allocation error occurs, returns a null pointer.
+*/
+double** normalized_similarity_matrix(double** sim_matrix, int n){
+    int i;
+    double** normalized;
+    double* D_neg_half = inv_sqrt_degree_vector(sim_matrix, n);
+    if(D_neg_half == NULL)
+        return NULL;
+    normalized = alloc_matrix_first_touch(n, n);
+    if(normalized == NULL)
+    {
+        free(D_neg_half);
+        return NULL;
+    }
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < n; i++)
+        memcpy(normalized[i], sim_matrix[i], n * sizeof(double));
+    normalize_in_place(normalized, D_neg_half, n);
+    free(D_neg_half);
+    return normalized;
+}
+
+/*
+Given the points and their dimensions, returns the n*n normalized similarity matrix W.
+The similarity matrix is built straight into the buffer that is returned and normalized there, so only one n*n matrix is ever allocated.
+If memory allocation error occurs, returns a null pointer.
+*/
+double** normalized_similarity_from_points(double** datapoints, int n, int d){
+    double* D_neg_half;
+    double** W = similarity_matrix(datapoints, n, d);
+    if(W == NULL)
+        return NULL;
+    D_neg_half = inv_sqrt_degree_vector(W, n);
+    if(D_neg_half == NULL)
+    {
+        free_matrix(W, n);
+        return NULL;
+    }
+    normalize_in_place(W, D_neg_half, n);
+    free(D_neg_half);
+    return W;
+}
+
+
+/*
+Returns the mean of all cells of a rows*cols matrix. Rows are summed in parallel, and the row sums are added with ordered_sum.
+*/
+double matrix_mean(double** M, int rows, int cols)
+{
+    int i, j;
+    double sum = 0.0;
+    double* row_sums = (double*)malloc(rows * sizeof(double));
+    if (row_sums == NULL) /* Still deterministic, just not parallel */
+    {
+        for (i = 0; i < rows; i++)
+            for (j = 0; j < cols; j++)
+                sum += M[i][j];
+        return sum / ((double)rows * cols);
+    }
+    #pragma omp parallel for private(j) schedule(static)
+    for (i = 0; i < rows; i++)
+    {
+        row_sums[i] = 0.0;
+        for (j = 0; j < cols; j++)
+            row_sums[i] += M[i][j];
+    }
+    sum = ordered_sum(row_sums, rows);
+    free(row_sums);
+    return sum / ((double)rows * cols);
+}
+
+/*
+A 32 bit integer hash with good avalanche (every input bit affects every output bit). Only the low 32 bits of x are used.
+*/
+unsigned long hash32(unsigned long x)
+{
+    x &= 0xFFFFFFFFUL;
+    x ^= x >> 16;
+    x = (x * 0x7FEB352DUL) & 0xFFFFFFFFUL;
+    x ^= x >> 15;
+    x = (x * 0x846CA68BUL) & 0xFFFFFFFFUL;
+    x ^= x >> 16;
+    return x;
+}
+
+/*
+Returns the fingerprint of the input of run_symnmf: the n*d points (after any preprocessing, so that is covered too), the kernel
+(kernel_sigma and local_scaling_neighbor) and the seed of the initial H - everything the H it optimizes depends on.
+The rows are hashed in parallel and their hashes combined in order, so it is the same for any amount of threads.
+Returns 0 (an unknown input) if memory allocation fails, and never otherwise.
+*/
+unsigned long input_fingerprint(double** points, int n, int d, unsigned long seed)
+{
+    int i, j, b;
+    unsigned long h, word;
+    const unsigned char* bytes;
+    unsigned long* row_hashes = (unsigned long*)malloc(n * sizeof(unsigned long));
+    if (row_hashes == NULL)
+        return 0;
+    #pragma omp parallel for private(j, b, h, word, bytes) schedule(static)
+    for (i = 0; i < n; i++)
+    {
+        h = hash32((unsigned long)i);
+        for (j = 0; j < d; j++) /* Every double as 32 bit words of its bytes */
+        {
+            bytes = (const unsigned char*)&points[i][j];
+            for (b = 0; b < (int)sizeof(double); b += 4)
+            {
+                word = bytes[b] | ((unsigned long)bytes[b + 1] << 8) | ((unsigned long)bytes[b + 2] << 16) | ((unsigned long)bytes[b + 3] << 24);
+                h = hash32(h ^ word);
+            }
+        }
+        row_hashes[i] = h;
+    }
+    h = hash32(hash32((unsigned long)n) ^ (unsigned long)d);
+    for (i = 0; i < n; i++)
+        h = hash32(h ^ row_hashes[i]);
+    free(row_hashes);
+    bytes = (const unsigned char*)&kernel_sigma;
+    for (b = 0; b < (int)sizeof(double); b++)
+        h = hash32(h ^ bytes[b]);
+    h = hash32(h ^ (unsigned long)local_scaling_neighbor);
+    h = hash32(h ^ hash32(seed));
+    return (h == 0) ? 1 : h;
+}
+
+/*
+Returns a uniform double in [0,1) that depends only on the seed and the index of the draw (a counter-based generator).
+Any thread can draw any index, so the sequence is the same for every amount of threads.
+*/
+double uniform_draw(unsigned long seed, unsigned long index)
+{
+    unsigned long key = hash32(seed ^ hash32(index >> 16 >> 16)); /* The double shift keeps it defined when long is 32 bits */
+    unsigned long high = hash32(key ^ hash32(2 * index)) >> 5; /* 27 bits */
+    unsigned long low = hash32(key ^ hash32(2 * index + 1)) >> 6; /* 26 bits */
+    return ((double)high * TWO_POW_26 + (double)low) / TWO_POW_53;
+}
+
+/*
+Given a n*n graph laplacian W, returns a NEW n*k matrix H to start the optimization from (see 1.4.1):
+every cell is drawn uniformly from [0, 2*sqrt(m/k)] where m is the mean of W. Cell (i,j) is draw number i*k+j of the seed,
+so the same seed always gives the same H. If memory allocation error occurs, returns a null pointer.
+*/
+double** init_H(double** W, int n, int k, unsigned long seed)
+{
+    return init_H_from_mean(matrix_mean(W, n, n), n, k, seed);
+}
+
+/*
+init_H given only the mean of W, for when W is not in memory.
+*/
+double** init_H_from_mean(double mean, int n, int k, unsigned long seed)
+{
+    int i, j;
+    double high = 2 * sqrt(mean / k);
+    double** H = alloc_matrix(n, k);
+    if (H == NULL)
+        return NULL;
+    #pragma omp parallel for private(j) schedule(static)
+    for (i = 0; i < n; i++)
+        for (j = 0; j < k; j++)
+            H[i][j] = high * uniform_draw(seed, (unsigned long)i * k + j);
+    return H;
+}
+
+/*
+Runs the whole SymNMF pipeline on the points: builds W, draws the initial H from the seed and optimizes it.
+If distributed_workers is above 1 the pipeline runs on that many worker processes instead, and W is never built in one piece.
+Otherwise, if memory_budget is set, runs the strategy the planner picks for it (See plan_symnmf), reporting the plan on stderr first.
+Returns the final n*k matrix H. Exits with an error if k is not in 1 <= k < n, no strategy fits the budget or memory allocation fails.
+*/
+double** run_symnmf(double** points, int n, int d, int k, unsigned long seed)
+{
+    int iteration, rows = 0, cols = 0, strategy = STRATEGY_DENSE, resuming;
+    double delta;
+    char W_path[MAX_PATH_LENGTH];
+    double **W = NULL, **H;
+    plan_estimate estimates[STRATEGIES];
+    w_source src;
+    if (k <= 0 || k >= n)
+        free_mat_and_exit(points, n);
+    if (distributed_workers > 1)
+    {
+        H = distributed_symnmf(points, n, d, k, NULL, seed, distributed_workers);
+        if (H == NULL)
+            free_mat_and_exit(points, n);
+        return H;
+    }
+    if (memory_budget > 0)
+    {
+        strategy = plan_symnmf(n, d, k, memory_budget, 0, estimates);
+        report_plan(stderr, n, d, k, memory_budget, estimates, strategy);
+        if (strategy < 0)
+            free_mat_and_exit(points, n);
+    }
+    init_w_source(&src);
+    if (checkpoint_path != NULL) /* Only a checkpoint of these very points, kernel and seed is resumed from */
+        checkpoint_fingerprint = input_fingerprint(points, n, d, seed);
+    resuming = (checkpoint_path != NULL && read_checkpoint(checkpoint_path, NULL, n, k, checkpoint_fingerprint, &iteration, &delta, W_path) == 0
+        && W_path[0] != '\0');
+    if (strategy != STRATEGY_DENSE)
+        return run_symnmf_without_dense_W(points, n, d, k, seed, strategy, resuming ? W_path : NULL);
+    if (resuming)
+    { /* Resuming - take W from where the checkpointed run persisted it */
+        W = read_matrix_file(W_path, &rows, &cols);
+        if (W != NULL && (rows != n || cols != n))
+        {
+            free_matrix(W, rows);
+            W = NULL;
+        }
+        src.W_path = (W == NULL) ? NULL : W_path;
+    }
+    if (W == NULL)
+        W = normalized_similarity_from_points(points, n, d);
+    if (W == NULL)
+        free_mat_and_exit(points, n);
+    H = init_H(W, n, k, seed);
+    if (H == NULL)
+    {
+        free_matrix(W, n);
+        free_mat_and_exit(points, n);
+    }
+    src.W = W;
+    H = optimizing_H_from_source(H, n, k, &src);
+    free_matrix(W, n);
+    if (H == NULL)
+        free_mat_and_exit(points, n);
+    return H;
+}
+
+/*
+The rest of run_symnmf for the strategies that never hold all of W, STRATEGY_OUT_OF_CORE and STRATEGY_MATRIX_FREE.
+Out-of-core, W is taken from persisted_W if it is not a null pointer (the file of a checkpointed run), and otherwise written to the file
+W_FILE_ENV names, which is removed at the end unless checkpoint_path is set (the checkpoints refer to it).
+Both draw the same initial H as run_symnmf does from a dense W. Exits with an error if W can't be written or memory allocation fails.
+*/
+double** run_symnmf_without_dense_W(double** points, int n, int d, int k, unsigned long seed, int strategy, const char* persisted_W)
+{
+    int rows = 0, cols = 0;
+    double mean = -1;
+    const char* filename = (persisted_W != NULL) ? persisted_W : getenv(W_FILE_ENV);
+    double** H;
+    FILE* fp = NULL;
+    w_source src;
+    if (filename == NULL || filename[0] == '\0')
+        filename = DEFAULT_W_FILE;
+    if (strategy == STRATEGY_OUT_OF_CORE)
+    {
+        if (persisted_W != NULL || normalized_similarity_to_file(points, n, d, filename) == 0)
+            fp = open_matrix_file(filename, &rows, &cols, NULL, &mean, NULL);
+        if (fp != NULL)
+            fclose(fp);
+        H = (fp == NULL || rows != n || cols != n) ? NULL : init_H_from_mean(mean, n, k, seed);
+        if (H == NULL)
+            free_mat_and_exit(points, n);
+        H = optimizing_H_out_of_core(H, n, k, filename);
+        if (persisted_W == NULL && checkpoint_path == NULL)
+            remove(filename);
+        if (H == NULL)
+            free_mat_and_exit(points, n);
+        return H;
+    }
+    init_w_source(&src);
+    src.points = points; src.d = d;
+    src.scales = point_scales(points, n, d);
+    src.D_neg_half = (src.scales == NULL) ? NULL : matrix_free_inv_sqrt_degrees(points, n, d, src.scales);
+    if (src.D_neg_half != NULL)
+        mean = matrix_free_mean(points, n, d, src.scales, src.D_neg_half);
+    H = (mean < 0) ? NULL : init_H_from_mean(mean, n, k, seed);
+    if (H == NULL)
+    {
+        free(src.D_neg_half);
+        free(src.scales);
+        free_mat_and_exit(points, n);
+    }
+    H = optimizing_H_from_source(H, n, k, &src);
+    free(src.D_neg_half);
+    free(src.scales);
+    if (H == NULL)
+        free_mat_and_exit(points, n);
+    return H;
+}
+
+/*
+Receives a String for which algorithm to run, a temporary matrix pointer A, a n*d matrix representing points and its dimensions, and returns the algorithm's result matrix.
+*/
+double** run_selected_algorithm(const char* goal, double** A, double** points, int n, int d) {
+    double** result = NULL;
+
+    if (strcmp(goal, "sym") == 0) { /* Goal: calculate similarity matrix */
         result = similarity_matrix(points, n, d); 
         if (result == NULL) {
             free_mat_and_exit(points, n);
@@ -460,40 +2585,192 @@ double** run_selected_algorithm(const char* goal, double** A, double** points, i
             free_mat_and_exit(points, n);
         }
     } else if (strcmp(goal, "norm") == 0) { /* Goal: calculate normalized similarity matrix */
-        A = similarity_matrix(points, n, d);
-        if (A == NULL) { /* Couldn't allocate space for A */
-            free_mat_and_exit(points, n);
-        }
-        result = normalized_similarity_matrix(A, n);
-        free_matrix(A, n);
+        result = normalized_similarity_from_points(points, n, d); /* Only one n*n buffer - A is normalized in place */
         if (result == NULL) {
             free_mat_and_exit(points, n);
-        } 
+        }
     } else { /* Invalid goal */
         free_mat_and_exit(points, n);
     }
     return result;
 }
 
+/*
+Writes row i of A (or of W, if D_neg_half, the diagonal of D^(-1/2), is given) into row, recomputing it from the points and their kernel widths.
+The cells are the ones similarity_matrix and normalized_similarity_from_points compute, in the same order of operations.
+*/
+void similarity_row(double** datapoints, int n, int d, double* scales, double* D_neg_half, int i, double* row)
+{
+    int p;
+    for (p = 0; p < n; p++)
+    {
+        row[p] = (p == i) ? 0.0 : similarity(squared_euclidean_dist(datapoints[i], datapoints[p], d), scales[i], scales[p]);
+        if (D_neg_half != NULL && p != i)
+            row[p] = (D_neg_half[i] * row[p]) * D_neg_half[p];
+    }
+}
+
+/*
+Prints the result of goal sym or norm as it is computed, without ever storing the n*n matrix: blocks of rows are recomputed from the points,
+formatted in parallel, and written out by one thread while the rest of the team already computes the next block (double buffering).
+Every row is computed whole, so a distance is computed twice instead of once - the formatting costs far more.
+Returns 0 once everything is printed, and 1 if memory allocation failed (before anything was printed).
+*/
+int stream_selected_algorithm(const char* goal, double** points, int n, int d)
+{
+    int b, i, r, first, last, slot, blocks, block_rows = (int)(STREAM_TEXT_BYTES / ((size_t)n * 8 + 1));
+    size_t row_text = (size_t)n * 8 + 1; /* Room for "0.0000," per cell - every cell of A and W is in [0, 1] */
+    int *lengths[2] = {NULL, NULL};
+    char *text[2] = {NULL, NULL}, *fallback = NULL;
+    double **values[2] = {NULL, NULL}, *D_neg_half = NULL, *scales = point_scales(points, n, d);
+    if (block_rows < 1)
+        block_rows = 1;
+    if (block_rows > n)
+        block_rows = n;
+    blocks = (n + block_rows - 1) / block_rows;
+    if (scales != NULL && strcmp(goal, "norm") == 0)
+        D_neg_half = matrix_free_inv_sqrt_degrees(points, n, d, scales);
+    for (slot = 0; slot < 2; slot++)
+    {
+        values[slot] = alloc_matrix(block_rows, n);
+        text[slot] = (char*)malloc(block_rows * row_text);
+        lengths[slot] = (int*)malloc(block_rows * sizeof(int));
+    }
+    fallback = (char*)malloc(WRITE_BUFFER);
+    if (scales == NULL || (D_neg_half == NULL && strcmp(goal, "norm") == 0) || fallback == NULL ||
+        values[0] == NULL || values[1] == NULL || text[0] == NULL || text[1] == NULL || lengths[0] == NULL || lengths[1] == NULL)
+    {
+        for (slot = 0; slot < 2; slot++)
+        {
+            free_matrix(values[slot], block_rows);
+            free(text[slot]);
+            free(lengths[slot]);
+        }
+        free(fallback);
+        free(scales);
+        free(D_neg_half);
+        return 1;
+    }
+    #pragma omp parallel private(b, i, r, first, last, slot)
+    for (b = 0; b <= blocks; b++)
+    {
+        #pragma omp single nowait
+        if (b > 0) /* Write the previous block, while the other threads start on this one */
+        {
+            slot = (b - 1) % 2;
+            last = (b * block_rows < n) ? b * block_rows : n;
+            for (r = 0; r < last - (b - 1) * block_rows; r++)
+            {
+                if (lengths[slot][r] >= 0)
+                    fwrite(text[slot] + r * row_text, 1, lengths[slot][r], stdout);
+                else /* A cell too long for its slot (e.g. NaN from broken input) */
+                    write_row(stdout, values[slot][r], n, fallback, WRITE_BUFFER);
+            }
+        }
+        if (b < blocks)
+        {
+            slot = b % 2;
+            first = b * block_rows;
+            last = (first + block_rows < n) ? first + block_rows : n;
+            #pragma omp for schedule(dynamic)
+            for (i = first; i < last; i++)
+            {
+                similarity_row(points, n, d, scales, D_neg_half, i, values[slot][i - first]);
+                lengths[slot][i - first] = format_row(values[slot][i - first], n, text[slot] + (i - first) * row_text, row_text);
+            }
+        }
+    }
+    for (slot = 0; slot < 2; slot++)
+    {
+        free_matrix(values[slot], block_rows);
+        free(text[slot]);
+        free(lengths[slot]);
+    }
+    free(fallback);
+    free(scales);
+    free(D_neg_half);
+    return 0;
+}
+
+#endif /* SYMNMF_CLI */
 
+#ifndef SYMNMF_LIBRARY
 /*
-CMD args: argv[1] - goal (sym, ddg, or norm), argv[2] - file path
+CMD args: [flags] goal file, where goal is sym, ddg, norm or symnmf, and symnmf is followed by k and optionally the seed of the initial H.
+The optional flags preprocess the points first (See parse_preprocess_flags): --standardize, --pca P, and for symnmf only --dedup
+(the duplicates get the row of H of the point they duplicate, so there is still a row for every point).
 */
 int main(int argc, char *argv[]) {
     double **points;
     double **A = NULL;
-    double **result = NULL;
-    int n, d;
-    char *goal, *filename;
-    if (argc != 3) { exit_with_error(); } /* Check for correct num of CMD args */
+    double **result = NULL, **expanded;
+    int n, n_read, d, k = 0, cols, flags;
+    int *representative = NULL;
+    unsigned long seed = RANDOM_SEED;
+    double budget = 0.0;
+    char *goal, *filename, *end;
+    preprocess_options options;
+    if (argc >= 3 && strcmp(argv[1], "batch") == 0) { /* ./symnmf batch MANIFEST [parallel_jobs] (See run_batch) */
+        k = (argc == 4) ? (int)strtol(argv[3], &end, 10) : 0;
+        if (argc > 4 || (argc == 4 && (*end != '\0' || k < 1))) { exit_with_error(); }
+        read_env_modes();
+        flags = run_batch(argv[2], k, stdout);
+        if (flags < 0) { exit_with_error(); }
+        return flags > 0;
+    }
+    flags = parse_budget_flag(argc - 1, argv + 1, &budget);
+    if (flags < 0) { exit_with_error(); }
+    argc -= flags; argv += flags;
+    flags = parse_preprocess_flags(argc - 1, argv + 1, &options);
+    if (flags < 0) { exit_with_error(); }
+    argc -= flags; argv += flags; /* The rest is read as if there were no flags */
+    options.seed = RANDOM_SEED;
+    if (argc < 3) { exit_with_error(); } /* Check for correct num of CMD args */
+    read_env_modes();
+    if (budget > 0) { memory_budget = budget; } /* The flag overrides the environment */
     goal = argv[1];
     filename = argv[2];
+    if (strcmp(goal, "symnmf") == 0) {
+        if (argc != 4 && argc != 5) { exit_with_error(); }
+        k = (int)strtol(argv[3], &end, 10);
+        if (*end != '\0') { exit_with_error(); }
+        if (argc == 5) {
+            seed = strtoul(argv[4], &end, 10);
+            if (*end != '\0') { exit_with_error(); }
+        }
+    } else if (argc != 3 || options.dedup) { exit_with_error(); }
     points = read_data(filename, &n, &d); /* Read data points from input file */
-    result = run_selected_algorithm(goal, A, points, n, d); /* Get the result matrix */
-    print_matrix(result, n, n); /* Print the result matrix */
+    n_read = n;
+    if (preprocess_points(&points, &n, &d, &options, &representative) == 1) {
+        free(representative);
+        free_mat_and_exit(points, n);
+    }
+    if (strcmp(goal, "symnmf") == 0) {
+        result = run_symnmf(points, n, d, k, seed); /* The whole pipeline, without going through Python */
+        cols = k;
+    } else if (strcmp(goal, "sym") == 0 || strcmp(goal, "norm") == 0) { /* Printed as it is computed, never stored */
+        if (stream_selected_algorithm(goal, points, n, d) == 1) { free_mat_and_exit(points, n); }
+        free_matrix(points, n);
+        return 0;
+    } else {
+        result = run_selected_algorithm(goal, A, points, n, d); /* Get the result matrix */
+        cols = n;
+    }
+    if (representative != NULL) { /* Back to a row for every point that was read */
+        expanded = expand_rows(result, cols, representative, n_read);
+        free_matrix(result, n);
+        free(representative);
+        if (expanded == NULL) { free_mat_and_exit(points, n); }
+        free_matrix(points, n);
+        points = NULL;
+        result = expanded;
+        n = n_read;
+    }
+    print_matrix(result, n, cols); /* Print the result matrix */
     free_matrix(points, n);
     free_matrix(result, n);
     if (strcmp(goal, "sym") != 0) { free_matrix(A, n); } /* Only free A if it was actually allocated */
 
     return 0;
-}
\ No newline at end of file
+}
+#endif /* SYMNMF_LIBRARY */
@@ -5,28 +5,179 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
-#include "symnmf.c"
+
+#define max_iter 300
+#define eps 1e-4
+#define denominator_eps 1e-7
+#define RANDOM_SEED 1234 /* Default seed for the initial H, same as symnmf.py */
+#define MAX_LINE_LENGTH 65536 /* Enough for a few thousand coordinates (e.g. embeddings) per point */
+#define MAX_PATH_LENGTH 4096 /* Longest path of a checkpoint or a persisted W */
+#define TEMP_SUFFIX ".tmp" /* Files are written under this suffix first, and renamed into place once complete */
+#define MAX_LOCAL_SCALING_NEIGHBOR 64 /* Largest m of local scaling */
+#define MAX_CELL_TEXT 320 /* Longest "%.4f" text of a double (the largest ones have 309 digits before the point) */
+#define REDUCTION_BLOCK 256 /* Rows summed together in reproducible mode - fixed, so the summation order never depends on the threads */
+#define TILE_SIZE 64 /* Rows/columns of W handled together when W is recomputed on the fly, or skipped when sparse (See sparse_tile_threshold) */
+#define PANEL_BYTES (8 * 1024 * 1024) /* Approximate size of one row panel of a W file */
+#define COARSE_ROWS 2048 /* Larger graphs are coarsened straight to this many landmarks instead of by matching */
+
+/*
+Called after every iteration on W itself with the context it was given, the iteration number, the squared change of H in it (delta)
+and the objective ||W - HH^T||^2 of the H the iteration started from (NaN if it couldn't be computed). In place (See in_place_updates),
+the products come from a partially updated H, so the objective is only an estimate. Returning non-zero stops the optimization after this iteration.
+*/
+typedef int (*iteration_hook)(void* context, int iteration, double delta, double objective);
+
+/*
+Where the optimization takes the products WH from. Exactly one of the following is used:
+If W is not NULL it is a dense n*n matrix in memory.
+Else if W_file is not NULL, W lives on disk in the binary matrix format and is streamed through panel (panel_rows*n) by panel.
+Otherwise W is never stored (matrix-free) and its cells are recomputed from the n*d points, their kernel widths (scales, See point_scales)
+and the diagonal of D^(-1/2) whenever they are needed.
+A dense W may also have an index of its non-empty TILE_SIZE*TILE_SIZE tiles, and the products then skip the empty ones (See build_tile_index).
+*/
+typedef struct {
+    double** W;
+    FILE* W_file;
+    int panel_rows;
+    double** panel;
+    double** points;
+    int d;
+    double* D_neg_half;
+    double* scales;
+    const char* W_path; /* The file W is persisted in, if any - recorded in checkpoints (See write_checkpoint) */
+    iteration_hook on_iteration; /* If not a null pointer, called with hook_context after every iteration */
+    void* hook_context;
+    double* row_traces; /* While there is a hook - every row's dot product of H and WH, and (H^T)H's squared norm, for the objective */
+    double gram_sq_norm;
+    int* tile_offsets; /* If not a null pointer (dense W only), the non-empty tiles of tile row t are tile_columns[tile_offsets[t]..tile_offsets[t+1]-1] */
+    int* tile_columns;
+} w_source;
+
+/*
+The kernels that work on a single row of the n*k matrices, so the loops over k can be compiled for a fixed k.
+w_times_row writes the row of WH of a row of W, and update_row turns a row of WH into the updated row of H, returning its squared change.
+tiled_w_times_row is w_times_row that only sums over the count tiles of columns listed in tiles (See build_tile_index).
+*/
+typedef struct {
+    void (*w_times_row)(double* W_row, double** H, double* WH_row, int n, int k);
+    double (*update_row)(double* H_row, double** HtH, double* WH_new_row, int k);
+    void (*tiled_w_times_row)(double* W_row, double** H, double* WH_row, int n, int k, const int* tiles, int count);
+} row_kernels;
+
+/* Declares the row kernels of a fixed k, which DEFINE_FIXED_K_KERNELS defines. */
+#define DECLARE_FIXED_K_KERNELS(K) \
+void w_times_row_k##K(double* W_row, double** H, double* WH_row, int n, int k); \
+double update_row_k##K(double* H_row, double** HtH, double* WH_new_row, int k); \
+void tiled_w_times_row_k##K(double* W_row, double** H, double* WH_row, int n, int k, const int* tiles, int count);
+
+/* The modes read from the environment by read_env_modes (See their definitions in symnmf.c) */
+extern int reproducible_reductions;
+extern int in_place_updates;
+extern int fixed_k_kernels;
+extern int multilevel_solver;
+extern int distributed_workers;
+extern double kernel_sigma;
+extern int local_scaling_neighbor;
+extern const char* checkpoint_path;
+extern int checkpoint_interval;
+extern unsigned long checkpoint_fingerprint;
+extern int label_stop_window;
+extern double label_stop_tolerance;
+extern int parallel_first_touch;
+extern double memory_budget;
+extern double sparse_tile_threshold;
 
 /* Function declarations */
 double squared_euclidean_dist(double* point1, double* point2, int dimension);
-double** get_column(double** M, int rows_num, int j);
+double similarity(double sq_dist, double scale_i, double scale_j);
+void keep_nearest(double* nearest, int* count, int m, double sq_dist);
+double local_scale(double* nearest, int count);
+double* point_scales(double** datapoints, int n, int d);
 double** optimizing_H(double** H, int rows_num, int cols_num, double** W);
+double** optimizing_H_matrix_free(double** H, int n, int k, double** datapoints, int d);
+double** optimizing_H_out_of_core(double** H, int n, int k, const char* filename);
+double** run_symnmf(double** points, int n, int d, int k, unsigned long seed);
+double** run_symnmf_without_dense_W(double** points, int n, int d, int k, unsigned long seed, int strategy, const char* persisted_W);
 int update_H(double** W, double** H, double** new_H, int n, int k);
 double** similarity_matrix(double** datapoints, int n, int d);
+double** locally_scaled_similarity_matrix(double** A, double** datapoints, int n, int d);
+void mirror_upper_triangle(double** A, int n);
 double** diagonal_degree_matrix(double** A, int n);
 double** normalized_similarity_matrix(double** sim_matrix, int n);
+double** normalized_similarity_from_points(double** datapoints, int n, int d);
 
 double **read_data(const char *filename, int *n, int *d);
+double **read_points(const char *filename, char line[], int *n, int *d);
 void print_matrix(double **matrix, int rows, int cols);
+int format_fixed4(double x, char* text);
+int format_row(double* row, int cols, char* text, size_t capacity);
+void write_row(FILE* out, double* row, int cols, char* text, size_t capacity);
+int stream_selected_algorithm(const char* goal, double** points, int n, int d);
+void similarity_row(double** datapoints, int n, int d, double* scales, double* D_neg_half, int i, double* row);
 
 /* Helper functions */
 double** run_selected_algorithm(const char* goal, double** A, double** points, int n, int d);
 double **create_points_matrix(FILE *fp, char line[], int *n, int *d);
 double sq_frobenius_norm(double** A, int rows_num, int cols_num, double** B);
+double* degree_vector(double** A, int n);
+double* inv_sqrt_degree_vector(double** A, int n);
+void normalize_in_place(double** A, double* D_neg_half, int n);
 void free_matrix(double** M, int len);
 double** multiply_matrix(double** matrixA, double** matrixB, int m, int n, int k);
 double matrix_mult_cell(double** A, int A_cols_num ,double** B, int i, int j);
-void update_H_cell(double **W, double **H, double **new_H, double **HtH_col, int n, int k, int i, int j);
+double** alloc_matrix(int rows, int cols);
+double** alloc_matrix_first_touch(int rows, int cols);
+double** gram_matrix(double** H, int n, int k);
+void add_gram_rows(double** H, int first, int last, int k, double** HtH);
+double ordered_sum(double* values, int count);
+void read_env_modes(void);
+void w_times_row(double* W_row, double** H, double* WH_row, int n, int k);
+double update_row(double* H_row, double** HtH, double* WH_new_row, int k);
+void tiled_w_times_row(double* W_row, double** H, double* WH_row, int n, int k, const int* tiles, int count);
+DECLARE_FIXED_K_KERNELS(2) DECLARE_FIXED_K_KERNELS(3) DECLARE_FIXED_K_KERNELS(4) DECLARE_FIXED_K_KERNELS(5)
+DECLARE_FIXED_K_KERNELS(6) DECLARE_FIXED_K_KERNELS(7) DECLARE_FIXED_K_KERNELS(8) DECLARE_FIXED_K_KERNELS(9)
+DECLARE_FIXED_K_KERNELS(10) DECLARE_FIXED_K_KERNELS(11) DECLARE_FIXED_K_KERNELS(12) DECLARE_FIXED_K_KERNELS(13)
+DECLARE_FIXED_K_KERNELS(14) DECLARE_FIXED_K_KERNELS(15) DECLARE_FIXED_K_KERNELS(16)
+const row_kernels* select_row_kernels(int k);
+void dense_w_times_H(double** W, double** H, double** WH, int first, int last, int n, int k);
+void tiled_w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k);
+int build_tile_index(w_source* src, int n, double threshold);
+void free_tile_index(w_source* src);
+void matrix_free_w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k);
+int w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k);
+void apply_update(double** H, double** HtH, double** WH_new, double* row_deltas, double* row_traces, int first, int last, int k);
+int update_H_from_source(w_source* src, double** H, double** new_H, double* row_deltas, int n, int k, double* delta);
+int update_H_in_place(w_source* src, double** H, double** block, int block_rows, double* row_deltas, int n, int k, double* delta);
+double** optimizing_H_from_source(double** H, int rows_num, int cols_num, w_source* src);
+double** optimizing_H_single_level(double** H, int rows_num, int cols_num, w_source* src, const char* checkpoint);
+double** optimizing_H_multilevel(double** H, int n, int k, w_source* src, const char* checkpoint);
+int labels_changed(double** H, int n, int k, int* labels, int* reference);
+double source_sq_norm(w_source* src, int n);
+double sq_norm(double** A, int rows, int cols);
+int w_source_rows(w_source* src, int first, int last, int n, double** buffer, double** rows);
+int landmark_aggregates(w_source* src, int n, int n_coarse, int* aggregate);
+int heavy_edge_matching(w_source* src, int n, int* sizes, int* aggregate);
+double** coarse_graph(w_source* src, int n, int* aggregate, int n_coarse);
+double** restrict_H(double** H, int n, int k, int* aggregate, int* children, int n_coarse);
+double** prolong_H(double** H_coarse, int n, int k, int* aggregate, int* children);
+double* matrix_free_inv_sqrt_degrees(double** datapoints, int n, int d, double* scales);
+double matrix_free_mean(double** datapoints, int n, int d, double* scales, double* D_neg_half);
+void init_w_source(w_source* src);
+double matrix_mean(double** M, int rows, int cols);
+unsigned long hash32(unsigned long x);
+unsigned long input_fingerprint(double** points, int n, int d, unsigned long seed);
+double uniform_draw(unsigned long seed, unsigned long index);
+double** init_H(double** W, int n, int k, unsigned long seed);
+double** init_H_from_mean(double mean, int n, int k, unsigned long seed);
+int write_matrix_header(FILE* fp, int rows, int cols, int panel_rows, double mean, unsigned long fingerprint);
+FILE* open_matrix_file(const char* filename, int* rows, int* cols, int* panel_rows, double* mean, unsigned long* fingerprint);
+int normalized_similarity_to_file(double** datapoints, int n, int d, const char* filename);
+int write_matrix_file(const char* filename, double** M, int rows, int cols);
+double** read_matrix_file(const char* filename, int* rows, int* cols);
+int write_checkpoint(const char* filename, double** H, int n, int k, int iteration, double delta, const char* W_path, unsigned long fingerprint);
+int read_checkpoint(const char* filename, double** H, int n, int k, unsigned long fingerprint, int* iteration, double* delta, char* W_path);
+int temp_file_name(const char* filename, const char* suffix, char* name);
+int out_of_core_w_times_H(w_source* src, double** H, double** WH, int first, int last, int n, int k);
 void exit_with_error();
 void free_mat_and_exit(double **mat, int n);
 
@@ -1,5 +1,6 @@
 # Python interface of your code
 import math
+import os
 import numpy as np
 import pandas as pd
 import sys
@@ -8,9 +9,18 @@ import symnmfmodule  # Import our C module
 RANDOM_SEED = 1234
 ERROR_MSG = "An Error Has Occurred"
 SEPERATOR = ','
+MODE_ENV = "SYMNMF_MODE" # "dense" (default) keeps W in memory, "out-of-core" streams it from a file, "matrix-free" recomputes it on every iteration,
+                         # "distributed" splits its rows among worker processes
+CHECKPOINT_ENV = "SYMNMF_CHECKPOINT" # A file to checkpoint symnmf into (the C side reads it too), and to resume from if it holds a checkpoint
+WORKERS_ENV = "SYMNMF_WORKERS" # How many worker processes distributed mode runs (default: one per CPU)
+W_FILE_ENV = "SYMNMF_W_FILE" # Where out-of-core mode keeps W. An existing file is reused only if it holds the W of the same points and kernel
+DEFAULT_W_FILE = "symnmf_W.bin"
+MEMORY_BUDGET_ENV = "SYMNMF_MEMORY_BUDGET" # A size like "2G" - without MODE_ENV, symnmf runs in the fastest mode whose memory fits it (the C side reads it too)
 
 def initH(n, k, W):
-    m = np.mean(W)
+    return initH_from_mean(n, k, np.mean(W))
+
+def initH_from_mean(n, k, m):
     H_init = np.random.uniform(0, 2 * np.sqrt(m/k), size=(n, k))
     return H_init
     # m = np.average(W)
@@ -18,6 +28,32 @@ def initH(n, k, W):
     # basel = np.random.uniform(0, np.nextafter(high, high+1), (n, k))
     # return basel
 
+def resumable_W(n, k):
+    '''
+    Returns the file W was persisted in by the checkpoint in CHECKPOINT_ENV, if there is a checkpoint of an n*k H there, and None otherwise.
+    '''
+    checkpoint = os.environ.get(CHECKPOINT_ENV)
+    info = symnmfmodule.checkpoint_info(checkpoint, n, k) if checkpoint else None
+    if info is None or info[2] is None or not os.path.exists(info[2]):
+        return None
+    return info[2]
+
+def planned_mode(n, d, k):
+    '''
+    Returns the mode the planner picks for MEMORY_BUDGET_ENV, after reporting its estimates on stderr. Exits with an error if no mode fits.
+    '''
+    mode, estimates = symnmfmodule.plan(n, d, k)
+    print(f"plan: n={n} d={d} k={k}, memory budget {os.environ.get(MEMORY_BUDGET_ENV)}", file=sys.stderr)
+    for name, memory, disk, seconds, fits in estimates:
+        print(f"plan:   {name:<12} memory {memory / 2**20:10.1f} MiB  disk {disk / 2**20:10.1f} MiB  time {seconds:10.1f} s"
+              + ("" if fits else "  (does not fit)"), file=sys.stderr)
+    if mode is None:
+        print("plan: no mode fits the budget", file=sys.stderr)
+        print(ERROR_MSG)
+        sys.exit(1)
+    print(f"plan: running {mode}", file=sys.stderr)
+    return mode
+
 def check_validity(goal, k, data_points):
     '''
     Checks the validity of the goal and k inputs. If one is invalid, prints error and terminates program.
@@ -51,6 +87,11 @@ def main():
         print(ERROR_MSG)
         sys.exit(1)
     check_validity(goal, k, data_points)
+    mode = os.environ.get(MODE_ENV)
+    if goal == "symnmf" and os.environ.get(CHECKPOINT_ENV): # Only a checkpoint of these very points is resumed from
+        symnmfmodule.checkpoint_input(data_points.tolist(), RANDOM_SEED)
+    if goal == "symnmf" and mode is None and os.environ.get(MEMORY_BUDGET_ENV): # Decided before W (or anything of size n^2) exists
+        mode = planned_mode(len(data_points), data_points.shape[1] if data_points.ndim > 1 else 1, k)
     try: # Call fitting function according to goal
         if goal == "sym":
             result = symnmfmodule.sym(data_points.tolist())
@@ -58,11 +99,30 @@ def main():
             result = symnmfmodule.ddg(data_points.tolist())
         elif goal == "norm":
             result = symnmfmodule.norm(data_points.tolist())
-        elif goal == "symnmf": # For symnmf, first of all get the normalized similarity matrix W
-            W = symnmfmodule.norm(data_points.tolist())
+        elif goal == "symnmf" and resumable_W(len(data_points), k) is not None: # Resume with the W the checkpointed run persisted
+            n = len(data_points)
+            w_file = resumable_W(n, k)
+            H_init = initH_from_mean(n, k, symnmfmodule.norm_file_info(w_file)[1]).tolist() # Replaced by the checkpoint's H
+            result = symnmfmodule.symnmf_file(w_file, H_init)
+        elif goal == "symnmf" and mode == "matrix-free": # W is never built, only its mean
+            n = len(data_points)
+            H_init = initH_from_mean(n, k, symnmfmodule.norm_mean(data_points.tolist())).tolist()
+            result = symnmfmodule.symnmf_matrix_free(data_points.tolist(), H_init)
+        elif goal == "symnmf" and mode == "distributed": # Every worker builds and keeps only its rows of W
+            n = len(data_points)
+            workers = int(os.environ.get(WORKERS_ENV, os.cpu_count() or 1))
+            H_init = initH_from_mean(n, k, symnmfmodule.norm_mean(data_points.tolist())).tolist()
+            result = symnmfmodule.symnmf_distributed(data_points.tolist(), H_init, workers)
+        elif goal == "symnmf" and mode == "out-of-core": # W is written to disk once and streamed on every iteration
+            n = len(data_points)
+            w_file = os.environ.get(W_FILE_ENV, DEFAULT_W_FILE)
+            if not symnmfmodule.norm_file_matches(data_points.tolist(), w_file): # Rebuilt for other points or another kernel
+                symnmfmodule.norm_to_file(data_points.tolist(), w_file)
+            H_init = initH_from_mean(n, k, symnmfmodule.norm_file_info(w_file)[1]).tolist()
+            result = symnmfmodule.symnmf_file(w_file, H_init)
+        elif goal == "symnmf": # W is built and optimized on in C, only its mean comes back here to draw the initial H
             n = len(data_points)
-            H_init = initH(n, k, W).tolist()
-            result = symnmfmodule.symnmf(W, H_init)
+            result = symnmfmodule.symnmf_points(data_points.tolist(), lambda m: initH_from_mean(n, k, m).tolist())
     except Exception as e:
         print(f"{ERROR_MSG}: {e}")
         sys.exit(1)
@@ -6,32 +6,84 @@ symnmf,sym,ddg,norm for Python
 
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <pthread.h>
+#include <omp.h>
 #include "symnmf.h"
+#include "clustering.h"
+#include "distributed.h"
+#include "preprocess.h"
+#include "planner.h"
 
 #define ERR_LIST_FORMAT "Expected a list of lists of floats"
 #define ERR_LIST_ITEM_FORMAT "List items must be floats"
-#define ERR_SYMNMF_FORMAT "Input must be two matrixes"
+#define ERR_SYMNMF_FORMAT "Input must be two matrixes, and optionally 1 <= top_m <= k"
+#define ERR_SYMNMF_POINTS_FORMAT "Input must be a matrix of datapoints and a callable returning the initial H given mean(W)"
+#define ERR_SHAPE_FORMAT "Every row of a matrix must have the same non-zero length, and H a row for every datapoint"
+#define ERR_W_FILE_SHAPE "The W file must hold an n*n matrix for the n rows of H"
+#define ERR_MATRIX_FILE "Not a binary matrix file: '%s'"
+#define ERR_KMEANS_FORMAT "Input must be a matrix and a number of clusters 1 < k < n"
+#define ERR_SILHOUETTE_FORMAT "Input must be n datapoints, n labels in 0..k-1 with at least 2 clusters, and optionally the n*n similarity matrix"
+#define ERR_KERNEL_FORMAT "Input must be sigma > 0, and optionally 0 <= m <= 64"
+#define ERR_PREPROCESS_FORMAT "Input must be a matrix, and optionally dedup, standardize and the amount of components p >= 0"
+#define ERR_CHECKPOINT_FORMAT "Input must be a file path (or None), and optionally the iterations between checkpoints >= 1"
+#define ERR_CHECKPOINT_INPUT_FORMAT "Input must be a matrix of datapoints, and optionally the seed of the initial H"
+#define ERR_ASYNC_FORMAT "Input must be the matrices of the synchronous call, and optionally a callable for progress"
+#define ERR_POOL_FORMAT "Input must be 1 <= threads <= 256, and optionally threads_per_job >= 1"
+#define ERR_PLAN_FORMAT "Input must be n, d and k with 1 <= k < n and d >= 1, and optionally the memory budget in bytes or as a size like \"2G\""
+#define ERR_POOL_STOPPED "The thread pool was shut down"
+#define ERR_KERNEL_BUSY "The kernel can't change while async jobs are queued or running"
+#define MAX_POOL_THREADS 256
+#define ASYNC_NORM 0
+#define ASYNC_SYMNMF 1
+#define KMEANS_DEFAULT_ITER 300
+#define KMEANS_EPSILON 0.0001
 
 /* Function declarations - for module use only */
 static PyObject* symnmf(PyObject* self, PyObject* args);
 static PyObject* sym(PyObject* self, PyObject* args);
 static PyObject* ddg(PyObject* self, PyObject* args);
 static PyObject* norm(PyObject* self, PyObject* args);
+static PyObject* norm_mean(PyObject* self, PyObject* args);
+static PyObject* set_kernel(PyObject* self, PyObject* args);
+static PyObject* plan(PyObject* self, PyObject* args);
+static PyObject* preprocess(PyObject* self, PyObject* args);
+static PyObject* set_checkpoint(PyObject* self, PyObject* args);
+static PyObject* checkpoint_info(PyObject* self, PyObject* args);
+static PyObject* checkpoint_input(PyObject* self, PyObject* args);
+static PyObject* symnmf_matrix_free(PyObject* self, PyObject* args);
+static PyObject* symnmf_distributed(PyObject* self, PyObject* args);
+static PyObject* norm_to_file(PyObject* self, PyObject* args);
+static PyObject* norm_file_info(PyObject* self, PyObject* args);
+static PyObject* norm_file_matches(PyObject* self, PyObject* args);
+static PyObject* symnmf_file(PyObject* self, PyObject* args);
+static PyObject* kmeans_labels(PyObject* self, PyObject* args);
+static PyObject* silhouette_score(PyObject* self, PyObject* args);
+static PyObject* norm_async(PyObject* self, PyObject* args);
+static PyObject* symnmf_async(PyObject* self, PyObject* args);
+static PyObject* set_pool(PyObject* self, PyObject* args);
+static PyObject* shutdown_pool(PyObject* self, PyObject* unused);
+static int set_kernel_if_idle(double sigma, int m);
 double** getDataPoints(PyObject* lst);
+Py_ssize_t checkMatrixShape(PyObject* lst, Py_ssize_t rows);
+PyObject* matrixFileError(const char* filename);
+double** getSquareMatrix(PyObject* lst);
 void freeDataPoints(double** dataPoints, int n);
 PyObject* MatrixToPyList(double** matrix, int n, int m);
+PyObject* LabelsToPyList(int* labels, int n);
+int* getLabels(PyObject* lst, int n, int* k);
+PyObject* MembershipsToPy(double** H, int n, int k, int top_m);
 
 /*
-Input: Matrices W and H
-Output: Final H
+Input: Matrices W and H, and optionally top_m
+Output: Final H, or if top_m is given (labels, top_m memberships, confidences) - see MembershipsToPy
 Given a starting matrix H and a graph laplacian W, perform the optimization algorithm in the instructions.
 Stages 1.4 and 1.5 in the instructions.
 */
 static PyObject* symnmf(PyObject* self, PyObject* args) {
     PyObject *lstH, *lstW, *ret;
     double** H, **W;
-    int n, k;
-    if(!PyArg_ParseTuple(args, "OO", &lstW, &lstH)) {
+    int n, k, top_m = 0;
+    if(!PyArg_ParseTuple(args, "OO|i", &lstW, &lstH, &top_m)) {
         PyErr_SetString(PyExc_TypeError, ERR_SYMNMF_FORMAT);
         Py_RETURN_NONE;
     }
@@ -40,15 +92,72 @@ static PyObject* symnmf(PyObject* self, PyObject* args) {
         Py_RETURN_NONE;
     }
     H = getDataPoints(lstH);
-    W = getDataPoints(lstW);
+    W = getSquareMatrix(lstW);
     if(H == NULL || W == NULL) {
         PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
         Py_RETURN_NONE;
     }
     n = PyList_Size(lstH);
     k = PyList_Size(PyList_GetItem(lstH, 0));
+    if (top_m < 0 || top_m > k) {
+        freeDataPoints(H, n);
+        freeDataPoints(W, n);
+        PyErr_SetString(PyExc_ValueError, ERR_SYMNMF_FORMAT);
+        return NULL;
+    }
     H = optimizing_H(H, n, k, W); 
     freeDataPoints(W, n);
+    if (H == NULL)
+        return PyErr_NoMemory();
+    ret = (top_m > 0) ? MembershipsToPy(H, n, k, top_m) : MatrixToPyList(H, n, k);
+    freeDataPoints(H, n);
+    return ret;
+}
+
+/*
+Input: Datapoints and a callable that draws the initial H given mean(W)
+Output: Final H
+Same as norm followed by symnmf, but W is built from the datapoints and optimized on right here, so it only ever exists as one n*n C matrix -
+never as a Python list, nor as a second C copy of one. Only its mean goes back to Python, for init_H to draw the n*k initial H with (See 1.4.1).
+*/
+static PyObject* symnmf_points(PyObject* self, PyObject* args) {
+    PyObject *lstX, *init, *lstH, *ret;
+    double **X, **W, **H = NULL;
+    int n, k = 0;
+    if(!PyArg_ParseTuple(args, "OO", &lstX, &init) || !PyList_Check(lstX) || !PyCallable_Check(init)) {
+        PyErr_SetString(PyExc_TypeError, ERR_SYMNMF_POINTS_FORMAT);
+        return NULL;
+    }
+    X = getDataPoints(lstX);
+    if(X == NULL) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    n = PyList_Size(lstX);
+    W = normalized_similarity_from_points(X, n, PyList_Size(PyList_GetItem(lstX, 0)));
+    freeDataPoints(X, n);
+    if(W == NULL)
+        return PyErr_NoMemory();
+    lstH = PyObject_CallFunction(init, "d", matrix_mean(W, n, n));
+    if(lstH != NULL && PyList_Check(lstH) && PyList_Size(lstH) == n) {
+        H = getDataPoints(lstH);
+        k = PyList_Size(PyList_GetItem(lstH, 0));
+    }
+    Py_XDECREF(lstH);
+    if(H != NULL && k < 1) {
+        freeDataPoints(H, n);
+        H = NULL;
+    }
+    if(H == NULL) {
+        free_matrix(W, n);
+        if(!PyErr_Occurred())
+            PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    H = optimizing_H(H, n, k, W);
+    free_matrix(W, n);
+    if (H == NULL)
+        return PyErr_NoMemory();
     ret = MatrixToPyList(H, n, k);
     freeDataPoints(H, n);
     return ret;
@@ -107,9 +216,11 @@ static PyObject* ddg(PyObject* self, PyObject* args) {
         Py_RETURN_NONE;
     }
     A = similarity_matrix(dataPoints, PyList_Size(lst), PyList_Size(PyList_GetItem(lst, 0)));
-    D = diagonal_degree_matrix(A, PyList_Size(lst));
+    D = (A == NULL) ? NULL : diagonal_degree_matrix(A, PyList_Size(lst));
     freeDataPoints(dataPoints, PyList_Size(lst));
     free_matrix(A, PyList_Size(lst));
+    if(D == NULL)
+        return PyErr_NoMemory();
     ret = MatrixToPyList(D, PyList_Size(lst), PyList_Size(lst));
     free_matrix(D, PyList_Size(lst));
     return ret;
@@ -123,7 +234,7 @@ Stage 1.3 in the instructions.
 */
 static PyObject* norm(PyObject* self, PyObject* args) {
     PyObject* lst, *ret;
-    double** dataPoints, **A, **normalized;
+    double** dataPoints, **normalized;
     if(!PyArg_ParseTuple(args, "O", &lst)) {
         PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
         Py_RETURN_NONE;
@@ -137,21 +248,900 @@ static PyObject* norm(PyObject* self, PyObject* args) {
         PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
         Py_RETURN_NONE;
     }
-    A = similarity_matrix(dataPoints, PyList_Size(lst), PyList_Size(PyList_GetItem(lst, 0)));
-    normalized = normalized_similarity_matrix(A, PyList_Size(lst));
+    normalized = normalized_similarity_from_points(dataPoints, PyList_Size(lst), PyList_Size(PyList_GetItem(lst, 0)));
     freeDataPoints(dataPoints, PyList_Size(lst));
-    free_matrix(A, PyList_Size(lst));
+    if(normalized == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
     ret = MatrixToPyList(normalized, PyList_Size(lst), PyList_Size(lst));
 
     free_matrix(normalized, PyList_Size(lst));
     return ret;
 }
 
+/*
+Input: Datapoints Py List
+Output: The mean of all cells of the normalized similarity matrix
+Calculates mean(W) (needed to initialize H, see 1.4.1) without building W.
+*/
+static PyObject* norm_mean(PyObject* self, PyObject* args) {
+    PyObject* lst;
+    double** dataPoints, *D_neg_half = NULL, *scales;
+    double m;
+    int n, d;
+    if(!PyArg_ParseTuple(args, "O", &lst)) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        Py_RETURN_NONE;
+    }
+    if (!PyList_Check(lst)) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        Py_RETURN_NONE;
+    }
+    dataPoints = getDataPoints(lst);
+    if(dataPoints == NULL) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        Py_RETURN_NONE;
+    }
+    n = PyList_Size(lst);
+    d = PyList_Size(PyList_GetItem(lst, 0));
+    scales = point_scales(dataPoints, n, d);
+    if(scales != NULL)
+        D_neg_half = matrix_free_inv_sqrt_degrees(dataPoints, n, d, scales);
+    if(D_neg_half == NULL) {
+        free(scales);
+        freeDataPoints(dataPoints, n);
+        return PyErr_NoMemory();
+    }
+    m = matrix_free_mean(dataPoints, n, d, scales, D_neg_half);
+    free(D_neg_half);
+    free(scales);
+    freeDataPoints(dataPoints, n);
+    if(m < 0)
+        return PyErr_NoMemory();
+    return PyFloat_FromDouble(m);
+}
+
+/*
+Input: The kernel width sigma, and optionally m
+Output: None
+Sets the similarity kernel every later call uses (See kernel_sigma): exp(-d^2 / (2 * sigma^2)),
+or with m > 0 local scaling, where every point's width is the distance to its m-th nearest neighbour (See local_scaling_neighbor).
+Raises RuntimeError while the pool has jobs queued or running (See pool_jobs), since they read the kernel without the GIL.
+*/
+static PyObject* set_kernel(PyObject* self, PyObject* args) {
+    double sigma;
+    int m = 0;
+    if(!PyArg_ParseTuple(args, "d|i", &sigma, &m)) {
+        PyErr_SetString(PyExc_TypeError, ERR_KERNEL_FORMAT);
+        return NULL;
+    }
+    if(sigma <= 0 || m < 0 || m > MAX_LOCAL_SCALING_NEIGHBOR) {
+        PyErr_SetString(PyExc_ValueError, ERR_KERNEL_FORMAT);
+        return NULL;
+    }
+    if (set_kernel_if_idle(sigma, m) == 1) {
+        PyErr_SetString(PyExc_RuntimeError, ERR_KERNEL_BUSY);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/*
+Input: n, d and k, and optionally the memory budget (bytes, or a size like "2G" - See parse_memory_size). By default, SYMNMF_MEMORY_BUDGET's.
+Output: (strategy, estimates) - the mode (as SYMNMF_MODE names it) the planner picks, or None if none fits,
+and for every mode a tuple (mode, peak memory bytes, disk bytes, seconds, fits). Nothing is allocated or run.
+The estimates are of symnmf.py's flow, where the points and H go through Python lists but W is built in C in every mode (See plan_symnmf).
+*/
+static PyObject* plan(PyObject* self, PyObject* args) {
+    int n, d, k, s, chosen;
+    double budget = memory_budget;
+    PyObject *budget_obj = Py_None, *estimates_list, *item;
+    plan_estimate estimates[STRATEGIES];
+    if(!PyArg_ParseTuple(args, "iii|O", &n, &d, &k, &budget_obj)) {
+        PyErr_SetString(PyExc_TypeError, ERR_PLAN_FORMAT);
+        return NULL;
+    }
+    if (PyUnicode_Check(budget_obj))
+        budget = parse_memory_size(PyUnicode_AsUTF8(budget_obj));
+    else if (budget_obj != Py_None)
+        budget = PyFloat_AsDouble(budget_obj);
+    if (PyErr_Occurred() || k < 1 || k >= n || d < 1 || (budget_obj != Py_None && budget <= 0)) {
+        PyErr_Clear();
+        PyErr_SetString(PyExc_ValueError, ERR_PLAN_FORMAT);
+        return NULL;
+    }
+    chosen = plan_symnmf(n, d, k, budget, 1, estimates);
+    estimates_list = PyList_New(STRATEGIES);
+    if (estimates_list == NULL)
+        return NULL;
+    for (s = 0; s < STRATEGIES; s++) {
+        item = Py_BuildValue("(sdddO)", estimates[s].name, estimates[s].memory, estimates[s].disk, estimates[s].seconds,
+                             estimates[s].fits ? Py_True : Py_False);
+        if (item == NULL) {
+            Py_DECREF(estimates_list);
+            return NULL;
+        }
+        PyList_SET_ITEM(estimates_list, s, item);
+    }
+    if (chosen < 0)
+        return Py_BuildValue("(ON)", Py_None, estimates_list);
+    return Py_BuildValue("(sN)", estimates[chosen].name, estimates_list);
+}
+
+/*
+Input: Datapoints, and optionally dedup, standardize and p (See preprocess_options)
+Output: (points, representative) - the preprocessed points, and if dedup is set, the row of the result every original point ended up in
+(So H of the original points is [H[r] for r in representative]), otherwise None.
+*/
+static PyObject* preprocess(PyObject* self, PyObject* args) {
+    PyObject *lst, *ret;
+    double** dataPoints;
+    int n, d, *representative;
+    preprocess_options options;
+    memset(&options, 0, sizeof(options));
+    options.seed = RANDOM_SEED;
+    if(!PyArg_ParseTuple(args, "O|iii", &lst, &options.dedup, &options.standardize, &options.pca_components) || options.pca_components < 0) {
+        PyErr_SetString(PyExc_TypeError, ERR_PREPROCESS_FORMAT);
+        return NULL;
+    }
+    if (!PyList_Check(lst)) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    if ((d = checkMatrixShape(lst, -1)) < 0)
+        return NULL;
+    dataPoints = getDataPoints(lst);
+    if(dataPoints == NULL) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    n = PyList_Size(lst);
+    if(preprocess_points(&dataPoints, &n, &d, &options, &representative) == 1) {
+        free(representative);
+        freeDataPoints(dataPoints, n);
+        return PyErr_NoMemory();
+    }
+    if(representative != NULL)
+        ret = Py_BuildValue("(NN)", MatrixToPyList(dataPoints, n, d), LabelsToPyList(representative, PyList_Size(lst)));
+    else
+        ret = Py_BuildValue("(NO)", MatrixToPyList(dataPoints, n, d), Py_None);
+    free(representative);
+    freeDataPoints(dataPoints, n);
+    return ret;
+}
+
+/* The path set_checkpoint points checkpoint_path at */
+static char checkpoint_file[MAX_PATH_LENGTH];
+
+/*
+Input: A checkpoint file (or None to stop checkpointing), and optionally the iterations between checkpoints
+Output: None
+Every later optimization checkpoints into the file, and resumes from it if it already holds a checkpoint of the same n and k,
+of the input given to checkpoint_input (See checkpoint_path). Until checkpoint_input is called, nothing is resumed from.
+*/
+static PyObject* set_checkpoint(PyObject* self, PyObject* args) {
+    const char* path;
+    int every = checkpoint_interval;
+    if(!PyArg_ParseTuple(args, "z|i", &path, &every)) {
+        PyErr_SetString(PyExc_TypeError, ERR_CHECKPOINT_FORMAT);
+        return NULL;
+    }
+    if(every < 1 || (path != NULL && (path[0] == '\0' || temp_file_name(path, ".W", checkpoint_file) == 1))) {
+        PyErr_SetString(PyExc_ValueError, ERR_CHECKPOINT_FORMAT);
+        return NULL;
+    }
+    if(path != NULL)
+        strcpy(checkpoint_file, path);
+    checkpoint_path = (path == NULL) ? NULL : checkpoint_file;
+    checkpoint_interval = every;
+    Py_RETURN_NONE;
+}
+
+/*
+Input: A checkpoint file, n and k
+Output: (iteration, delta, W path or None) of the checkpoint in the file if it is one of an n*k H of the input given to checkpoint_input, otherwise None
+*/
+static PyObject* checkpoint_info(PyObject* self, PyObject* args) {
+    const char* path;
+    char W_path[MAX_PATH_LENGTH];
+    int n, k, iteration;
+    double delta;
+    if(!PyArg_ParseTuple(args, "sii", &path, &n, &k)) {
+        PyErr_SetString(PyExc_TypeError, ERR_CHECKPOINT_FORMAT);
+        return NULL;
+    }
+    if(read_checkpoint(path, NULL, n, k, checkpoint_fingerprint, &iteration, &delta, W_path) == 1)
+        Py_RETURN_NONE;
+    if(W_path[0] == '\0')
+        return Py_BuildValue("(idO)", iteration, delta, Py_None);
+    return Py_BuildValue("(ids)", iteration, delta, W_path);
+}
+
+/*
+Input: Datapoints, and optionally the seed the initial H is drawn with
+Output: None
+Tells checkpointing that the later optimizations are of these datapoints (under the current kernel) and this initial H,
+so they only resume from a checkpoint of the same input (See input_fingerprint). Call it again whenever the input changes.
+*/
+static PyObject* checkpoint_input(PyObject* self, PyObject* args) {
+    PyObject* lst;
+    double** dataPoints;
+    unsigned long seed = 0;
+    int n;
+    if(!PyArg_ParseTuple(args, "O|k", &lst, &seed) || !PyList_Check(lst) || PyList_Size(lst) == 0) {
+        PyErr_SetString(PyExc_TypeError, ERR_CHECKPOINT_INPUT_FORMAT);
+        return NULL;
+    }
+    dataPoints = getDataPoints(lst);
+    if(dataPoints == NULL) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    n = PyList_Size(lst);
+    checkpoint_fingerprint = input_fingerprint(dataPoints, n, PyList_Size(PyList_GetItem(lst, 0)), seed);
+    freeDataPoints(dataPoints, n);
+    if(checkpoint_fingerprint == 0)
+        return PyErr_NoMemory();
+    Py_RETURN_NONE;
+}
+
+/*
+Input: Datapoints and H
+Output: Final H
+Same as symnmf, but takes the datapoints instead of W, and never stores W (it is recomputed on every iteration).
+Memory is O(nd + nk), for inputs too large for a single n*n matrix.
+*/
+static PyObject* symnmf_matrix_free(PyObject* self, PyObject* args) {
+    PyObject *lstX, *lstH, *ret;
+    double** H, **X;
+    int n, k, d;
+    if(!PyArg_ParseTuple(args, "OO", &lstX, &lstH)) {
+        PyErr_SetString(PyExc_TypeError, ERR_SYMNMF_FORMAT);
+        return NULL;
+    }
+    if (!PyList_Check(lstH) || !PyList_Check(lstX)) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    if ((d = checkMatrixShape(lstX, -1)) < 0 || (k = checkMatrixShape(lstH, PyList_Size(lstX))) < 0)
+        return NULL;
+    n = PyList_Size(lstH);
+    H = getDataPoints(lstH);
+    X = (H == NULL) ? NULL : getDataPoints(lstX);
+    if(X == NULL) {
+        if (H != NULL)
+            freeDataPoints(H, n);
+        return NULL;
+    }
+    H = optimizing_H_matrix_free(H, n, k, X, d);
+    freeDataPoints(X, n);
+    if (H == NULL)
+        return PyErr_NoMemory();
+    ret = MatrixToPyList(H, n, k);
+    freeDataPoints(H, n);
+    return ret;
+}
+
+/*
+Input: Datapoints, H and the amount of worker processes
+Output: Final H
+Same as symnmf_matrix_free, but W is split by rows among the worker processes (See distributed_symnmf): each one builds and keeps
+only its own rows, and they exchange only H and (H^T)H. Gives the same H as symnmf on the full W.
+*/
+static PyObject* symnmf_distributed(PyObject* self, PyObject* args) {
+    PyObject *lstX, *lstH, *ret;
+    double** H, **X, **result;
+    int n, k, d, workers;
+    if(!PyArg_ParseTuple(args, "OOi", &lstX, &lstH, &workers)) {
+        PyErr_SetString(PyExc_TypeError, ERR_SYMNMF_FORMAT);
+        return NULL;
+    }
+    if (!PyList_Check(lstH) || !PyList_Check(lstX)) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    if ((d = checkMatrixShape(lstX, -1)) < 0 || (k = checkMatrixShape(lstH, PyList_Size(lstX))) < 0)
+        return NULL;
+    n = PyList_Size(lstH);
+    H = getDataPoints(lstH);
+    X = (H == NULL) ? NULL : getDataPoints(lstX);
+    if(X == NULL) {
+        if (H != NULL)
+            freeDataPoints(H, n);
+        return NULL;
+    }
+    result = distributed_symnmf(X, n, d, k, H, 0, workers);
+    freeDataPoints(X, n);
+    freeDataPoints(H, n);
+    if (result == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "The worker processes failed");
+        return NULL;
+    }
+    ret = MatrixToPyList(result, n, k);
+    freeDataPoints(result, n);
+    return ret;
+}
+
+/*
+Input: Datapoints Py List and a file path
+Output: None
+Writes the normalized similarity matrix W to the file in the binary matrix format, one row panel at a time.
+The file can then be passed to symnmf_file any number of times (e.g. across restarts) without recomputing W.
+*/
+static PyObject* norm_to_file(PyObject* self, PyObject* args) {
+    PyObject* lst;
+    const char* filename;
+    double** dataPoints;
+    int n, failed;
+    if(!PyArg_ParseTuple(args, "Os", &lst, &filename)) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    if (!PyList_Check(lst)) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    dataPoints = getDataPoints(lst);
+    if(dataPoints == NULL) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    n = PyList_Size(lst);
+    failed = normalized_similarity_to_file(dataPoints, n, PyList_Size(PyList_GetItem(lst, 0)), filename);
+    freeDataPoints(dataPoints, n);
+    if(failed)
+        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, filename);
+    Py_RETURN_NONE;
+}
+
+/*
+Input: A file path
+Output: (n, mean) of the W stored in the file
+Lets the caller check that a stored W fits its data, and initialize H (see 1.4.1) without loading W.
+*/
+static PyObject* norm_file_info(PyObject* self, PyObject* args) {
+    const char* filename;
+    int rows;
+    double mean;
+    FILE* fp;
+    if(!PyArg_ParseTuple(args, "s", &filename))
+        return NULL;
+    errno = 0;
+    fp = open_matrix_file(filename, &rows, NULL, NULL, &mean, NULL);
+    if(fp == NULL)
+        return matrixFileError(filename);
+    fclose(fp);
+    return Py_BuildValue("(id)", rows, mean);
+}
+
+/*
+Input: Datapoints Py List and a file path
+Output: True if the file holds the W of exactly these datapoints under the current kernel (See input_fingerprint), False otherwise
+Lets the caller reuse a stored W only for the input it was built from - a W file of another input (or an unreadable one) is rebuilt.
+*/
+static PyObject* norm_file_matches(PyObject* self, PyObject* args) {
+    PyObject* lst;
+    const char* filename;
+    double** dataPoints;
+    int n, rows, cols;
+    unsigned long stored, expected;
+    FILE* fp;
+    if(!PyArg_ParseTuple(args, "Os", &lst, &filename) || !PyList_Check(lst)) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    dataPoints = getDataPoints(lst);
+    if(dataPoints == NULL) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    n = PyList_Size(lst);
+    expected = input_fingerprint(dataPoints, n, PyList_Size(PyList_GetItem(lst, 0)), 0);
+    freeDataPoints(dataPoints, n);
+    fp = open_matrix_file(filename, &rows, &cols, NULL, NULL, &stored);
+    if(fp == NULL)
+        Py_RETURN_FALSE;
+    fclose(fp);
+    if(rows != n || cols != n || expected == 0 || stored != expected)
+        Py_RETURN_FALSE;
+    Py_RETURN_TRUE;
+}
+
+/*
+Input: A file path holding W (see norm_to_file) and H
+Output: Final H
+Same as symnmf, but streams W from the file on every iteration instead of keeping it in memory.
+A missing or unreadable file is an OSError (like norm_file_info), a W of another size a ValueError, and only a failed allocation a MemoryError.
+*/
+static PyObject* symnmf_file(PyObject* self, PyObject* args) {
+    PyObject *lstH, *ret;
+    const char* filename;
+    double** H;
+    int n, k, rows, cols;
+    FILE* fp;
+    if(!PyArg_ParseTuple(args, "sO", &filename, &lstH)) {
+        PyErr_SetString(PyExc_TypeError, ERR_SYMNMF_FORMAT);
+        return NULL;
+    }
+    if (!PyList_Check(lstH)) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    if ((k = checkMatrixShape(lstH, -1)) < 0)
+        return NULL;
+    n = PyList_Size(lstH);
+    errno = 0;
+    fp = open_matrix_file(filename, &rows, &cols, NULL, NULL, NULL);
+    if(fp == NULL)
+        return matrixFileError(filename);
+    fclose(fp);
+    if(rows != n || cols != n) {
+        PyErr_SetString(PyExc_ValueError, ERR_W_FILE_SHAPE);
+        return NULL;
+    }
+    H = getDataPoints(lstH);
+    if(H == NULL)
+        return NULL;
+    errno = 0;
+    H = optimizing_H_out_of_core(H, n, k, filename);
+    if (H == NULL) /* The file was readable above, so this is an allocation or a read that failed midway */
+        return (errno == ENOMEM) ? PyErr_NoMemory() : PyErr_SetFromErrnoWithFilename(PyExc_OSError, filename);
+    ret = MatrixToPyList(H, n, k);
+    freeDataPoints(H, n);
+    return ret;
+}
+
+/*
+Input: Datapoints Py List, k, and optionally the max amount of iterations, epsilon and whether to use Hamerly's bounds
+Output: (centroids, labels)
+Performs HW1's K-means in C, and labels every point with its nearest final centroid.
+*/
+static PyObject* kmeans_labels(PyObject* self, PyObject* args) {
+    PyObject* lst, *ret;
+    double** dataPoints, **centroids;
+    int* labels;
+    int n, d, k, iter = KMEANS_DEFAULT_ITER, use_bounds = 1;
+    double epsilon = KMEANS_EPSILON;
+    if(!PyArg_ParseTuple(args, "Oi|idp", &lst, &k, &iter, &epsilon, &use_bounds)) {
+        PyErr_SetString(PyExc_TypeError, ERR_KMEANS_FORMAT);
+        return NULL;
+    }
+    if (!PyList_Check(lst) || k <= 1 || k >= PyList_Size(lst)) {
+        PyErr_SetString(PyExc_ValueError, ERR_KMEANS_FORMAT);
+        return NULL;
+    }
+    dataPoints = getDataPoints(lst);
+    if(dataPoints == NULL) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    n = PyList_Size(lst);
+    d = PyList_Size(PyList_GetItem(lst, 0));
+    centroids = alloc_matrix(k, d);
+    labels = (int*)malloc(n * sizeof(int));
+    if (centroids == NULL || labels == NULL || kmeans(dataPoints, n, d, k, iter, epsilon, use_bounds, centroids, labels) == -1) {
+        freeDataPoints(dataPoints, n);
+        free_matrix(centroids, k);
+        free(labels);
+        return PyErr_NoMemory();
+    }
+    freeDataPoints(dataPoints, n);
+    ret = Py_BuildValue("(NN)", MatrixToPyList(centroids, k, d), LabelsToPyList(labels, n));
+    free_matrix(centroids, k);
+    free(labels);
+    return ret;
+}
+
+/*
+Input: Datapoints Py List, a label for every point, and optionally the similarity matrix (the output of sym) of the points
+Output: The mean silhouette coefficient
+Computed in C without a full distance matrix. If the similarity matrix is given, the distances are recovered from it instead of recomputed,
+which assumes it was built with the current kernel (See set_kernel) - the kernel widths of the points are used to invert it.
+*/
+static PyObject* silhouette_score(PyObject* self, PyObject* args) {
+    PyObject* lst, *lstLabels, *lstA = NULL;
+    double** dataPoints, **A = NULL;
+    double score, *scales = NULL;
+    int* labels;
+    int n, d, k, status = 1;
+    if(!PyArg_ParseTuple(args, "OO|O", &lst, &lstLabels, &lstA) || !PyList_Check(lst) || !PyList_Check(lstLabels)
+        || PyList_Size(lstLabels) != PyList_Size(lst) || (lstA != NULL && lstA != Py_None && (!PyList_Check(lstA) || PyList_Size(lstA) != PyList_Size(lst)))) {
+        PyErr_SetString(PyExc_TypeError, ERR_SILHOUETTE_FORMAT);
+        return NULL;
+    }
+    n = PyList_Size(lst);
+    labels = getLabels(lstLabels, n, &k);
+    if(labels == NULL)
+        return NULL;
+    dataPoints = getDataPoints(lst);
+    if(lstA != NULL && lstA != Py_None)
+        A = getDataPoints(lstA);
+    if(dataPoints == NULL || (lstA != NULL && lstA != Py_None && A == NULL)) {
+        free(labels);
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    d = PyList_Size(PyList_GetItem(lst, 0));
+    Py_BEGIN_ALLOW_THREADS
+    if(A != NULL) /* The widths A was built with, to invert it (See pair_dist) */
+        scales = point_scales(dataPoints, n, d);
+    if(A == NULL || scales != NULL)
+        status = silhouette(dataPoints, n, d, labels, k, A, scales, &score);
+    Py_END_ALLOW_THREADS
+    free(scales);
+    freeDataPoints(dataPoints, n);
+    if(A != NULL)
+        freeDataPoints(A, n);
+    free(labels);
+    if(status == 1)
+        return PyErr_NoMemory();
+    if(status == 2) {
+        PyErr_SetString(PyExc_ValueError, ERR_SILHOUETTE_FORMAT);
+        return NULL;
+    }
+    return PyFloat_FromDouble(score);
+}
+
+/*
+A job of the native thread pool (See pool_worker): norm of the n*cols points in input, or symnmf of the W in input and the n*cols H.
+It is owned by a capsule, which the running worker and the done callback of its future both hold, so it outlives whichever is done last.
+cancelled is set (holding the GIL) once the future is cancelled, and read by the worker without it, between iterations.
+A job reads the kernel and the modes of the process (kernel_sigma, multilevel_solver, label_stop_window...) as it runs. The modes are only
+read from the environment when the module loads, and set_kernel is refused while any job is queued or running, so they can't change under it.
+*/
+typedef struct async_job {
+    struct async_job* next;
+    int kind, n, cols;
+    double **input, **H;
+    PyObject *future, *progress, *capsule;
+    PyObject* error; /* What the progress callable raised, if it did */
+    volatile int cancelled;
+} async_job;
+
+/* The native thread pool. pool_lock guards everything but pool_stopping, which only ever goes from 0 to 1. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_changed = PTHREAD_COND_INITIALIZER;
+static async_job *pool_head = NULL, *pool_tail = NULL;
+static pthread_t pool_threads[MAX_POOL_THREADS];
+static int pool_size = 0, pool_started = 0, pool_job_threads = 1;
+static int pool_jobs = 0; /* Jobs queued or running (See set_kernel) */
+static volatile int pool_stopping = 0;
+static PyObject* future_type = NULL; /* concurrent.futures.Future */
+
+/* Frees a job once nothing holds its capsule anymore. */
+static void free_async_job(PyObject* capsule) {
+    async_job* job = (async_job*)PyCapsule_GetPointer(capsule, NULL);
+    free_matrix(job->input, job->n);
+    free_matrix(job->H, job->n);
+    Py_XDECREF(job->future);
+    Py_XDECREF(job->progress);
+    Py_XDECREF(job->error);
+    free(job);
+}
+
+/* The done callback of a job's future: a cancelled future stops its job at the next iteration (or before it starts). */
+static PyObject* job_done(PyObject* capsule, PyObject* future) {
+    async_job* job = (async_job*)PyCapsule_GetPointer(capsule, NULL);
+    PyObject* cancelled = PyObject_CallMethod(future, "cancelled", NULL);
+    if (cancelled != NULL && PyObject_IsTrue(cancelled))
+        job->cancelled = 1;
+    Py_XDECREF(cancelled);
+    PyErr_Clear();
+    Py_RETURN_NONE;
+}
+
+/*
+The iteration hook of a symnmf job (See iteration_hook): calls its progress callable with (iteration, delta, objective), taking the GIL only for that.
+Asks the optimization to stop if the job was cancelled, the pool is shutting down or the callable raised (the exception becomes the job's result).
+*/
+static int job_progress(void* context, int iteration, double delta, double objective) {
+    async_job* job = (async_job*)context;
+    PyGILState_STATE gil;
+    PyObject *ret, *type, *value, *traceback;
+    if (job->progress != NULL && !job->cancelled && !pool_stopping) {
+        gil = PyGILState_Ensure();
+        ret = PyObject_CallFunction(job->progress, "idd", iteration, delta, objective);
+        if (ret == NULL) {
+            PyErr_Fetch(&type, &value, &traceback);
+            PyErr_NormalizeException(&type, &value, &traceback);
+            if (value != NULL && traceback != NULL)
+                PyException_SetTraceback(value, traceback);
+            job->error = (value != NULL) ? value : type;
+            Py_XDECREF(value == NULL ? NULL : type);
+            Py_XDECREF(traceback);
+        }
+        Py_XDECREF(ret);
+        PyGILState_Release(gil);
+    }
+    return job->cancelled || pool_stopping || job->error != NULL;
+}
+
+/*
+Runs a job without the GIL, and returns its result matrix (of n rows), or a null pointer if memory allocation failed
+(the optimization then returns instead of exiting, and finish_async_job sets MemoryError on the future).
+Checkpointing is left out, since the jobs may run concurrently and it is a single file (See checkpoint_path).
+*/
+static double** run_async_job(async_job* job) {
+    double** result;
+    w_source src;
+    if (job->kind == ASYNC_NORM)
+        result = normalized_similarity_from_points(job->input, job->n, job->cols);
+    else {
+        init_w_source(&src);
+        src.W = job->input;
+        src.on_iteration = job_progress;
+        src.hook_context = job;
+        if (multilevel_solver)
+            result = optimizing_H_multilevel(job->H, job->n, job->cols, &src, NULL);
+        else
+            result = optimizing_H_single_level(job->H, job->n, job->cols, &src, NULL);
+        job->H = NULL; /* Taken over by the optimization */
+    }
+    free_matrix(job->input, job->n); /* A future that is kept around shouldn't keep W alive */
+    job->input = NULL;
+    return result;
+}
+
+/*
+Holding the GIL, hands the result of a job (or the reason it has none) to its future, and lets go of the job.
+A future that was cancelled in the meantime refuses the result, which is then just dropped.
+*/
+static void finish_async_job(async_job* job, double** result) {
+    PyObject *value, *ret = NULL;
+    int cols = (job->kind == ASYNC_NORM) ? job->n : job->cols;
+    if (job->error != NULL)
+        ret = PyObject_CallMethod(job->future, "set_exception", "O", job->error);
+    else if (job->cancelled || pool_stopping)
+        ret = PyObject_CallMethod(job->future, "cancel", NULL);
+    else if (result == NULL)
+        ret = PyObject_CallMethod(job->future, "set_exception", "O", PyExc_MemoryError);
+    else if ((value = MatrixToPyList(result, job->n, cols)) != NULL) {
+        ret = PyObject_CallMethod(job->future, "set_result", "O", value);
+        Py_DECREF(value);
+    }
+    Py_XDECREF(ret);
+    PyErr_Clear();
+    free_matrix(result, job->n);
+    Py_CLEAR(job->future); /* The future holds the capsule through its callback - this breaks the cycle */
+    Py_DECREF(job->capsule); /* The worker's reference - may free the job */
+}
+
+/* A thread of the pool: runs the queued jobs in order, until the pool is shut down and the queue is empty. */
+static void* pool_worker(void* unused) {
+    async_job* job;
+    double** result;
+    int threads;
+    PyGILState_STATE gil;
+    (void)unused;
+    for (;;) {
+        pthread_mutex_lock(&pool_lock);
+        while (pool_head == NULL && !pool_stopping)
+            pthread_cond_wait(&pool_changed, &pool_lock);
+        job = pool_head;
+        if (job != NULL) {
+            pool_head = job->next;
+            if (pool_head == NULL)
+                pool_tail = NULL;
+        }
+        threads = pool_job_threads;
+        pthread_mutex_unlock(&pool_lock);
+        if (job == NULL)
+            return NULL;
+        omp_set_num_threads(threads);
+        result = (job->cancelled || pool_stopping) ? NULL : run_async_job(job);
+        pthread_mutex_lock(&pool_lock);
+        pool_jobs--; /* Before the future is done, so whoever waits on it may set the kernel right away */
+        pthread_mutex_unlock(&pool_lock);
+        gil = PyGILState_Ensure();
+        finish_async_job(job, result);
+        PyGILState_Release(gil);
+    }
+}
+
+/*
+Queues a job on the pool (starting its threads if needed) and returns the concurrent.futures.Future its result will be set on.
+Takes over the job, and frees it on failure. On failure, sets a Python exception and returns a null pointer.
+*/
+static PyObject* submit_async_job(async_job* job) {
+    static PyMethodDef done_def = {"job_done", job_done, METH_O, NULL};
+    PyObject *module, *future = NULL, *callback = NULL, *ret = NULL;
+    int failed = 0;
+    if (future_type == NULL && (module = PyImport_ImportModule("concurrent.futures")) != NULL) {
+        future_type = PyObject_GetAttrString(module, "Future");
+        Py_DECREF(module);
+    }
+    job->capsule = PyCapsule_New(job, NULL, free_async_job);
+    if (job->capsule == NULL) {
+        free_matrix(job->input, job->n);
+        free_matrix(job->H, job->n);
+        Py_XDECREF(job->progress);
+        free(job);
+        return NULL;
+    }
+    future = (future_type == NULL) ? NULL : PyObject_CallObject(future_type, NULL);
+    callback = (future == NULL) ? NULL : PyCFunction_New(&done_def, job->capsule);
+    ret = (callback == NULL) ? NULL : PyObject_CallMethod(future, "add_done_callback", "O", callback);
+    Py_XDECREF(callback);
+    Py_XDECREF(ret);
+    pthread_mutex_lock(&pool_lock);
+    if (pool_size == 0)
+        pool_size = (omp_get_num_procs() < MAX_POOL_THREADS) ? omp_get_num_procs() : MAX_POOL_THREADS;
+    failed = (ret == NULL || pool_stopping);
+    while (!failed && pool_started < pool_size)
+        if (pthread_create(&pool_threads[pool_started], NULL, pool_worker, NULL) == 0)
+            pool_started++;
+        else
+            failed = (pool_started == 0); /* Fewer threads will do */
+    if (!failed) {
+        Py_INCREF(future);
+        job->future = future;
+        if (pool_tail != NULL)
+            pool_tail->next = job;
+        else
+            pool_head = job;
+        pool_tail = job;
+        pool_jobs++;
+        pthread_cond_signal(&pool_changed);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (failed) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_RuntimeError, ERR_POOL_STOPPED);
+        Py_XDECREF(future);
+        Py_DECREF(job->capsule);
+        return NULL;
+    }
+    return future;
+}
+
+/*
+Input: Datapoints Py List
+Output: A concurrent.futures.Future of norm of the datapoints
+Like norm, but returns at once: the work runs on the native thread pool (See set_pool), without the GIL.
+In asyncio, await asyncio.wrap_future(future). Cancelling it before the job starts skips the job.
+*/
+static PyObject* norm_async(PyObject* self, PyObject* args) {
+    PyObject* lst;
+    async_job* job;
+    if(!PyArg_ParseTuple(args, "O", &lst) || !PyList_Check(lst) || PyList_Size(lst) == 0) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    job = (async_job*)calloc(1, sizeof(async_job));
+    if (job == NULL)
+        return PyErr_NoMemory();
+    job->kind = ASYNC_NORM;
+    job->n = PyList_Size(lst);
+    job->cols = PyList_Size(PyList_GetItem(lst, 0));
+    job->input = getDataPoints(lst);
+    if (job->input == NULL) {
+        free(job);
+        return NULL;
+    }
+    return submit_async_job(job);
+}
+
+/*
+Input: Matrices W and H, and optionally a progress callable
+Output: A concurrent.futures.Future of the final H
+Like symnmf, but returns at once: the iterations run on the native thread pool (See set_pool), without the GIL.
+After every iteration, progress(iteration, delta, objective) is called on the pool's thread (See iteration_hook) - in asyncio, hand it to the
+loop with call_soon_threadsafe. If it raises, the job stops and the future gets the exception.
+Cancelling the future (or the asyncio future wrapping it) stops the job at its next iteration. Nothing is checkpointed.
+*/
+static PyObject* symnmf_async(PyObject* self, PyObject* args) {
+    PyObject *lstW, *lstH, *progress = Py_None;
+    async_job* job;
+    if(!PyArg_ParseTuple(args, "OO|O", &lstW, &lstH, &progress) || (progress != Py_None && !PyCallable_Check(progress))) {
+        PyErr_SetString(PyExc_TypeError, ERR_ASYNC_FORMAT);
+        return NULL;
+    }
+    if (!PyList_Check(lstH) || !PyList_Check(lstW) || PyList_Size(lstH) == 0 || PyList_Size(lstW) != PyList_Size(lstH)) {
+        PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+        return NULL;
+    }
+    job = (async_job*)calloc(1, sizeof(async_job));
+    if (job == NULL)
+        return PyErr_NoMemory();
+    job->kind = ASYNC_SYMNMF;
+    job->n = PyList_Size(lstH);
+    job->cols = PyList_Size(PyList_GetItem(lstH, 0));
+    job->H = getDataPoints(lstH);
+    job->input = (job->H == NULL) ? NULL : getDataPoints(lstW);
+    if (job->input == NULL) {
+        free_matrix(job->H, job->n);
+        free(job);
+        return NULL;
+    }
+    if (progress != Py_None) {
+        Py_INCREF(progress);
+        job->progress = progress;
+    }
+    return submit_async_job(job);
+}
+
+/*
+Input: The amount of threads of the native pool, and optionally the OpenMP threads every job runs on (1 by default - the parallelism is across jobs)
+Output: None
+The pool only grows - threads that were already started stay. threads_per_job applies to the jobs that start afterwards.
+*/
+static PyObject* set_pool(PyObject* self, PyObject* args) {
+    int threads, threads_per_job = 1;
+    if(!PyArg_ParseTuple(args, "i|i", &threads, &threads_per_job)) {
+        PyErr_SetString(PyExc_TypeError, ERR_POOL_FORMAT);
+        return NULL;
+    }
+    if (threads < 1 || threads > MAX_POOL_THREADS || threads_per_job < 1) {
+        PyErr_SetString(PyExc_ValueError, ERR_POOL_FORMAT);
+        return NULL;
+    }
+    pthread_mutex_lock(&pool_lock);
+    pool_size = (threads > pool_started) ? threads : pool_started;
+    pool_job_threads = threads_per_job;
+    pthread_mutex_unlock(&pool_lock);
+    Py_RETURN_NONE;
+}
+
+/*
+Sets kernel_sigma and local_scaling_neighbor, unless the pool has jobs queued or running. Returns 0 if it did and 1 if it didn't.
+*/
+static int set_kernel_if_idle(double sigma, int m) {
+    int busy;
+    pthread_mutex_lock(&pool_lock);
+    busy = (pool_jobs > 0);
+    if (!busy) {
+        kernel_sigma = sigma;
+        local_scaling_neighbor = m;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return busy;
+}
+
+/*
+Stops the pool (registered with atexit, so no thread needs the GIL once the interpreter is gone): running jobs stop at their next iteration,
+every job still queued is cancelled, and the threads are joined. Later submissions raise RuntimeError.
+*/
+static PyObject* shutdown_pool(PyObject* self, PyObject* unused) {
+    int i, started;
+    pthread_mutex_lock(&pool_lock);
+    pool_stopping = 1;
+    pthread_cond_broadcast(&pool_changed);
+    started = pool_started;
+    pthread_mutex_unlock(&pool_lock);
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < started; i++)
+        pthread_join(pool_threads[i], NULL);
+    Py_END_ALLOW_THREADS
+    pool_started = 0;
+    Py_RETURN_NONE;
+}
+
 static PyMethodDef symnmfmethods[] = {
-    {"symnmf", symnmf, METH_VARARGS, "Performs SymNMF on a matrix."},
+    {"symnmf", symnmf, METH_VARARGS, "Performs SymNMF on a matrix. With top_m, returns (labels, memberships, confidences) instead of H."},
+    {"symnmf_points", symnmf_points, METH_VARARGS, "Performs Norm and then SymNMF on datapoints, drawing the initial H with a callable given mean(W)."},
     {"sym", sym, METH_VARARGS, "Performs Sym on a matrix."},
     {"ddg", ddg, METH_VARARGS, "Performs DDG on a matrix."},
     {"norm", norm, METH_VARARGS, "Performs Norm on a matrix."},
+    {"norm_mean", norm_mean, METH_VARARGS, "Mean of the normalized similarity matrix, without building it."},
+    {"plan", plan, METH_VARARGS, "Estimates memory and runtime of every mode of symnmf and picks the fastest that fits the memory budget."},
+    {"preprocess", preprocess, METH_VARARGS, "Drops duplicates, standardizes and projects datapoints onto principal components."},
+    {"set_checkpoint", set_checkpoint, METH_VARARGS, "Checkpoints every later optimization into a file (None - off), resuming from it if possible."},
+    {"checkpoint_info", checkpoint_info, METH_VARARGS, "Returns (iteration, delta, W path) of the checkpoint of an n*k H in a file, or None."},
+    {"checkpoint_input", checkpoint_input, METH_VARARGS, "Sets the datapoints (and seed) later optimizations are of, so only their checkpoints are resumed from."},
+    {"set_kernel", set_kernel, METH_VARARGS, "Sets the kernel width sigma, and optionally the neighbour m of local scaling (0 - off)."},
+    {"symnmf_matrix_free", symnmf_matrix_free, METH_VARARGS, "Performs SymNMF on datapoints without storing W."},
+    {"symnmf_distributed", symnmf_distributed, METH_VARARGS, "Performs SymNMF on datapoints with W split among worker processes."},
+    {"norm_to_file", norm_to_file, METH_VARARGS, "Writes Norm of a matrix to a binary file."},
+    {"norm_file_info", norm_file_info, METH_VARARGS, "Returns (n, mean) of a W stored by norm_to_file."},
+    {"norm_file_matches", norm_file_matches, METH_VARARGS, "Returns whether a file stored by norm_to_file holds the W of these datapoints."},
+    {"symnmf_file", symnmf_file, METH_VARARGS, "Performs SymNMF streaming W from a file."},
+    {"kmeans", kmeans_labels, METH_VARARGS, "Performs K-means, returns (centroids, labels)."},
+    {"silhouette", silhouette_score, METH_VARARGS, "Mean silhouette coefficient of labeled datapoints."},
+    {"norm_async", norm_async, METH_VARARGS, "Like norm, but returns a Future at once and runs on the native thread pool."},
+    {"symnmf_async", symnmf_async, METH_VARARGS, "Like symnmf, but returns a cancellable Future at once, optionally reporting progress(iteration, delta, objective)."},
+    {"set_pool", set_pool, METH_VARARGS, "Sets the threads of the native thread pool, and optionally the threads per job."},
+    {"shutdown_pool", shutdown_pool, METH_NOARGS, "Stops the native thread pool (done at exit)."},
     {NULL, NULL, 0, NULL}
 };
 
@@ -164,13 +1154,60 @@ static struct PyModuleDef symnmfmodule = {
 };
 
 PyMODINIT_FUNC PyInit_symnmfmodule(void) {
+    PyObject *atexit, *shutdown, *ret = NULL;
     PyObject* m = PyModule_Create(&symnmfmodule);
+    read_env_modes();
     if (m == NULL) {
         return NULL;
     }
+    atexit = PyImport_ImportModule("atexit"); /* The pool's threads must be done before the interpreter goes away */
+    shutdown = PyObject_GetAttrString(m, "shutdown_pool");
+    if (atexit != NULL && shutdown != NULL)
+        ret = PyObject_CallMethod(atexit, "register", "O", shutdown);
+    Py_XDECREF(atexit);
+    Py_XDECREF(shutdown);
+    if (ret == NULL) {
+        Py_DECREF(m);
+        return NULL;
+    }
+    Py_DECREF(ret);
     return m;
 }
 
+/*
+Checks that lst is a non-empty list of rows lists (of any amount of rows, if rows is -1) that all have the same non-zero length.
+Returns that length, or sets ValueError and returns -1. Only the shape is checked - getDataPoints checks the items.
+*/
+Py_ssize_t checkMatrixShape(PyObject* lst, Py_ssize_t rows) {
+    Py_ssize_t i, cols = -1;
+    PyObject* row;
+    if (PyList_Size(lst) == 0 || (rows >= 0 && PyList_Size(lst) != rows)) {
+        PyErr_SetString(PyExc_ValueError, ERR_SHAPE_FORMAT);
+        return -1;
+    }
+    for (i = 0; i < PyList_Size(lst); i++) {
+        row = PyList_GetItem(lst, i);
+        if (!PyList_Check(row) || PyList_Size(row) == 0 || (cols >= 0 && PyList_Size(row) != cols)) {
+            PyErr_SetString(PyExc_ValueError, ERR_SHAPE_FORMAT);
+            return -1;
+        }
+        cols = PyList_Size(row);
+    }
+    return cols;
+}
+
+/*
+Sets the OSError of a matrix file open_matrix_file failed on (errno must be 0 before the call) and returns NULL.
+A file that opened but has no valid header leaves errno at 0, and is reported as not a matrix file.
+*/
+PyObject* matrixFileError(const char* filename) {
+    if (errno == 0) {
+        PyErr_Format(PyExc_OSError, ERR_MATRIX_FILE, filename);
+        return NULL;
+    }
+    return PyErr_SetFromErrnoWithFilename(PyExc_OSError, filename);
+}
+
 void freeDataPoints(double** dataPoints, int n) {
     int i;
     for (i = 0; i < n; i++) {
@@ -183,18 +1220,29 @@ double** getDataPoints(PyObject* lst) {
     Py_ssize_t len = PyList_Size(lst);
     double** dataPoints = malloc(len * sizeof(double*)); /* TODO david replaced calloc with malloc, ok? */
     Py_ssize_t i, j;
+    if (dataPoints == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
     for (i = 0; i < len; i++) {
         PyObject* subList = PyList_GetItem(lst, i);
         if (!PyList_Check(subList)) {
             PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+            freeDataPoints(dataPoints, i);
             return NULL;
         }
         Py_ssize_t subListLen = PyList_Size(subList);
         dataPoints[i] = malloc(subListLen * sizeof(double)); /* TODO david replaced calloc with malloc, ok? */
+        if (dataPoints[i] == NULL) {
+            PyErr_NoMemory();
+            freeDataPoints(dataPoints, i);
+            return NULL;
+        }
         for(j = 0; j < subListLen; j++) {
             PyObject* cord = PyList_GetItem(subList, j);
             if (!PyFloat_Check(cord) && !PyLong_Check(cord)) {
                 PyErr_SetString(PyExc_TypeError, ERR_LIST_ITEM_FORMAT);
+                freeDataPoints(dataPoints, i + 1);
                 return NULL;
             }
             dataPoints[i][j] = PyFloat_AsDouble(cord);
@@ -203,6 +1251,38 @@ double** getDataPoints(PyObject* lst) {
     return dataPoints;
 }
 
+/*
+Like getDataPoints, but for a square matrix (W), which it allocates with alloc_matrix_first_touch - the rows are placed on the NUMA nodes
+of the threads that update them before the cells are copied in from this thread.
+*/
+double** getSquareMatrix(PyObject* lst) {
+    Py_ssize_t n = PyList_Size(lst), i, j;
+    PyObject *row, *cell;
+    double** M = alloc_matrix_first_touch(n, n);
+    if (M == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        row = PyList_GetItem(lst, i);
+        if (!PyList_Check(row) || PyList_Size(row) != n) {
+            free_matrix(M, n);
+            PyErr_SetString(PyExc_TypeError, ERR_LIST_FORMAT);
+            return NULL;
+        }
+        for (j = 0; j < n; j++) {
+            cell = PyList_GetItem(row, j);
+            if (!PyFloat_Check(cell) && !PyLong_Check(cell)) {
+                free_matrix(M, n);
+                PyErr_SetString(PyExc_TypeError, ERR_LIST_ITEM_FORMAT);
+                return NULL;
+            }
+            M[i][j] = PyFloat_AsDouble(cell);
+        }
+    }
+    return M;
+}
+
 PyObject* MatrixToPyList(double** matrix, int n, int m) {
     PyObject* lst = PyList_New(n), *num, *subList;
     int i, j;
@@ -216,3 +1296,72 @@ PyObject* MatrixToPyList(double** matrix, int n, int m) {
     }
     return lst;
 }
+
+PyObject* LabelsToPyList(int* labels, int n) {
+    PyObject* lst = PyList_New(n);
+    int i;
+    for (i = 0; i < n; i++) {
+        PyList_SET_ITEM(lst, i, PyLong_FromLong(labels[i]));
+    }
+    return lst;
+}
+
+/*
+Reads a Py List of n non-negative int labels into a NEW array, and puts the amount of clusters (max label + 1) into k.
+On failure, sets a Python exception and returns a null pointer.
+*/
+int* getLabels(PyObject* lst, int n, int* k) {
+    int i;
+    long label;
+    int* labels = malloc(n * sizeof(int));
+    if (labels == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    *k = 0;
+    for (i = 0; i < n; i++) {
+        label = PyLong_AsLong(PyList_GetItem(lst, i));
+        if (label < 0 || label >= n) {
+            free(labels);
+            PyErr_SetString(PyExc_ValueError, ERR_SILHOUETTE_FORMAT);
+            return NULL;
+        }
+        labels[i] = (int)label;
+        if (labels[i] + 1 > *k)
+            *k = labels[i] + 1;
+    }
+    return labels;
+}
+
+/*
+Given the final n*k association matrix H, returns (labels, top, confidence) instead of H itself:
+labels - the hard label argmax(H[i]) of every point, top - the top_m best clusters of every point (a list of lists, best first),
+confidence - the share H[i][label] / sum(H[i]) of every point. Only O(n*top_m) values cross over to Python instead of n*k.
+*/
+PyObject* MembershipsToPy(double** H, int n, int k, int top_m) {
+    PyObject* labels, *top, *confidence, *subList;
+    int i, m;
+    int** best = malloc(n * sizeof(int*));
+    double* conf = malloc(n * sizeof(double));
+    int* block = malloc((size_t)n * top_m * sizeof(int));
+    if (best == NULL || conf == NULL || block == NULL) {
+        free(best); free(conf); free(block);
+        return PyErr_NoMemory();
+    }
+    for (i = 0; i < n; i++)
+        best[i] = block + (size_t)i * top_m;
+    memberships(H, n, k, top_m, best, conf);
+    labels = PyList_New(n);
+    top = PyList_New(n);
+    confidence = PyList_New(n);
+    for (i = 0; i < n; i++) {
+        PyList_SET_ITEM(labels, i, PyLong_FromLong(best[i][0]));
+        subList = PyList_New(top_m);
+        for (m = 0; m < top_m; m++)
+            PyList_SET_ITEM(subList, m, PyLong_FromLong(best[i][m]));
+        PyList_SET_ITEM(top, i, subList);
+        PyList_SET_ITEM(confidence, i, PyFloat_FromDouble(conf[i]));
+    }
+    free(best); free(conf); free(block);
+    return Py_BuildValue("(NNN)", labels, top, confidence);
+}
@@ -3,14 +3,25 @@
 
 #include <Python.h>
 #include "symnmf.h"
+#include "clustering.h"
 
 /* Function declarations */
 static PyObject* symnmf(PyObject* self, PyObject* args);
 static PyObject* sym(PyObject* self, PyObject* args);
 static PyObject* ddg(PyObject* self, PyObject* args);
 static PyObject* norm(PyObject* self, PyObject* args);
+static PyObject* norm_mean(PyObject* self, PyObject* args);
+static PyObject* symnmf_matrix_free(PyObject* self, PyObject* args);
+static PyObject* norm_to_file(PyObject* self, PyObject* args);
+static PyObject* norm_file_info(PyObject* self, PyObject* args);
+static PyObject* symnmf_file(PyObject* self, PyObject* args);
+static PyObject* kmeans_labels(PyObject* self, PyObject* args);
+static PyObject* silhouette_score(PyObject* self, PyObject* args);
 double** getDataPoints(PyObject* lst);
 void freeDataPoints(double** dataPoints, int n);
 PyObject* MatrixToPyList(double** matrix, int n, int m);
+PyObject* LabelsToPyList(int* labels, int n);
+int* getLabels(PyObject* lst, int n, int* k);
+PyObject* MembershipsToPy(double** H, int n, int k, int top_m);
 
 #endif
\ No newline at end of file
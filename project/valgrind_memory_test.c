@@ -1,7 +1,7 @@
 /*
  * valgrind_memory_test.c - Memory leak test for symNMF implementation
  * 
- * Compile: gcc -ansi -Wall -Wextra -pedantic-errors -g valgrind_memory_test.c -o valgrind_memory_test -lm
+ * Compile: make libsymnmf.so && gcc -ansi -Wall -Wextra -pedantic-errors -g valgrind_memory_test.c -o valgrind_memory_test -L. -lsymnmf -Wl,-rpath,'$ORIGIN' -lm
  * Run with Valgrind: valgrind --leak-check=full --show-leak-kinds=all ./valgrind_memory_test
  */
 